@@ -1,3 +1,5 @@
+// Reference: https://www.felixcloutier.com/x86/
+
 namespace amd64 {
 
 struct Reg {
@@ -5,22 +7,22 @@ struct Reg {
 	u8 size;
 };
 
-extern const Reg rax, eax,  ax,   al;
-extern const Reg rcx, ecx,  cx,   cl;
-extern const Reg rdx, edx,  dx,   dl;
-extern const Reg rbx, ebx,  bx,   bl;
-extern const Reg rsp, esp,  sp,   spl;
-extern const Reg rbp, ebp,  bp,   bpl;
-extern const Reg rsi, esi,  si,   sil;
-extern const Reg rdi, edi,  di,   dil;
-extern const Reg r8,  r8d,  r8w,  r8b;
-extern const Reg r9,  r9d,  r9w,  r9b;
-extern const Reg r10, r10d, r10w, r10b;
-extern const Reg r11, r11d, r11w, r11b;
-extern const Reg r12, r12d, r12w, r12b;
-extern const Reg r13, r13d, r13w, r13b;
-extern const Reg r14, r14d, r14w, r14b;
-extern const Reg r15, r15d, r15w, r15b;
+constexpr Reg rax = {0,  64}, eax  = {0,  32}, ax   = {0,  16}, al   = {0,  8};
+constexpr Reg rcx = {1,  64}, ecx  = {1,  32}, cx   = {1,  16}, cl   = {1,  8};
+constexpr Reg rdx = {2,  64}, edx  = {2,  32}, dx   = {2,  16}, dl   = {2,  8};
+constexpr Reg rbx = {3,  64}, ebx  = {3,  32}, bx   = {3,  16}, bl   = {3,  8};
+constexpr Reg rsp = {4,  64}, esp  = {4,  32}, sp   = {4,  16}, spl  = {4,  8};
+constexpr Reg rbp = {5,  64}, ebp  = {5,  32}, bp   = {5,  16}, bpl  = {5,  8};
+constexpr Reg rsi = {6,  64}, esi  = {6,  32}, si   = {6,  16}, sil  = {6,  8};
+constexpr Reg rdi = {7,  64}, edi  = {7,  32}, di   = {7,  16}, dil  = {7,  8};
+constexpr Reg r8  = {8,  64}, r8d  = {8,  32}, r8w  = {8,  16}, r8b  = {8,  8};
+constexpr Reg r9  = {9,  64}, r9d  = {9,  32}, r9w  = {9,  16}, r9b  = {9,  8};
+constexpr Reg r10 = {10, 64}, r10d = {10, 32}, r10w = {10, 16}, r10b = {10, 8};
+constexpr Reg r11 = {11, 64}, r11d = {11, 32}, r11w = {11, 16}, r11b = {11, 8};
+constexpr Reg r12 = {12, 64}, r12d = {12, 32}, r12w = {12, 16}, r12b = {12, 8};
+constexpr Reg r13 = {13, 64}, r13d = {13, 32}, r13w = {13, 16}, r13b = {13, 8};
+constexpr Reg r14 = {14, 64}, r14d = {14, 32}, r14w = {14, 16}, r14b = {14, 8};
+constexpr Reg r15 = {15, 64}, r15d = {15, 32}, r15w = {15, 16}, r15b = {15, 8};
 
 enum Error {
 	ErrScale = AsmErrCount,
@@ -33,19 +35,91 @@ struct I {
 	u8  scale;
 };
 
-I operator*(Reg r, u8 scale);
+constexpr I operator*(Reg r, u8 scale) { return {r, scale}; }
 
+// With label it is [rip+disp32] to that label_num, see
+// ptr(Assembler&, LabelId, s32)
 struct Ptr {
 	s32 offset;
 	Reg base;
 	Reg index;
 	u8  scale;
+	u32 label = 0;
+};
+
+constexpr Ptr ptr(Reg base, I i, s32 offset = 0) { return {offset, base, i.index, i.scale}; }
+constexpr Ptr ptr(Reg base, s32 offset = 0) { return ptr(base, {}, offset); }
+constexpr Ptr ptr(I i, s32 offset = 0) { return ptr({}, i, offset); }
+constexpr Ptr ptr(s32 offset) { return ptr({}, {}, offset); }
+
+// Vector register of size bits. Under EVEX the destination can be
+// masked by k (see mask), 0 means no masking.
+struct Vec {
+	u8   code;
+	u16  size;
+	u8   k = 0;
+	bool z = false; // zero the masked elements instead of keeping them
+};
+
+constexpr Vec xmm0  = {0,  128}, ymm0  = {0,  256}, zmm0  = {0,  512};
+constexpr Vec xmm1  = {1,  128}, ymm1  = {1,  256}, zmm1  = {1,  512};
+constexpr Vec xmm2  = {2,  128}, ymm2  = {2,  256}, zmm2  = {2,  512};
+constexpr Vec xmm3  = {3,  128}, ymm3  = {3,  256}, zmm3  = {3,  512};
+constexpr Vec xmm4  = {4,  128}, ymm4  = {4,  256}, zmm4  = {4,  512};
+constexpr Vec xmm5  = {5,  128}, ymm5  = {5,  256}, zmm5  = {5,  512};
+constexpr Vec xmm6  = {6,  128}, ymm6  = {6,  256}, zmm6  = {6,  512};
+constexpr Vec xmm7  = {7,  128}, ymm7  = {7,  256}, zmm7  = {7,  512};
+constexpr Vec xmm8  = {8,  128}, ymm8  = {8,  256}, zmm8  = {8,  512};
+constexpr Vec xmm9  = {9,  128}, ymm9  = {9,  256}, zmm9  = {9,  512};
+constexpr Vec xmm10 = {10, 128}, ymm10 = {10, 256}, zmm10 = {10, 512};
+constexpr Vec xmm11 = {11, 128}, ymm11 = {11, 256}, zmm11 = {11, 512};
+constexpr Vec xmm12 = {12, 128}, ymm12 = {12, 256}, zmm12 = {12, 512};
+constexpr Vec xmm13 = {13, 128}, ymm13 = {13, 256}, zmm13 = {13, 512};
+constexpr Vec xmm14 = {14, 128}, ymm14 = {14, 256}, zmm14 = {14, 512};
+constexpr Vec xmm15 = {15, 128}, ymm15 = {15, 256}, zmm15 = {15, 512};
+constexpr Vec xmm16 = {16, 128}, ymm16 = {16, 256}, zmm16 = {16, 512};
+constexpr Vec xmm17 = {17, 128}, ymm17 = {17, 256}, zmm17 = {17, 512};
+constexpr Vec xmm18 = {18, 128}, ymm18 = {18, 256}, zmm18 = {18, 512};
+constexpr Vec xmm19 = {19, 128}, ymm19 = {19, 256}, zmm19 = {19, 512};
+constexpr Vec xmm20 = {20, 128}, ymm20 = {20, 256}, zmm20 = {20, 512};
+constexpr Vec xmm21 = {21, 128}, ymm21 = {21, 256}, zmm21 = {21, 512};
+constexpr Vec xmm22 = {22, 128}, ymm22 = {22, 256}, zmm22 = {22, 512};
+constexpr Vec xmm23 = {23, 128}, ymm23 = {23, 256}, zmm23 = {23, 512};
+constexpr Vec xmm24 = {24, 128}, ymm24 = {24, 256}, zmm24 = {24, 512};
+constexpr Vec xmm25 = {25, 128}, ymm25 = {25, 256}, zmm25 = {25, 512};
+constexpr Vec xmm26 = {26, 128}, ymm26 = {26, 256}, zmm26 = {26, 512};
+constexpr Vec xmm27 = {27, 128}, ymm27 = {27, 256}, zmm27 = {27, 512};
+constexpr Vec xmm28 = {28, 128}, ymm28 = {28, 256}, zmm28 = {28, 512};
+constexpr Vec xmm29 = {29, 128}, ymm29 = {29, 256}, zmm29 = {29, 512};
+constexpr Vec xmm30 = {30, 128}, ymm30 = {30, 256}, zmm30 = {30, 512};
+constexpr Vec xmm31 = {31, 128}, ymm31 = {31, 256}, zmm31 = {31, 512};
+
+// AVX-512 opmask register
+struct Mask {
+	u8 code;
+};
+
+constexpr Mask k0 = {0}, k1 = {1}, k2 = {2}, k3 = {3}, k4 = {4}, k5 = {5}, k6 = {6}, k7 = {7};
+
+constexpr Vec mask(Vec v, Mask k, bool zero = false) { return {v.code, v.size, k.code, zero}; }
+
+struct VI {
+	Vec index;
+	u8  scale;
+};
+
+constexpr VI operator*(Vec v, u8 scale) { return {v, scale}; }
+
+// Memory operand of a gather, one address per element of index
+struct VPtr {
+	s32 offset;
+	Reg base;
+	Vec index;
+	u8  scale;
 };
 
-Ptr ptr(Reg base, I i, s32 offset = 0);
-Ptr ptr(Reg base, s32 offset = 0);
-Ptr ptr(I i, s32 offset = 0);
-Ptr ptr(s32 offset);
+constexpr VPtr ptr(Reg base, VI i, s32 offset = 0) { return {offset, base, i.index, i.scale}; }
+constexpr VPtr ptr(VI i, s32 offset = 0) { return ptr({}, i, offset); }
 
 enum Cond {
 	O  = 0x0,                       // overflow (OF=1)
@@ -66,6 +140,878 @@ enum Cond {
 	G  = 0xf, NLE = 0xf,            // greater/not less or equal (ZF=0 and SF=OF)
 };
 
+// Encoders that only compute the bytes of an instruction, so that
+// they can run in constant expressions (see Stencil). The functions
+// after them emit what they return into an Assembler.
+namespace enc {
+
+constexpr u8   size(Reg r) { return r.size; }
+constexpr u8   code(Reg r) { return r.code & 0b111; }
+constexpr bool isnew(Reg r) { return r.code & 0b1000; }
+
+constexpr bool isspecial(Reg r)
+{
+	// spl-dil require special treatment to distinguish from
+	// ah-bh (which I do not support)
+	return r.size == 8 && r.code >= sp.code && r.code <= di.code;
+}
+
+// n scales a disp8 (EVEX compressed displacement)
+constexpr u8 offsetsize(Ptr p, u8 n = 1)
+{
+	if (p.offset % n || p.offset/n < -128 || p.offset/n > 127)
+		return 4;
+	if (p.offset || code(p.base) == 0b101)
+		return 1;
+	return 0;
+}
+
+constexpr u8 size(Ptr p) { return p.base.size ? p.base.size : p.index.size; }
+
+constexpr int ptr_err(Ptr p)
+{
+	if (size(p.index) & 0x1f || size(p.base) & 0x1f)
+		return ErrSize; // less than 32 bits
+	if (size(p.index)) {
+		if (!p.scale || p.scale > 8 || p.scale&(p.scale - 1))
+			return ErrScale;
+		if (p.index.code == sp.code)
+			return ErrReg;
+		if (size(p.base) && size(p.base) != size(p.index))
+			return ErrSize;
+	}
+	return 0;
+}
+
+enum REX {
+	REX0 = 0b01000000,
+	REXW = 0b01001000,
+	REXR = 0b01000100,
+	REXX = 0b01000010,
+	REXB = 0b01000001,
+};
+
+enum Mod {
+	ModDisp0  = 0b00,
+	ModDisp1  = 0b01,
+	ModDisp4  = 0b10,
+	ModDirect = 0b11,
+};
+
+constexpr Mod mod(u8 offsetsize)
+{
+	switch (offsetsize) {
+		case 0: return ModDisp0;
+		case 1: return ModDisp1;
+		default: return ModDisp4;
+	}
+}
+
+constexpr u8 modrm(Mod mod, u8 reg, u8 rm) { return mod<<6 | reg<<3 | rm; }
+
+enum Scale {
+	Scale1 = 0b00,
+	Scale2 = 0b01,
+	Scale4 = 0b10,
+	Scale8 = 0b11,
+};
+
+constexpr Scale scale(u8 scale)
+{
+	switch (scale) {
+		case 1: return Scale1;
+		case 2: return Scale2;
+		case 4: return Scale4;
+		default: return Scale8; // anything else is rejected by ptr_err
+	}
+}
+
+constexpr u8 sib(Scale scale, u8 index, u8 base)
+{
+	return scale<<6 | index<<3 | base;
+}
+
+// Instructions are assembled in a pair of registers and then
+// emitted with a single store (see push_inst).
+struct [[nodiscard]] Inst {
+	u64 lo, hi; // little-endian bytes, at most 15 of them
+	u8  n;
+	u8  rel;    // position of the disp32 of a label operand holding its label_num, 0 for none
+	int err;    // the operands are not encodable
+};
+
+constexpr Inst fail(int err)
+{
+	Inst i = {};
+	i.err = err;
+	return i;
+}
+
+constexpr void put(Inst &i, u64 v, u8 count = 1)
+{
+	if (count < 8)
+		v &= ((u64)1 << 8*count) - 1;
+	if (i.n < 8) {
+		i.lo |= v << 8*i.n;
+		if (i.n)
+			i.hi |= v >> (64 - 8*i.n);
+	} else {
+		i.hi |= v << 8*(i.n - 8);
+	}
+	i.n += count;
+}
+
+constexpr Inst bytes(u64 v, u8 count)
+{
+	Inst i = {};
+	put(i, v, count);
+	return i;
+}
+
+constexpr void push_mod_sib_offset(Inst &i, u8 reg, Ptr p, u8 n = 1)
+{
+	if (p.label) {
+		put(i, modrm(ModDisp0, reg, 0b101));
+		if (size(p.base) || size(p.index))
+			i.err = ErrReg;
+		i.rel = i.n;
+		put(i, p.label, 4);
+		return;
+	}
+	if (!size(p.base)) {
+		put(i, modrm(ModDisp0, reg, 0b100));
+		if (size(p.index))
+			put(i, sib(scale(p.scale), code(p.index), 0b101));
+		else
+			put(i, sib(Scale1, 0b100, 0b101));
+		put(i, p.offset, 4);
+		return;
+	}
+	u8 osz = offsetsize(p, n);
+	if (!size(p.index) && code(p.base) != 0b100) {
+		put(i, modrm(mod(osz), reg, code(p.base)));
+	} else {
+		put(i, modrm(mod(osz), reg, 0b100));
+		if (size(p.index))
+			put(i, sib(scale(p.scale), code(p.index), code(p.base)));
+		else
+			put(i, sib(Scale1, 0b100, code(p.base)));
+	}
+	put(i, osz == 1 ? p.offset/n : p.offset, osz);
+}
+
+constexpr void push_prefixes(Inst &i, Reg r, Ptr p)
+{
+	if (size(p) == 32)
+		put(i, 0x67);
+	if (size(r) == 16)
+		put(i, 0x66);
+	u8 rex = 0;
+	if (isspecial(r) || isspecial(p.index) || isspecial(p.base))
+		rex |= REX0;
+	if (size(r) == 64)
+		rex |= REXW;
+	rex |= isnew(r)*REXR | isnew(p.index)*REXX | isnew(p.base)*REXB;
+	if (rex)
+		put(i, rex);
+}
+
+constexpr Inst inst(Reg r, Ptr rm, u8 op)
+{
+	if (int err = ptr_err(rm))
+		return fail(err);
+	Inst i = {};
+	push_prefixes(i, r, rm);
+	put(i, op + (size(r) > 8));
+	push_mod_sib_offset(i, code(r), rm);
+	return i;
+}
+
+constexpr void push_prefixes(Inst &i, Reg r, Reg rm)
+{
+	if (size(r) == 16)
+		put(i, 0x66);
+	u8 rex = 0;
+	if (isspecial(r) || isspecial(rm))
+		rex |= REX0;
+	if (size(r) == 64)
+		rex |= REXW;
+	rex |= isnew(r)*REXR | isnew(rm)*REXB;
+	if (rex)
+		put(i, rex);
+}
+
+constexpr Inst inst(Reg r, Reg rm, u8 op)
+{
+	if (size(r) != size(rm))
+		return fail(ErrSize);
+	Inst i = {};
+	push_prefixes(i, r, rm);
+	put(i, op + (size(r) > 8));
+	put(i, modrm(ModDirect, code(r), code(rm)));
+	return i;
+}
+
+constexpr void push_prefixes(Inst &i, Reg r)
+{
+	if (size(r) == 16)
+		put(i, 0x66);
+	u8 rex = 0;
+	if (isspecial(r))
+		rex |= REX0;
+	if (size(r) == 64)
+		rex |= REXW;
+	if (isnew(r))
+		rex |= REXB;
+	if (rex)
+		put(i, rex);
+}
+
+constexpr Inst inst(Reg dst, u8 src, u8 op)
+{
+	Inst i = {};
+	push_prefixes(i, dst);
+	put(i, op + (size(dst) > 8));
+	put(i, modrm(ModDirect, src, code(dst)));
+	return i;
+}
+
+constexpr Inst mov(Ptr dst, Reg src) { return inst(src, dst, 0x88); }
+constexpr Inst mov(Reg dst, Ptr src) { return inst(dst, src, 0x8a); }
+constexpr Inst mov(Reg dst, Reg src) { return inst(src, dst, 0x88); }
+
+constexpr Inst mov(Reg dst, u64 src)
+{
+	Inst i = {};
+	push_prefixes(i, dst);
+	put(i, (size(dst) == 8 ? 0xb0 : 0xb8) + code(dst));
+	put(i, src, size(dst)/8);
+	return i;
+}
+
+// mov between the accumulator and an absolute address, op is
+// 0xa0 for loads and 0xa2 for stores
+constexpr Inst moffs(Reg r, u64 addr, u8 op)
+{
+	if (r.code != rax.code)
+		return fail(ErrReg);
+	Inst i = {};
+	push_prefixes(i, r);
+	put(i, op + (size(r) > 8));
+	put(i, addr, 8);
+	return i;
+}
+
+constexpr Inst cmov(Cond c, Reg dst, Reg src)
+{
+	if (size(src) != size(dst) || size(src) == 8)
+		return fail(ErrSize);
+	Inst i = {};
+	push_prefixes(i, dst, src);
+	put(i, 0x0f);
+	put(i, 0x40 + c);
+	put(i, modrm(ModDirect, code(dst), code(src)));
+	return i;
+}
+
+constexpr Inst cmov(Cond c, Reg dst, Ptr src)
+{
+	if (size(src) == 8)
+		return fail(ErrSize);
+	if (int err = ptr_err(src))
+		return fail(err);
+	Inst i = {};
+	push_prefixes(i, dst, src);
+	put(i, 0x0f);
+	put(i, 0x40 + c);
+	push_mod_sib_offset(i, code(dst), src);
+	return i;
+}
+
+constexpr Inst xchg(Reg dst, Ptr src) { return inst(dst, src, 0x86); }
+constexpr Inst xchg(Reg dst, Reg src) { return inst(src, dst, 0x86); }
+
+constexpr Inst lea(Reg dst, Ptr src)
+{
+	if (size(dst) == 8)
+		return fail(ErrSize);
+	return inst(dst, src, 0x8c);
+}
+
+constexpr Inst inc(Reg dst) { return inst(dst, 0b000, 0xfe); }
+constexpr Inst dec(Reg dst) { return inst(dst, 0b001, 0xfe); }
+
+constexpr Inst arith(Reg dst, u32 src, u8 op)
+{
+	Inst i = {};
+	push_prefixes(i, dst);
+	if (dst.code == rax.code) {
+		put(i, 0x04 + (op << 3) + (size(dst) > 8));
+	} else {
+		put(i, 0x80 + (size(dst) > 8));
+		put(i, modrm(ModDirect, op, code(dst)));
+	}
+	if (size(dst) == 64)
+		put(i, src, 4);
+	else
+		put(i, src, size(dst)/8);
+	return i;
+}
+
+constexpr Inst add(Reg dst, Reg src) { return inst(src, dst, 0b000 << 3); }
+constexpr Inst add(Reg dst, u32 src) { return arith(dst, src, 0b000); }
+constexpr Inst or_(Reg dst, Reg src) { return inst(src, dst, 0b001 << 3); }
+constexpr Inst or_(Reg dst, u32 src) { return arith(dst, src, 0b001); }
+constexpr Inst and_(Reg dst, Reg src) { return inst(src, dst, 0b100 << 3); }
+constexpr Inst and_(Reg dst, u32 src) { return arith(dst, src, 0b100); }
+constexpr Inst sub(Reg dst, Reg src) { return inst(src, dst, 0b101 << 3); }
+constexpr Inst sub(Reg dst, u32 src) { return arith(dst, src, 0b101); }
+constexpr Inst xor_(Reg dst, Reg src) { return inst(src, dst, 0b110 << 3); }
+constexpr Inst xor_(Reg dst, u32 src) { return arith(dst, src, 0b110); }
+constexpr Inst cmp(Reg dst, Reg src) { return inst(src, dst, 0b111 << 3); }
+constexpr Inst cmp(Reg dst, u32 src) { return arith(dst, src, 0b111); }
+constexpr Inst test(Reg dst, Reg src) { return inst(src, dst, 0x84); }
+
+// Shortest forms of the above, they keep the result of the plain
+// ones but are not fixed size, so they can not be patched later.
+// Zeroing with xor clobbers the flags.
+constexpr Inst movshort(Reg dst, u64 src)
+{
+	if (!src && size(dst) == 64)
+		return xor_(Reg{dst.code, 32}, Reg{dst.code, 32});
+	if (!src)
+		return xor_(dst, dst);
+	if (size(dst) != 64 || src <= 0xffffffff)
+		return mov(size(dst) == 64 ? Reg{dst.code, 32} : dst, src);
+	if ((u64)(s32)src != src)
+		return mov(dst, src);
+	Inst i = inst(dst, 0b000, 0xc6); // sign extended imm32
+	put(i, src, 4);
+	return i;
+}
+
+constexpr Inst arithshort(Reg dst, u32 src, u8 op)
+{
+	if (op == 0b111 && !src)
+		return test(dst, dst);
+	s32 v = size(dst) == 16 ? (s16)src : (s32)src;
+	if (size(dst) == 8 || v < -128 || v > 127)
+		return arith(dst, src, op);
+	Inst i = inst(dst, op, 0x82);
+	put(i, src, 1);
+	return i;
+}
+
+constexpr Inst mul(Reg src) { return inst(src, 0x4, 0xf6); }
+constexpr Inst div(Reg src) { return inst(src, 0x6, 0xf6); }
+constexpr Inst neg(Reg dst) { return inst(dst, 0x3, 0xf6); }
+
+constexpr Inst imul(Reg dst, Reg src)
+{
+	if (size(src) != size(dst) || size(src) == 8)
+		return fail(ErrSize);
+	Inst i = {};
+	push_prefixes(i, dst, src);
+	put(i, 0x0f);
+	put(i, 0xaf);
+	put(i, modrm(ModDirect, code(dst), code(src)));
+	return i;
+}
+
+// Shift by a constant, op is the reg field of the modrm
+constexpr Inst shift(Reg dst, u8 n, u8 op)
+{
+	if (n >= size(dst))
+		return fail(ErrSize);
+	Inst i = inst(dst, op, 0xc0);
+	put(i, n, 1);
+	return i;
+}
+
+constexpr Inst shl(Reg dst, u8 n) { return shift(dst, n, 0x4); }
+constexpr Inst shr(Reg dst, u8 n) { return shift(dst, n, 0x5); }
+constexpr Inst sar(Reg dst, u8 n) { return shift(dst, n, 0x7); }
+
+// Load of a zero extended 8 or 16 bit value
+constexpr Inst movzx(Reg dst, Ptr src, u8 bits)
+{
+	if ((bits != 8 && bits != 16) || size(dst) <= bits)
+		return fail(ErrSize);
+	if (int err = ptr_err(src))
+		return fail(err);
+	Inst i = {};
+	push_prefixes(i, dst, src);
+	put(i, 0x0f);
+	put(i, 0xb6 + (bits == 16));
+	push_mod_sib_offset(i, code(dst), src);
+	return i;
+}
+
+// rel is counted from the end of the instruction
+constexpr Inst jcc(Cond c, s32 rel)
+{
+	Inst i = {};
+	put(i, 0x0f);
+	put(i, 0x80 + c);
+	put(i, rel, 4);
+	return i;
+}
+
+constexpr Inst jmp(s32 rel) { Inst i = {}; put(i, 0xe9); put(i, rel, 4); return i; }
+constexpr Inst call(s32 rel) { Inst i = {}; put(i, 0xe8); put(i, rel, 4); return i; }
+
+constexpr Inst jump(Ptr dst, u8 op)
+{
+	if (int err = ptr_err(dst))
+		return fail(err);
+	Inst i = {};
+	if (size(dst) == 32)
+		put(i, 0x67);
+	u8 rex = isnew(dst.index)*REXX | isnew(dst.base)*REXB;
+	if (rex)
+		put(i, rex);
+	put(i, 0xff);
+	push_mod_sib_offset(i, op, dst);
+	return i;
+}
+
+constexpr Inst jump(Reg dst, u8 op)
+{
+	if (size(dst) != 64)
+		return fail(ErrSize);
+	Inst i = {};
+	if (isnew(dst))
+		put(i, REXB);
+	put(i, 0xff);
+	put(i, modrm(ModDirect, op, code(dst)));
+	return i;
+}
+
+constexpr Inst jmp(Ptr dst) { return jump(dst, 0b100); }
+constexpr Inst jmp(Reg dst) { return jump(dst, 0b100); }
+constexpr Inst call(Ptr dst) { return jump(dst, 0b010); }
+constexpr Inst call(Reg dst) { return jump(dst, 0b010); }
+
+constexpr Inst pushpop(Reg dst, u8 op)
+{
+	if (size(dst) != 64)
+		return fail(ErrSize);
+	Inst i = {};
+	if (isnew(dst))
+		put(i, REXB);
+	put(i, op + code(dst));
+	return i;
+}
+
+constexpr Inst push(Reg dst) { return pushpop(dst, 0x50); }
+constexpr Inst pop(Reg dst) { return pushpop(dst, 0x58); }
+
+constexpr Inst ret() { return bytes(0xc3, 1); }
+constexpr Inst ud2() { return bytes(0x0b0f, 2); }
+constexpr Inst int3() { return bytes(0xcc, 1); }
+constexpr Inst syscall() { return bytes(0x050f, 2); }
+constexpr Inst mfence() { return bytes(0xf0ae0f, 3); }
+constexpr Inst rdtsc() { return bytes(0x310f, 2); }
+
+// Recommended nops of 1 to 9 bytes: nop dword [rax+rax*1+disp]
+// and its shorter forms, with a 66 prefix for 2, 6 and 9 bytes
+constexpr Inst nop(u8 n = 1)
+{
+	const u64 nops[] = {
+		0x90, 0x9066, 0x001f0f, 0x00401f0f, 0x0000441f0f,
+		0x0000441f0f66, 0x00000000801f0f, 0x0000000000841f0f,
+	};
+	if (!n || n > 9)
+		return fail(ErrSize);
+	if (n < 9)
+		return bytes(nops[n-1], n);
+	Inst i = bytes(0x66, 1);
+	put(i, nops[7], 8);
+	return i;
+}
+
+// Vector instructions, with a VEX or an EVEX prefix. Operands are
+// register numbers, reg and v from 0 to 31 and rm either a register
+// number or memory. EVEX is used when VEX can not encode them.
+
+enum VexMap {
+	Map0F = 1,
+	Map0F38,
+	Map0F3A,
+};
+
+enum VexPP {
+	PPNone,
+	PP66,
+	PPF3,
+	PPF2,
+};
+
+enum VexEnc {
+	VexEvex,  // both
+	VexOnly,  // AVX2 and earlier, no EVEX form
+	EvexOnly, // AVX-512
+};
+
+struct VForm {
+	u8 pp, map, op;
+	u8 vw = 0, ew = 0; // VEX.W, 0 where it is ignored, and EVEX.W
+	u8 enc = VexEvex;
+	u8 n = 0;  // EVEX disp8 scale, 0 for the vector size
+};
+
+constexpr void push_vex(Inst &i, VForm f, u16 vsize, u8 reg, u8 v, u8 x, u8 b)
+{
+	if (f.map == Map0F && !f.vw && !x && !b) {
+		put(i, 0xc5);
+		put(i, !(reg & 8) << 7 | (~v & 15) << 3 | (vsize == 256) << 2 | f.pp);
+	} else {
+		put(i, 0xc4);
+		put(i, !(reg & 8) << 7 | !x << 6 | !b << 5 | f.map);
+		put(i, f.vw << 7 | (~v & 15) << 3 | (vsize == 256) << 2 | f.pp);
+	}
+}
+
+// x and b extend the index and base, or bits 4 and 3 of a register rm,
+// vx is bit 4 of a vector index
+constexpr void push_evex(Inst &i, VForm f, u16 vsize, u8 reg, u8 v, u8 x, u8 b, u8 vx, u8 k, bool z)
+{
+	put(i, 0x62);
+	put(i, !(reg & 8) << 7 | !x << 6 | !b << 5 | !(reg & 16) << 4 | f.map);
+	put(i, f.ew << 7 | (~v & 15) << 3 | 1 << 2 | f.pp);
+	put(i, z << 7 | vsize/256 << 5 | !((v & 16) || vx) << 3 | k);
+}
+
+constexpr int evex_err(VForm f, bool evex, u16 vsize)
+{
+	if (evex && f.enc == VexOnly)
+		return vsize == 512 ? ErrSize : ErrReg;
+	return 0;
+}
+
+constexpr Inst vinst(VForm f, u16 vsize, u8 reg, u8 v, u8 rm, u8 k = 0, bool z = false)
+{
+	bool evex = f.enc == EvexOnly || vsize == 512 || (reg | v | rm) & 16 || k || z;
+	if (int err = evex_err(f, evex, vsize))
+		return fail(err);
+	Inst i = {};
+	if (evex)
+		push_evex(i, f, vsize, reg, v, rm >> 4 & 1, rm >> 3 & 1, 0, k, z);
+	else
+		push_vex(i, f, vsize, reg, v, 0, rm >> 3 & 1);
+	put(i, f.op);
+	put(i, modrm(ModDirect, reg & 7, rm & 7));
+	return i;
+}
+
+constexpr int vsib_err(Ptr p)
+{
+	if (size(p.base) & 0x1f)
+		return ErrSize;
+	if (!p.scale || p.scale > 8 || p.scale&(p.scale - 1))
+		return ErrScale;
+	return 0;
+}
+
+// vsib: the index of p is a vector register
+constexpr Inst vinst(VForm f, u16 vsize, u8 reg, u8 v, Ptr p, u8 k = 0, bool z = false, bool vsib = false)
+{
+	if (int err = vsib ? vsib_err(p) : ptr_err(p))
+		return fail(err);
+	u8 vx = vsib && (p.index.code & 16);
+	bool evex = f.enc == EvexOnly || vsize == 512 || (reg | v) & 16 || vx || k || z;
+	if (int err = evex_err(f, evex, vsize))
+		return fail(err);
+	Inst i = {};
+	if (size(p) == 32)
+		put(i, 0x67);
+	u8 x = p.index.code >> 3 & 1, b = p.base.code >> 3 & 1;
+	if (evex)
+		push_evex(i, f, vsize, reg, v, x, b, vx, k, z);
+	else
+		push_vex(i, f, vsize, reg, v, x, b);
+	put(i, f.op);
+	push_mod_sib_offset(i, reg & 7, p, evex ? (f.n ? f.n : vsize/8) : 1);
+	return i;
+}
+
+constexpr Inst imm8(Inst i, u8 imm)
+{
+	if (!i.err)
+		put(i, imm);
+	return i;
+}
+
+// d = op(a, b) elementwise
+constexpr Inst v3(VForm f, Vec d, Vec a, Vec b)
+{
+	if (d.size != a.size || a.size != b.size)
+		return fail(ErrSize);
+	return vinst(f, d.size, d.code, a.code, b.code, d.k, d.z);
+}
+
+constexpr Inst v3(VForm f, Vec d, Vec a, Ptr b)
+{
+	if (d.size != a.size)
+		return fail(ErrSize);
+	return vinst(f, d.size, d.code, a.code, b, d.k, d.z);
+}
+
+// d = op(s)
+constexpr Inst v2(VForm f, Vec d, Vec s)
+{
+	if (d.size != s.size)
+		return fail(ErrSize);
+	return vinst(f, d.size, d.code, 0, s.code, d.k, d.z);
+}
+
+constexpr Inst v2(VForm f, Vec d, Ptr s) { return vinst(f, d.size, d.code, 0, s, d.k, d.z); }
+
+constexpr Inst vstore(VForm f, Ptr d, Vec s)
+{
+	if (s.z)
+		return fail(ErrReg); // stores only merge
+	return vinst(f, s.size, s.code, 0, d, s.k);
+}
+
+constexpr VForm VMOVDQU = {PPF3, Map0F, 0x6f, 0, 0, VexEvex, 0};
+constexpr VForm VMOVUPS = {PPNone, Map0F, 0x10, 0, 0, VexEvex, 0};
+
+constexpr Inst vmovdqu(Vec d, Vec s) { return v2(VMOVDQU, d, s); }
+constexpr Inst vmovdqu(Vec d, Ptr s) { return v2(VMOVDQU, d, s); }
+constexpr Inst vmovdqu(Ptr d, Vec s) { return vstore({PPF3, Map0F, 0x7f}, d, s); }
+constexpr Inst vmovups(Vec d, Vec s) { return v2(VMOVUPS, d, s); }
+constexpr Inst vmovups(Vec d, Ptr s) { return v2(VMOVUPS, d, s); }
+constexpr Inst vmovups(Ptr d, Vec s) { return vstore({PPNone, Map0F, 0x11}, d, s); }
+
+constexpr VForm VPADDD = {PP66, Map0F, 0xfe, 0, 0, VexEvex, 0};
+constexpr VForm VPADDQ = {PP66, Map0F, 0xd4, 0, 1, VexEvex, 0};
+constexpr VForm VPSUBD = {PP66, Map0F, 0xfa, 0, 0, VexEvex, 0};
+constexpr VForm VPMULLD = {PP66, Map0F38, 0x40, 0, 0, VexEvex, 0};
+constexpr VForm VPAND = {PP66, Map0F, 0xdb, 0, 0, VexEvex, 0}; // vpandd under EVEX
+constexpr VForm VPOR = {PP66, Map0F, 0xeb, 0, 0, VexEvex, 0};
+constexpr VForm VPXOR = {PP66, Map0F, 0xef, 0, 0, VexEvex, 0};
+constexpr VForm VADDPS = {PPNone, Map0F, 0x58, 0, 0, VexEvex, 0};
+constexpr VForm VADDPD = {PP66, Map0F, 0x58, 0, 1, VexEvex, 0};
+constexpr VForm VMULPS = {PPNone, Map0F, 0x59, 0, 0, VexEvex, 0};
+constexpr VForm VMULPD = {PP66, Map0F, 0x59, 0, 1, VexEvex, 0};
+
+constexpr Inst vpaddd(Vec d, Vec a, Vec b) { return v3(VPADDD, d, a, b); }
+constexpr Inst vpaddd(Vec d, Vec a, Ptr b) { return v3(VPADDD, d, a, b); }
+constexpr Inst vpaddq(Vec d, Vec a, Vec b) { return v3(VPADDQ, d, a, b); }
+constexpr Inst vpaddq(Vec d, Vec a, Ptr b) { return v3(VPADDQ, d, a, b); }
+constexpr Inst vpsubd(Vec d, Vec a, Vec b) { return v3(VPSUBD, d, a, b); }
+constexpr Inst vpsubd(Vec d, Vec a, Ptr b) { return v3(VPSUBD, d, a, b); }
+constexpr Inst vpmulld(Vec d, Vec a, Vec b) { return v3(VPMULLD, d, a, b); }
+constexpr Inst vpmulld(Vec d, Vec a, Ptr b) { return v3(VPMULLD, d, a, b); }
+constexpr Inst vpand(Vec d, Vec a, Vec b) { return v3(VPAND, d, a, b); }
+constexpr Inst vpand(Vec d, Vec a, Ptr b) { return v3(VPAND, d, a, b); }
+constexpr Inst vpor(Vec d, Vec a, Vec b) { return v3(VPOR, d, a, b); }
+constexpr Inst vpor(Vec d, Vec a, Ptr b) { return v3(VPOR, d, a, b); }
+constexpr Inst vpxor(Vec d, Vec a, Vec b) { return v3(VPXOR, d, a, b); }
+constexpr Inst vpxor(Vec d, Vec a, Ptr b) { return v3(VPXOR, d, a, b); }
+constexpr Inst vaddps(Vec d, Vec a, Vec b) { return v3(VADDPS, d, a, b); }
+constexpr Inst vaddps(Vec d, Vec a, Ptr b) { return v3(VADDPS, d, a, b); }
+constexpr Inst vaddpd(Vec d, Vec a, Vec b) { return v3(VADDPD, d, a, b); }
+constexpr Inst vaddpd(Vec d, Vec a, Ptr b) { return v3(VADDPD, d, a, b); }
+constexpr Inst vmulps(Vec d, Vec a, Vec b) { return v3(VMULPS, d, a, b); }
+constexpr Inst vmulps(Vec d, Vec a, Ptr b) { return v3(VMULPS, d, a, b); }
+constexpr Inst vmulpd(Vec d, Vec a, Vec b) { return v3(VMULPD, d, a, b); }
+constexpr Inst vmulpd(Vec d, Vec a, Ptr b) { return v3(VMULPD, d, a, b); }
+
+// Comparisons into a vector are AVX2, into a mask AVX-512
+constexpr VForm VPCMPEQD = {PP66, Map0F, 0x76, 0, 0, VexOnly, 0};
+constexpr VForm VPCMPGTD = {PP66, Map0F, 0x66, 0, 0, VexOnly, 0};
+constexpr VForm KPCMPEQD = {PP66, Map0F, 0x76, 0, 0, EvexOnly, 0};
+constexpr VForm KPCMPGTD = {PP66, Map0F, 0x66, 0, 0, EvexOnly, 0};
+constexpr VForm KPCMPD = {PP66, Map0F3A, 0x1f, 0, 0, EvexOnly, 0};
+constexpr VForm VCMPPS = {PPNone, Map0F, 0xc2, 0, 0, VexOnly, 0};
+constexpr VForm KCMPPS = {PPNone, Map0F, 0xc2, 0, 0, EvexOnly, 0};
+
+constexpr Inst k3(VForm f, Mask k, Vec a, Vec b)
+{
+	if (a.size != b.size)
+		return fail(ErrSize);
+	return vinst(f, a.size, k.code, a.code, b.code);
+}
+
+constexpr Inst k3(VForm f, Mask k, Vec a, Ptr b) { return vinst(f, a.size, k.code, a.code, b); }
+
+constexpr Inst vpcmpeqd(Vec d, Vec a, Vec b) { return v3(VPCMPEQD, d, a, b); }
+constexpr Inst vpcmpeqd(Vec d, Vec a, Ptr b) { return v3(VPCMPEQD, d, a, b); }
+constexpr Inst vpcmpgtd(Vec d, Vec a, Vec b) { return v3(VPCMPGTD, d, a, b); }
+constexpr Inst vpcmpgtd(Vec d, Vec a, Ptr b) { return v3(VPCMPGTD, d, a, b); }
+constexpr Inst vpcmpeqd(Mask k, Vec a, Vec b) { return k3(KPCMPEQD, k, a, b); }
+constexpr Inst vpcmpeqd(Mask k, Vec a, Ptr b) { return k3(KPCMPEQD, k, a, b); }
+constexpr Inst vpcmpgtd(Mask k, Vec a, Vec b) { return k3(KPCMPGTD, k, a, b); }
+constexpr Inst vpcmpgtd(Mask k, Vec a, Ptr b) { return k3(KPCMPGTD, k, a, b); }
+constexpr Inst vpcmpd(Mask k, Vec a, Vec b, u8 pred) { return imm8(k3(KPCMPD, k, a, b), pred); }
+constexpr Inst vpcmpd(Mask k, Vec a, Ptr b, u8 pred) { return imm8(k3(KPCMPD, k, a, b), pred); }
+constexpr Inst vcmpps(Vec d, Vec a, Vec b, u8 pred) { return imm8(v3(VCMPPS, d, a, b), pred); }
+constexpr Inst vcmpps(Vec d, Vec a, Ptr b, u8 pred) { return imm8(v3(VCMPPS, d, a, b), pred); }
+constexpr Inst vcmpps(Mask k, Vec a, Vec b, u8 pred) { return imm8(k3(KCMPPS, k, a, b), pred); }
+constexpr Inst vcmpps(Mask k, Vec a, Ptr b, u8 pred) { return imm8(k3(KCMPPS, k, a, b), pred); }
+
+// The AVX2 blends select by the top bit of the elements of m, which
+// goes into the high nibble of an immediate
+constexpr Inst blendv(VForm f, Vec d, Vec a, Vec b, Vec m)
+{
+	if (m.size != d.size)
+		return fail(ErrSize);
+	if (m.code & 16)
+		return fail(ErrReg);
+	return imm8(v3(f, d, a, b), m.code << 4);
+}
+
+constexpr VForm VPBLENDVB = {PP66, Map0F3A, 0x4c, 0, 0, VexOnly, 0};
+constexpr VForm VBLENDVPS = {PP66, Map0F3A, 0x4a, 0, 0, VexOnly, 0};
+constexpr VForm VPBLENDMD = {PP66, Map0F38, 0x64, 0, 0, EvexOnly, 0};
+constexpr VForm VBLENDMPS = {PP66, Map0F38, 0x65, 0, 0, EvexOnly, 0};
+
+constexpr Inst vpblendvb(Vec d, Vec a, Vec b, Vec m) { return blendv(VPBLENDVB, d, a, b, m); }
+constexpr Inst vblendvps(Vec d, Vec a, Vec b, Vec m) { return blendv(VBLENDVPS, d, a, b, m); }
+constexpr Inst vpblendmd(Vec d, Vec a, Vec b) { return v3(VPBLENDMD, d, a, b); }
+constexpr Inst vpblendmd(Vec d, Vec a, Ptr b) { return v3(VPBLENDMD, d, a, b); }
+constexpr Inst vblendmps(Vec d, Vec a, Vec b) { return v3(VBLENDMPS, d, a, b); }
+constexpr Inst vblendmps(Vec d, Vec a, Ptr b) { return v3(VBLENDMPS, d, a, b); }
+
+constexpr VForm VPSHUFD = {PP66, Map0F, 0x70, 0, 0, VexEvex, 0};
+constexpr VForm VPSHUFB = {PP66, Map0F38, 0x00, 0, 0, VexEvex, 0};
+constexpr VForm VPERMD = {PP66, Map0F38, 0x36, 0, 0, VexEvex, 0};
+constexpr VForm VPERMPS = {PP66, Map0F38, 0x16, 0, 0, VexEvex, 0};
+
+// Permutes across lanes, there are none in 128 bits
+constexpr Inst perm(VForm f, Vec d, Vec idx, Vec s)
+{
+	if (d.size == 128)
+		return fail(ErrSize);
+	return v3(f, d, idx, s);
+}
+
+constexpr Inst vpshufd(Vec d, Vec s, u8 order) { return imm8(v2(VPSHUFD, d, s), order); }
+constexpr Inst vpshufd(Vec d, Ptr s, u8 order) { return imm8(v2(VPSHUFD, d, s), order); }
+constexpr Inst vpshufb(Vec d, Vec a, Vec idx) { return v3(VPSHUFB, d, a, idx); }
+constexpr Inst vpshufb(Vec d, Vec a, Ptr idx) { return v3(VPSHUFB, d, a, idx); }
+constexpr Inst vpermd(Vec d, Vec idx, Vec s) { return perm(VPERMD, d, idx, s); }
+constexpr Inst vpermps(Vec d, Vec idx, Vec s) { return perm(VPERMPS, d, idx, s); }
+
+// Broadcasts take the low element of an xmm register or of memory
+constexpr Inst bcast(VForm f, Vec d, Vec s)
+{
+	if (s.size != 128)
+		return fail(ErrSize);
+	return vinst(f, d.size, d.code, 0, s.code, d.k, d.z);
+}
+
+constexpr VForm VPBROADCASTD = {PP66, Map0F38, 0x58, 0, 0, VexEvex, 4};
+constexpr VForm VPBROADCASTQ = {PP66, Map0F38, 0x59, 0, 1, VexEvex, 8};
+constexpr VForm VBROADCASTSS = {PP66, Map0F38, 0x18, 0, 0, VexEvex, 4};
+
+constexpr Inst vpbroadcastd(Vec d, Vec s) { return bcast(VPBROADCASTD, d, s); }
+constexpr Inst vpbroadcastd(Vec d, Ptr s) { return v2(VPBROADCASTD, d, s); }
+constexpr Inst vpbroadcastq(Vec d, Vec s) { return bcast(VPBROADCASTQ, d, s); }
+constexpr Inst vpbroadcastq(Vec d, Ptr s) { return v2(VPBROADCASTQ, d, s); }
+constexpr Inst vbroadcastss(Vec d, Vec s) { return bcast(VBROADCASTSS, d, s); }
+constexpr Inst vbroadcastss(Vec d, Ptr s) { return v2(VBROADCASTSS, d, s); }
+
+constexpr Inst vpbroadcastd(Vec d, Reg s)
+{
+	if (size(s) != 32)
+		return fail(ErrSize);
+	return vinst({PP66, Map0F38, 0x7c, 0, 0, EvexOnly, 0}, d.size, d.code, 0, s.code, d.k, d.z);
+}
+
+constexpr Ptr vsib(VPtr p)
+{
+	Reg index = {p.index.code, (u8)(p.base.size ? p.base.size : 64)};
+	return {p.offset, p.base, index, p.scale};
+}
+
+// dword gathers, the AVX2 form clears the top bits of the elements
+// of m as they are loaded, the AVX-512 form clears the mask of d
+constexpr Inst gather(VForm f, Vec d, VPtr p, Vec m)
+{
+	if (d.size != p.index.size || d.size != m.size || d.size == 512)
+		return fail(ErrSize);
+	if (d.code == m.code || d.code == p.index.code || m.code == p.index.code)
+		return fail(ErrReg);
+	return vinst(f, d.size, d.code, m.code, vsib(p), 0, false, true);
+}
+
+constexpr Inst gather(VForm f, Vec d, VPtr p)
+{
+	if (d.size != p.index.size)
+		return fail(ErrSize);
+	if (!d.k || d.z || d.code == p.index.code)
+		return fail(ErrReg);
+	f.enc = EvexOnly;
+	return vinst(f, d.size, d.code, 0, vsib(p), d.k, false, true);
+}
+
+constexpr VForm VPGATHERDD = {PP66, Map0F38, 0x90, 0, 0, VexOnly, 4};
+constexpr VForm VGATHERDPS = {PP66, Map0F38, 0x92, 0, 0, VexOnly, 4};
+
+constexpr Inst vpgatherdd(Vec d, VPtr p, Vec m) { return gather(VPGATHERDD, d, p, m); }
+constexpr Inst vpgatherdd(Vec d, VPtr p) { return gather(VPGATHERDD, d, p); }
+constexpr Inst vgatherdps(Vec d, VPtr p, Vec m) { return gather(VGATHERDPS, d, p, m); }
+constexpr Inst vgatherdps(Vec d, VPtr p) { return gather(VGATHERDPS, d, p); }
+
+// Top bits of the elements into a general purpose register
+constexpr Inst movmsk(VForm f, Reg d, Vec s)
+{
+	if (size(d) != 32)
+		return fail(ErrSize);
+	return vinst(f, s.size, d.code, 0, s.code);
+}
+
+constexpr Inst vpmovmskb(Reg d, Vec s) { return movmsk({PP66, Map0F, 0xd7, 0, 0, VexOnly, 0}, d, s); }
+constexpr Inst vmovmskps(Reg d, Vec s) { return movmsk({PPNone, Map0F, 0x50, 0, 0, VexOnly, 0}, d, s); }
+
+constexpr Inst vzeroupper() { return bytes(0x77f8c5, 3); }
+
+// Opmask instructions are VEX encoded, L selects the form for some
+constexpr VForm kform(u8 op) { return {PPNone, Map0F, op, 0, 0, VexOnly, 0}; }
+
+constexpr Inst kmovw(Mask d, Mask s) { return vinst(kform(0x90), 128, d.code, 0, s.code); }
+constexpr Inst kmovw(Mask d, Ptr s) { return vinst(kform(0x90), 128, d.code, 0, s); }
+constexpr Inst kmovw(Ptr d, Mask s) { return vinst(kform(0x91), 128, s.code, 0, d); }
+
+constexpr Inst kmovw(Mask d, Reg s)
+{
+	if (size(s) != 32)
+		return fail(ErrSize);
+	return vinst(kform(0x92), 128, d.code, 0, s.code);
+}
+
+constexpr Inst kmovw(Reg d, Mask s)
+{
+	if (size(d) != 32)
+		return fail(ErrSize);
+	return vinst(kform(0x93), 128, d.code, 0, s.code);
+}
+
+constexpr Inst kandw(Mask d, Mask a, Mask b) { return vinst(kform(0x41), 256, d.code, a.code, b.code); }
+constexpr Inst korw(Mask d, Mask a, Mask b) { return vinst(kform(0x45), 256, d.code, a.code, b.code); }
+constexpr Inst kxorw(Mask d, Mask a, Mask b) { return vinst(kform(0x47), 256, d.code, a.code, b.code); }
+constexpr Inst knotw(Mask d, Mask s) { return vinst(kform(0x44), 128, d.code, 0, s.code); }
+constexpr Inst kortestw(Mask a, Mask b) { return vinst(kform(0x98), 128, a.code, 0, b.code); }
+
+}
+
+template <u32 N, u32 H>
+constexpr void emit(Stencil<N, H> &s, const enc::Inst &i)
+{
+	if (i.err || i.rel)
+		stencil_error("invalid operands");
+	push_inst(s, i.lo, i.hi, i.n);
+}
+
+// [rip+disp32] to offset bytes after a label, such as a literal
+// (see pool) or a table in the code. The displacement is counted
+// from the end of the instruction, after any immediate.
+Ptr ptr(Assembler &a, LabelId l, s32 offset = 0);
+Ptr ptr(Assembler &a, const char *label, s32 offset = 0);
+
 void mov(Assembler &a, Ptr dst, Reg src);
 void mov(Assembler &a, Reg dst, Ptr src);
 void mov(Assembler &a, Reg dst, Reg src);
@@ -91,12 +1037,22 @@ void xor_(Assembler &a, Reg dst, Reg src);
 void xor_(Assembler &a, Reg dst, u32 src);
 void cmp(Assembler &a, Reg dst, Reg src);
 void cmp(Assembler &a, Reg dst, u32 src);
+void test(Assembler &a, Reg dst, Reg src);
 void mul(Assembler &a, Reg src);
 void div(Assembler &a, Reg src);
+void neg(Assembler &a, Reg dst);
+void imul(Assembler &a, Reg dst, Reg src);
+void shl(Assembler &a, Reg dst, u8 n);
+void shr(Assembler &a, Reg dst, u8 n);
+void sar(Assembler &a, Reg dst, u8 n);
+void movzx(Assembler &a, Reg dst, Ptr src, u8 bits);
+void jcc(Assembler &a, Cond c, LabelId l);
 void jcc(Assembler &a, Cond c, const char *l);
+void jmp(Assembler &a, LabelId dst);
 void jmp(Assembler &a, const char *dst);
 void jmp(Assembler &a, Ptr dst);
 void jmp(Assembler &a, Reg dst);
+void call(Assembler &a, LabelId dst);
 void call(Assembler &a, const char *dst);
 void call(Assembler &a, Ptr dst);
 void call(Assembler &a, Reg dst);
@@ -106,8 +1062,94 @@ void ret(Assembler &a);
 void ud2(Assembler &a);
 void int3(Assembler &a);
 void syscall(Assembler &a);
-void nop(Assembler &a);
+void nop(Assembler &a, u8 n = 1);
 void mfence(Assembler &a);
 void rdtsc(Assembler &a);
 
+// Pad to a multiple of n bytes with the fewest nops, or bind l
+// there, e.g. to put a loop head at the start of a fetch block
+void align(Assembler &a, u32 n);
+void label(Assembler &a, LabelId l, u32 align);
+void label(Assembler &a, const char *name, u32 align);
+
+// Vector instructions, VEX encoded where possible (see enc::vinst)
+void vmovdqu(Assembler &a, Vec d, Vec s);
+void vmovdqu(Assembler &a, Vec d, Ptr s);
+void vmovdqu(Assembler &a, Ptr d, Vec s);
+void vmovups(Assembler &a, Vec d, Vec s);
+void vmovups(Assembler &a, Vec d, Ptr s);
+void vmovups(Assembler &a, Ptr d, Vec s);
+void vpaddd(Assembler &a, Vec d, Vec x, Vec y);
+void vpaddd(Assembler &a, Vec d, Vec x, Ptr y);
+void vpaddq(Assembler &a, Vec d, Vec x, Vec y);
+void vpaddq(Assembler &a, Vec d, Vec x, Ptr y);
+void vpsubd(Assembler &a, Vec d, Vec x, Vec y);
+void vpsubd(Assembler &a, Vec d, Vec x, Ptr y);
+void vpmulld(Assembler &a, Vec d, Vec x, Vec y);
+void vpmulld(Assembler &a, Vec d, Vec x, Ptr y);
+void vpand(Assembler &a, Vec d, Vec x, Vec y);
+void vpand(Assembler &a, Vec d, Vec x, Ptr y);
+void vpor(Assembler &a, Vec d, Vec x, Vec y);
+void vpor(Assembler &a, Vec d, Vec x, Ptr y);
+void vpxor(Assembler &a, Vec d, Vec x, Vec y);
+void vpxor(Assembler &a, Vec d, Vec x, Ptr y);
+void vaddps(Assembler &a, Vec d, Vec x, Vec y);
+void vaddps(Assembler &a, Vec d, Vec x, Ptr y);
+void vaddpd(Assembler &a, Vec d, Vec x, Vec y);
+void vaddpd(Assembler &a, Vec d, Vec x, Ptr y);
+void vmulps(Assembler &a, Vec d, Vec x, Vec y);
+void vmulps(Assembler &a, Vec d, Vec x, Ptr y);
+void vmulpd(Assembler &a, Vec d, Vec x, Vec y);
+void vmulpd(Assembler &a, Vec d, Vec x, Ptr y);
+void vpcmpeqd(Assembler &a, Vec d, Vec x, Vec y);
+void vpcmpeqd(Assembler &a, Vec d, Vec x, Ptr y);
+void vpcmpeqd(Assembler &a, Mask k, Vec x, Vec y);
+void vpcmpeqd(Assembler &a, Mask k, Vec x, Ptr y);
+void vpcmpgtd(Assembler &a, Vec d, Vec x, Vec y);
+void vpcmpgtd(Assembler &a, Vec d, Vec x, Ptr y);
+void vpcmpgtd(Assembler &a, Mask k, Vec x, Vec y);
+void vpcmpgtd(Assembler &a, Mask k, Vec x, Ptr y);
+void vpcmpd(Assembler &a, Mask k, Vec x, Vec y, u8 pred);
+void vpcmpd(Assembler &a, Mask k, Vec x, Ptr y, u8 pred);
+void vcmpps(Assembler &a, Vec d, Vec x, Vec y, u8 pred);
+void vcmpps(Assembler &a, Vec d, Vec x, Ptr y, u8 pred);
+void vcmpps(Assembler &a, Mask k, Vec x, Vec y, u8 pred);
+void vcmpps(Assembler &a, Mask k, Vec x, Ptr y, u8 pred);
+void vpblendvb(Assembler &a, Vec d, Vec x, Vec y, Vec m);
+void vblendvps(Assembler &a, Vec d, Vec x, Vec y, Vec m);
+void vpblendmd(Assembler &a, Vec d, Vec x, Vec y);
+void vpblendmd(Assembler &a, Vec d, Vec x, Ptr y);
+void vblendmps(Assembler &a, Vec d, Vec x, Vec y);
+void vblendmps(Assembler &a, Vec d, Vec x, Ptr y);
+void vpshufd(Assembler &a, Vec d, Vec s, u8 order);
+void vpshufd(Assembler &a, Vec d, Ptr s, u8 order);
+void vpshufb(Assembler &a, Vec d, Vec x, Vec idx);
+void vpshufb(Assembler &a, Vec d, Vec x, Ptr idx);
+void vpermd(Assembler &a, Vec d, Vec idx, Vec s);
+void vpermps(Assembler &a, Vec d, Vec idx, Vec s);
+void vpbroadcastd(Assembler &a, Vec d, Vec s);
+void vpbroadcastd(Assembler &a, Vec d, Ptr s);
+void vpbroadcastd(Assembler &a, Vec d, Reg s);
+void vpbroadcastq(Assembler &a, Vec d, Vec s);
+void vpbroadcastq(Assembler &a, Vec d, Ptr s);
+void vbroadcastss(Assembler &a, Vec d, Vec s);
+void vbroadcastss(Assembler &a, Vec d, Ptr s);
+void vpgatherdd(Assembler &a, Vec d, VPtr s, Vec m);
+void vpgatherdd(Assembler &a, Vec d, VPtr s);
+void vgatherdps(Assembler &a, Vec d, VPtr s, Vec m);
+void vgatherdps(Assembler &a, Vec d, VPtr s);
+void vpmovmskb(Assembler &a, Reg d, Vec s);
+void vmovmskps(Assembler &a, Reg d, Vec s);
+void vzeroupper(Assembler &a);
+void kmovw(Assembler &a, Mask d, Mask s);
+void kmovw(Assembler &a, Mask d, Ptr s);
+void kmovw(Assembler &a, Ptr d, Mask s);
+void kmovw(Assembler &a, Mask d, Reg s);
+void kmovw(Assembler &a, Reg d, Mask s);
+void kandw(Assembler &a, Mask d, Mask x, Mask y);
+void korw(Assembler &a, Mask d, Mask x, Mask y);
+void kxorw(Assembler &a, Mask d, Mask x, Mask y);
+void knotw(Assembler &a, Mask d, Mask s);
+void kortestw(Assembler &a, Mask x, Mask y);
+
 }
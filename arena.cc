@@ -7,17 +7,26 @@
 
 static const u32 PageSize = 16*((u32)1 << 20);
 
-static u32 free_size(Page *p)
+static u64 free_size(Page *p)
 {
-	return p ? PageSize - ((u64)p->data - (u64)p) : 0;
+	return p ? p->size - ((u64)p->data - (u64)p) : 0;
 }
 
 void *alloc(Arena &a, u32 size, u16 align)
 {
-	assert (size + align <= PageSize - sizeof(Page));
-	if (free_size(a.p) < size + align) {
-		Page *p = (Page *)mmap(0, PageSize, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
-		assert(p != MAP_FAILED);
+	if (free_size(a.p) < (u64)size + align) {
+		// oversized requests get a dedicated mapping of their own
+		u64 psize = PageSize;
+		if ((u64)size + align > PageSize - sizeof(Page))
+			psize = (sizeof(Page) + (u64)size + align + 4095) & ~(u64)4095;
+		Page *p = a.spare;
+		if (p && psize == PageSize) {
+			a.spare = p->next;
+		} else {
+			p = (Page *)mmap(0, psize, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+			assert(p != MAP_FAILED);
+			p->size = psize;
+		}
 		p->next = a.p;
 		p->data = (u8 *)p + sizeof(Page);
 		a.p = p;
@@ -30,10 +39,47 @@ void *alloc(Arena &a, u32 size, u16 align)
 	return (void *)ptr;
 }
 
+static void unmap(Page *p)
+{
+	for (Page *next; p; p = next) {
+		next = p->next;
+		munmap(p, p->size);
+	}
+}
+
 void reset(Arena &a)
 {
-	for (Page *p = a.p; p; p = a.p) {
-		a.p = p->next;
-		munmap(p, PageSize);
+	unmap(a.p);
+	unmap(a.spare);
+	a = {};
+}
+
+// Lazily give back the pages of a mapping that were used above keep
+void release(void *p, u64 keep, u64 used)
+{
+	keep = (keep + 4095) & ~(u64)4095;
+	used = (used + 4095) & ~(u64)4095;
+	if (used <= keep)
+		return;
+#ifdef MADV_FREE
+	madvise((u8 *)p + keep, used - keep, MADV_FREE);
+#else
+	madvise((u8 *)p + keep, used - keep, MADV_DONTNEED);
+#endif
+}
+
+void rewind(Arena &a, u64 keep)
+{
+	// the oldest page ends up on top of the spare list
+	for (Page *p = a.p, *next; p; p = next) {
+		next = p->next;
+		if (p->size != PageSize) {
+			munmap(p, p->size);
+			continue;
+		}
+		release(p, keep > sizeof(Page) ? keep : sizeof(Page), (u64)p->data - (u64)p);
+		p->next = a.spare;
+		a.spare = p;
 	}
+	a.p = 0;
 }
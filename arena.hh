@@ -1,11 +1,15 @@
 struct Page {
 	Page *next;
 	u8   *data;
+	u64  size;
 };
 
 struct Arena {
 	Page *p;
+	Page *spare; // rewound pages waiting for reuse
 };
 
 void *alloc(Arena &a, u32 size, u16 align = 8);
 void reset(Arena &a);
+void rewind(Arena &a, u64 keep);
+void release(void *p, u64 keep, u64 used);
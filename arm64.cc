@@ -1,3 +1,4 @@
+#include <string.h>
 #include <assert.h>
 
 #include "types.hh"
@@ -5,64 +6,39 @@
 #include "asm.hh"
 #include "arm64.hh"
 
-// Reference: https://developer.arm.com/documentation/ddi0602/2026-03/Base-Instructions/
-
 namespace arm64 {
 
-const Reg x0  = {0,  true, false}, w0  = {0,  false, false};
-const Reg x1  = {1,  true, false}, w1  = {1,  false, false};
-const Reg x2  = {2,  true, false}, w2  = {2,  false, false};
-const Reg x3  = {3,  true, false}, w3  = {3,  false, false};
-const Reg x4  = {4,  true, false}, w4  = {4,  false, false};
-const Reg x5  = {5,  true, false}, w5  = {5,  false, false};
-const Reg x6  = {6,  true, false}, w6  = {6,  false, false};
-const Reg x7  = {7,  true, false}, w7  = {7,  false, false};
-const Reg x8  = {8,  true, false}, w8  = {8,  false, false};
-const Reg x9  = {9,  true, false}, w9  = {9,  false, false};
-const Reg x10 = {10, true, false}, w10 = {10, false, false};
-const Reg x11 = {11, true, false}, w11 = {11, false, false};
-const Reg x12 = {12, true, false}, w12 = {12, false, false};
-const Reg x13 = {13, true, false}, w13 = {13, false, false};
-const Reg x14 = {14, true, false}, w14 = {14, false, false};
-const Reg x15 = {15, true, false}, w15 = {15, false, false};
-const Reg ip0 = {16, true, false}, x16 = {16, true,  false}, w16 = {16, false, false};
-const Reg ip1 = {17, true, false}, x17 = {17, true,  false}, w17 = {17, false, false};
-const Reg x18 = {18, true, false}, w18 = {18, false, false};
-const Reg x19 = {19, true, false}, w19 = {19, false, false};
-const Reg x20 = {20, true, false}, w20 = {20, false, false};
-const Reg x21 = {21, true, false}, w21 = {21, false, false};
-const Reg x22 = {22, true, false}, w22 = {22, false, false};
-const Reg x23 = {23, true, false}, w23 = {23, false, false};
-const Reg x24 = {24, true, false}, w24 = {24, false, false};
-const Reg x25 = {25, true, false}, w25 = {25, false, false};
-const Reg x26 = {26, true, false}, w26 = {26, false, false};
-const Reg x27 = {27, true, false}, w27 = {27, false, false};
-const Reg x28 = {28, true, false}, w28 = {28, false, false};
-const Reg fp  = {29, true, false}, x29 = {29, true,  false}, w29 = {29, false, false};
-const Reg lr  = {30, true, false}, x30 = {30, true,  false}, w30 = {30, false, false};
-const Reg xzr = {31, true, false}, wzr = {31, false, false};
-const Reg sp  = {31, true, true},  wsp = {31, false, true};
-
-static bool iszr(Reg r) { return r.code == 31 && !r.sp; }
-static bool issp(Reg r) { return r.sp; }
-
-struct Inst {
-	u32 v;
-	u8  n;
-};
-
-static void push_bits(Inst &i, u32 v, u8 n)
+// Distance from the first load of a literal at which its pool is
+// placed, with room for the branch around it and alignment
+static const u32 LiteralReach = (1 << 20) - 64;
+
+// The branches and literal loads place the island this early, so that
+// the next of them may be up to that far away
+static const u32 IslandSlack = 1 << 16;
+
+// Place the pending literals in the middle of the code, with a branch
+// around them, before they go out of the reach of ldr. It is only
+// checked by the branches and literal loads to keep the other
+// instructions cheap, see arm64.hh for straight code.
+void island(Assembler &a, u32 ahead)
 {
-	assert(n > 0 && 32 - i.n >= n);
-	assert(v >> n == 0);
-	i.v |= v << i.n;
-	i.n += n;
+	if (!a.lits || a.ip + ahead + a.litsize - a.litpos < LiteralReach)
+		return;
+	LabelId over = new_label(a);
+	push_u32(a, enc::b(0).v);
+	label_ref(a, over, a.ip - 4, a.ip - 4, 4, 26, 0);
+	pool(a);
+	label(a, over);
 }
 
-static void push_inst(Assembler &a, Inst &i)
+static void emit(Assembler &a, const enc::Inst &i)
 {
+	if (i.err) {
+		a.err = i.err;
+		return udf(a, 0);
+	}
 	assert(i.n == 32);
-	push_bytes(a, i.v, 4);
+	push_u32(a, i.v);
 }
 
 void udf(Assembler &a, u16 imm)
@@ -70,292 +46,291 @@ void udf(Assembler &a, u16 imm)
 	push_bytes(a, imm, 4);
 }
 
-void svc(Assembler &a, u16 imm)
-{
-	Inst i = {};
-	push_bits(i, 0b00001, 5);
-	push_bits(i, imm, 16);
-	push_bits(i, 0b11010100000, 11);
-	push_inst(a, i);
-}
+void svc(Assembler &a, u16 imm) { emit(a, enc::svc(imm)); }
+void nop(Assembler &a) { emit(a, enc::nop()); }
 
-static void inst3r(Assembler &a, u8 c1, u16 c2, Reg d, Reg n, Reg m)
+// Whole instructions, ip may not be at one if data was pushed
+static void fill(u8 *p, u32 size, u32 v)
 {
-	if (issp(d) || issp(n) || issp(m)) {
-		a.err = ErrReg;
-		return udf(a, 0);
-	}
-	if (d.sf != n.sf || n.sf != m.sf) {
-		a.err = ErrSize;
-		return udf(a, 0);
-	}
-	Inst i = {};
-	push_bits(i, d.code, 5);
-	push_bits(i, n.code, 5);
-	push_bits(i, c1, 6);
-	push_bits(i, m.code, 5);
-	push_bits(i, c2, 10);
-	push_bits(i, d.sf, 1);
-	push_inst(a, i);
+	memset(p, 0, size % 4);
+	for (u32 i = size % 4; i < size; i += 4)
+		memcpy(p + i, &v, 4);
 }
 
-void adc(Assembler &a, Reg d, Reg n, Reg m)  { return inst3r(a, 0, 0b0011010000, d, n, m); }
-void sdiv(Assembler &a, Reg d, Reg n, Reg m) { return inst3r(a, 3, 0b0011010110, d, n, m); }
-void udiv(Assembler &a, Reg d, Reg n, Reg m) { return inst3r(a, 2, 0b0011010110, d, n, m); }
+static void fill_nop(u8 *p, u32 size) { fill(p, size, enc::nop().v); }
+static void fill_udf(u8 *p, u32 size) { fill(p, size, enc::udf(0).v); }
 
-static bool testbit(u64 v, u8 bit)
-{
-	return (v >> bit) & 1;
-}
+void align(Assembler &a, u32 n, bool trap) { ::align(a, n, trap ? fill_udf : fill_nop); }
+void label(Assembler &a, LabelId l, u32 n) { align(a, n); ::label(a, l); }
+void label(Assembler &a, const char *name, u32 n) { align(a, n); ::label(a, name); }
 
-static void inste(Assembler &a, u16 c, Reg d, Reg n, Reg m, Ex e, u8 imm3)
-{
-	bool spd = !testbit(c, 8);
-	if ((spd && iszr(d)) || (!spd && issp(d)) || iszr(n) || issp(m)) {
-		a.err = ErrReg;
-		return udf(a, 0);
-	}
-	if (d.sf != n.sf || n.sf != m.sf || imm3 > 4) {
-		a.err = ErrSize;
-		return udf(a, 0);
-	}
-	Inst i = {};
-	push_bits(i, d.code, 5);
-	push_bits(i, n.code, 5);
-	push_bits(i, imm3, 3);
-	push_bits(i, e, 3);
-	push_bits(i, m.code, 5);
-	push_bits(i, c, 10);
-	push_bits(i, d.sf, 1);
-	push_inst(a, i);
-}
+void adc(Assembler &a, Reg d, Reg n, Reg m)  { emit(a, enc::adc(d, n, m)); }
+void sdiv(Assembler &a, Reg d, Reg n, Reg m) { emit(a, enc::sdiv(d, n, m)); }
+void udiv(Assembler &a, Reg d, Reg n, Reg m) { emit(a, enc::udiv(d, n, m)); }
+
+void add(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { emit(a, enc::add(d, n, m, e, imm3)); }
+void add(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { emit(a, enc::add(d, n, m, s, imm6)); }
+void add(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { emit(a, enc::add(d, n, imm12, s, simm)); }
+void add(Assembler &a, Reg d, Reg n, Reg m) { emit(a, enc::add(d, n, m)); }
 
-static void insts(Assembler &a, u8 c, Reg d, Reg n, Reg m, Sh s, u8 imm6)
+void sub(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { emit(a, enc::sub(d, n, m, e, imm3)); }
+void sub(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { emit(a, enc::sub(d, n, m, s, imm6)); }
+void sub(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { emit(a, enc::sub(d, n, imm12, s, simm)); }
+void sub(Assembler &a, Reg d, Reg n, Reg m) { emit(a, enc::sub(d, n, m)); }
+
+void adds(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { emit(a, enc::adds(d, n, m, e, imm3)); }
+void adds(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { emit(a, enc::adds(d, n, m, s, imm6)); }
+void adds(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { emit(a, enc::adds(d, n, imm12, s, simm)); }
+void adds(Assembler &a, Reg d, Reg n, Reg m) { emit(a, enc::adds(d, n, m)); }
+
+void subs(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { emit(a, enc::subs(d, n, m, e, imm3)); }
+void subs(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { emit(a, enc::subs(d, n, m, s, imm6)); }
+void subs(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { emit(a, enc::subs(d, n, imm12, s, simm)); }
+void subs(Assembler &a, Reg d, Reg n, Reg m) { emit(a, enc::subs(d, n, m)); }
+
+void cmp(Assembler &a, Reg n, Reg m) { subs(a, xzr, n, m); }
+void cmp(Assembler &a, Reg n, Reg m, Ex e, u8 imm3) { subs(a, xzr, n, m, e, imm3); }
+void cmp(Assembler &a, Reg n, Reg m, Sh s, u8 imm6) { subs(a, xzr, n, m, s, imm6); }
+void cmp(Assembler &a, Reg n, u16 imm12, Sh s, u8 simm) { subs(a, xzr, n, imm12, s, simm); }
+
+void orr(Assembler &a, Reg d, Reg n, u64 imm) { emit(a, enc::orr(d, n, imm)); }
+void orr(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { emit(a, enc::orr(d, n, m, s, imm6)); }
+void and_(Assembler &a, Reg d, Reg n, u64 imm) { emit(a, enc::and_(d, n, imm)); }
+void and_(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { emit(a, enc::and_(d, n, m, s, imm6)); }
+void eor(Assembler &a, Reg d, Reg n, u64 imm) { emit(a, enc::eor(d, n, imm)); }
+void eor(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { emit(a, enc::eor(d, n, m, s, imm6)); }
+void mul(Assembler &a, Reg d, Reg n, Reg m) { emit(a, enc::mul(d, n, m)); }
+void lsl(Assembler &a, Reg d, Reg n, u8 s) { emit(a, enc::lsl(d, n, s)); }
+void lsr(Assembler &a, Reg d, Reg n, u8 s) { emit(a, enc::lsr(d, n, s)); }
+void asr(Assembler &a, Reg d, Reg n, u8 s) { emit(a, enc::asr(d, n, s)); }
+void mov(Assembler &a, Reg d, Reg n) { emit(a, enc::mov(d, n)); }
+void movn(Assembler &a, Reg d, u16 imm, u8 hw) { emit(a, enc::movn(d, imm, hw)); }
+void movz(Assembler &a, Reg d, u16 imm, u8 hw) { emit(a, enc::movz(d, imm, hw)); }
+void movk(Assembler &a, Reg d, u16 imm, u8 hw) { emit(a, enc::movk(d, imm, hw)); }
+
+static u16 half(u64 v, u8 hw) { return v >> 16*hw; }
+
+// Any constant in the fewest instructions: one movz or movn with a
+// movk for each half that differs from it, or a logical immediate
+// with at most one movk. Constants that would take four instructions
+// are loaded from the literal pool instead (see pool).
+void mov(Assembler &a, Reg d, u64 imm)
 {
-	if (issp(d) || issp(n) || issp(m)) {
+	if (d.sp) {
 		a.err = ErrReg;
 		return udf(a, 0);
 	}
-	if (d.sf != n.sf || n.sf != m.sf || imm6 > ((32<<d.sf) - 1)) {
+	if (!d.sf && (u32)imm != imm) {
 		a.err = ErrSize;
 		return udf(a, 0);
 	}
-	Inst i = {};
-	push_bits(i, d.code, 5);
-	push_bits(i, n.code, 5);
-	push_bits(i, imm6, 6);
-	push_bits(i, m.code, 5);
-	push_bits(i, 0, 1);
-	push_bits(i, s, 2);
-	push_bits(i, c, 7);
-	push_bits(i, d.sf, 1);
-	push_inst(a, i);
-}
-
-static void insti(Assembler &a, u8 c, Reg d, Reg n, u16 imm12, Sh s, u8 simm)
-{
-	bool spd = !testbit(c, 6);
-	if ((spd && iszr(d)) || (!spd && issp(d)) || iszr(n)) {
-		a.err = ErrReg;
-		return udf(a, 0);
+	u8 n = d.sf ? 4 : 2, zeros = 0, ones = 0;
+	for (u8 hw = 0; hw < n; hw++) {
+		zeros += half(imm, hw) == 0;
+		ones += half(imm, hw) == 0xffff;
 	}
-	if (d.sf != n.sf || s != LSL || (simm != 0 && simm != 12) || imm12 > 4095) {
-		a.err = ErrSize;
-		return udf(a, 0);
+	u8 count = n - (zeros > ones ? zeros : ones);
+	if (count > 1 && enc::encode(imm, 32 << d.sf).size)
+		return orr(a, d, d.sf ? xzr : wzr, imm);
+	if (count > 2) {
+		// a logical immediate with one half replaced by another
+		for (u8 hw = 0; hw < n; hw++) {
+			for (u8 src = 0; src < n; src++) {
+				u64 mask = (u64)0xffff << 16*hw;
+				u64 v = (imm & ~mask) | (u64)half(imm, src) << 16*hw;
+				if (src == hw || !enc::encode(v, 64).size)
+					continue;
+				orr(a, d, xzr, v);
+				return movk(a, d, half(imm, hw), hw);
+			}
+		}
+	}
+	if (count == 4)
+		return ldr(a, d, literal(a, imm));
+	bool inv = ones > zeros;
+	u16 fill = inv ? 0xffff : 0;
+	bool first = true;
+	for (u8 hw = 0; hw < n; hw++) {
+		u16 h = half(imm, hw);
+		if (h == fill && (count || hw))
+			continue;
+		if (!first)
+			movk(a, d, h, hw);
+		else if (inv)
+			movn(a, d, ~h, hw);
+		else
+			movz(a, d, h, hw);
+		first = false;
 	}
-	Inst i = {};
-	push_bits(i, d.code, 5);
-	push_bits(i, n.code, 5);
-	push_bits(i, imm12, 12);
-	push_bits(i, simm == 12, 1);
-	push_bits(i, c, 8);
-	push_bits(i, d.sf, 1);
-	push_inst(a, i);
 }
 
-static void inst3r2(Assembler &a, u8 c1, u16 c2, Reg d, Reg n, Reg m)
+void b(Assembler &a, LabelId label)
 {
-	if (issp(d) || issp(n))
-		return inste(a, c2, d, n, m, d.sf ? UXTX : UXTW, 0);
-	return insts(a, c1, d, n, m, LSL, 0);
+	island(a, IslandSlack);
+	emit(a, enc::b(0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 26, 0);
 }
 
-void add(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { inste(a, 0b0001011001, d, n, m, e, imm3); }
-void add(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { insts(a, 0b0001011, d, n, m, s, imm6); }
-void add(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { insti(a, 0b00100010, d, n, imm12, s, simm); }
-void add(Assembler &a, Reg d, Reg n, Reg m) { inst3r2(a, 0b0001011, 0b0001011001, d, n, m); }
-
-void sub(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { inste(a, 0b1001011001, d, n, m, e, imm3); }
-void sub(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { insts(a, 0b1001011, d, n, m, s, imm6); }
-void sub(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { insti(a, 0b10100010, d, n, imm12, s, simm); }
-void sub(Assembler &a, Reg d, Reg n, Reg m) { inst3r2(a, 0b1001011, 0b1001011001, d, n, m); }
-
-void adds(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { inste(a, 0b0101011001, d, n, m, e, imm3); }
-void adds(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { insts(a, 0b0101011, d, n, m, s, imm6); }
-void adds(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { insti(a, 0b01100010, d, n, imm12, s, simm); }
-void adds(Assembler &a, Reg d, Reg n, Reg m) { inst3r2(a, 0b0101011, 0b0101011001, d, n, m); }
+void b(Assembler &a, const char *label) { b(a, label_id(a, label)); }
 
-void subs(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3) { inste(a, 0b1101011001, d, n, m, e, imm3); }
-void subs(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { insts(a, 0b1101011, d, n, m, s, imm6); }
-void subs(Assembler &a, Reg d, Reg n, u16 imm12, Sh s, u8 simm) { insti(a, 0b11100010, d, n, imm12, s, simm); }
-void subs(Assembler &a, Reg d, Reg n, Reg m) { inst3r2(a, 0b1101011, 0b1101011001, d, n, m); }
-
-void cmp(Assembler &a, Reg n, Reg m) { subs(a, xzr, n, m); }
-void cmp(Assembler &a, Reg n, Reg m, Ex e, u8 imm3) { subs(a, xzr, n, m, e, imm3); }
-void cmp(Assembler &a, Reg n, Reg m, Sh s, u8 imm6) { subs(a, xzr, n, m, s, imm6); }
-void cmp(Assembler &a, Reg n, u16 imm12, Sh s, u8 simm) { subs(a, xzr, n, imm12, s, simm); }
-
-static u64 lsb(u64 x)
+void b(Assembler &a, Cond c, LabelId label)
 {
-	return x ^ (x & (x - 1));
+	island(a, IslandSlack);
+	emit(a, enc::b(c, 0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 19, 5);
 }
 
-static u8 cnt1(u64 x)
-{
-	x = x - ((x >> 1) & 0x5555555555555555);
-	x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
-	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0F;
-	return (x * 0x0101010101010101) >> 56;
-}
+void b(Assembler &a, Cond c, const char *label) { b(a, c, label_id(a, label)); }
 
-static u8 nlz(u64 x)
+void cbz(Assembler &a, Reg t, LabelId label)
 {
-	u8 n = 64;
-	u8 c;
-	c = !!(x >> 32) << 5;
-	x >>= c, n -= c;
-	c = !!(x >> 16) << 4;
-	x >>= c, n -= c;
-	c = !!(x >> 8) << 3;
-	x >>= c, n -= c;
-	c = !!(x >> 4) << 2;
-	x >>= c, n -= c;
-	c = !!(x >> 2) << 1;
-	x >>= c, n -= c;
-	c = x >> 1;
-	x >>= c, n -= c;
-	return (n - x);
+	island(a, IslandSlack);
+	emit(a, enc::cbz(t, 0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 19, 5);
 }
 
-struct Logical {
-	u8 size;
-	u8 ones;
-	u8 rot;
-};
+void cbz(Assembler &a, Reg t, const char *label) { cbz(a, t, label_id(a, label)); }
 
-static Logical encode(u64 v, u8 vsize)
+void cbnz(Assembler &a, Reg t, LabelId label)
 {
-	u8 size = vsize;
-	u64 mask = (u64)-1 >> (64 - size);
-	for (u8 tmp = size/2; tmp; tmp /= 2) {
-		u64 tmask = mask >> tmp;
-		if ((v & tmask) != ((v >> tmp) & tmask))
-			break;
-		size = tmp, mask = tmask;
-	}
-	u64 seg = v & mask;
-	if (!seg || !(seg ^ mask))
-		return Logical{}; // reject 1* and 0*
-	u8 ones = cnt1(seg);
-	u8 rot;
-	if (seg & 1) { // 1*0*1*
-		u64 top = seg & (seg + 1);
-		if ((top + lsb(top)) & mask)
-			return Logical{};
-		rot = cnt1(top);
-	} else {       // 0*1*0*
-		if (seg & (seg + lsb(seg)))
-			return Logical{};
-		rot = ones + nlz(seg) - (64 - size);
-	}
-	return Logical{size, ones, rot};
+	island(a, IslandSlack);
+	emit(a, enc::cbnz(t, 0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 19, 5);
 }
 
-static void push_logical(Inst &i, Logical l)
+void cbnz(Assembler &a, Reg t, const char *label) { cbnz(a, t, label_id(a, label)); }
+
+void bl(Assembler &a, LabelId label)
 {
-	// I actually wonder why arm chose such a fucked up way of
-	// encoding imms and not simply l.size | (l.ones - 1)
-	push_bits(i, (~(l.size*2 - 1) & 0x3f) | (l.ones - 1) , 6);
-	push_bits(i, l.rot, 6);
-	push_bits(i, l.size == 64, 1);
+	island(a, IslandSlack);
+	emit(a, enc::bl(0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 26, 0);
 }
 
-void orr(Assembler &a, Reg d, Reg n, u64 imm)
+void bl(Assembler &a, const char *label) { bl(a, label_id(a, label)); }
+
+void br(Assembler &a, Reg n)  { emit(a, enc::br(n)); }
+void blr(Assembler &a, Reg n) { emit(a, enc::blr(n)); }
+void ret(Assembler &a, Reg n) { emit(a, enc::ret(n)); }
+
+
+void add(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::add(d, n, m)); }
+void sub(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::sub(d, n, m)); }
+void mul(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::mul(d, n, m)); }
+void smax(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::smax(d, n, m)); }
+void smin(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::smin(d, n, m)); }
+void umax(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::umax(d, n, m)); }
+void umin(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::umin(d, n, m)); }
+void cmeq(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::cmeq(d, n, m)); }
+void cmgt(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::cmgt(d, n, m)); }
+void cmge(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::cmge(d, n, m)); }
+void cmhi(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::cmhi(d, n, m)); }
+void cmhs(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::cmhs(d, n, m)); }
+void and_(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::and_(d, n, m)); }
+void bic(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::bic(d, n, m)); }
+void orr(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::orr(d, n, m)); }
+void orn(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::orn(d, n, m)); }
+void eor(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::eor(d, n, m)); }
+void bsl(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::bsl(d, n, m)); }
+void bit(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::bit(d, n, m)); }
+void bif(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::bif(d, n, m)); }
+void mov(Assembler &a, VReg d, VReg n) { emit(a, enc::mov(d, n)); }
+void cnt(Assembler &a, VReg d, VReg n) { emit(a, enc::cnt(d, n)); }
+void mvn(Assembler &a, VReg d, VReg n) { emit(a, enc::mvn(d, n)); }
+void abs(Assembler &a, VReg d, VReg n) { emit(a, enc::abs(d, n)); }
+void neg(Assembler &a, VReg d, VReg n) { emit(a, enc::neg(d, n)); }
+void addv(Assembler &a, VReg d, VReg n) { emit(a, enc::addv(d, n)); }
+void smaxv(Assembler &a, VReg d, VReg n) { emit(a, enc::smaxv(d, n)); }
+void sminv(Assembler &a, VReg d, VReg n) { emit(a, enc::sminv(d, n)); }
+void umaxv(Assembler &a, VReg d, VReg n) { emit(a, enc::umaxv(d, n)); }
+void uminv(Assembler &a, VReg d, VReg n) { emit(a, enc::uminv(d, n)); }
+void uzp1(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::uzp1(d, n, m)); }
+void uzp2(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::uzp2(d, n, m)); }
+void trn1(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::trn1(d, n, m)); }
+void trn2(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::trn2(d, n, m)); }
+void zip1(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::zip1(d, n, m)); }
+void zip2(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::zip2(d, n, m)); }
+void tbl(Assembler &a, VReg d, VReg t, u8 len, VReg idx) { emit(a, enc::tbl(d, t, len, idx)); }
+void tbx(Assembler &a, VReg d, VReg t, u8 len, VReg idx) { emit(a, enc::tbx(d, t, len, idx)); }
+void dup(Assembler &a, VReg d, VReg n, u8 index) { emit(a, enc::dup(d, n, index)); }
+void dup(Assembler &a, VReg d, Reg n) { emit(a, enc::dup(d, n)); }
+void ins(Assembler &a, VReg d, u8 index, Reg n) { emit(a, enc::ins(d, index, n)); }
+void umov(Assembler &a, Reg d, VReg n, u8 index) { emit(a, enc::umov(d, n, index)); }
+void fadd(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fadd(d, n, m)); }
+void fsub(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fsub(d, n, m)); }
+void fmul(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fmul(d, n, m)); }
+void fdiv(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fdiv(d, n, m)); }
+void fmax(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fmax(d, n, m)); }
+void fmin(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fmin(d, n, m)); }
+void fmla(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fmla(d, n, m)); }
+void fcmeq(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fcmeq(d, n, m)); }
+void fcmge(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fcmge(d, n, m)); }
+void fcmgt(Assembler &a, VReg d, VReg n, VReg m) { emit(a, enc::fcmgt(d, n, m)); }
+void fabs(Assembler &a, VReg d, VReg n) { emit(a, enc::fabs(d, n)); }
+void fneg(Assembler &a, VReg d, VReg n) { emit(a, enc::fneg(d, n)); }
+void fsqrt(Assembler &a, VReg d, VReg n) { emit(a, enc::fsqrt(d, n)); }
+void fmov(Assembler &a, VReg d, VReg n) { emit(a, enc::fmov(d, n)); }
+void fmov(Assembler &a, VReg d, Reg n) { emit(a, enc::fmov(d, n)); }
+void fmov(Assembler &a, Reg d, VReg n) { emit(a, enc::fmov(d, n)); }
+void fcvt(Assembler &a, VReg d, VReg n) { emit(a, enc::fcvt(d, n)); }
+void fcmp(Assembler &a, VReg n, VReg m) { emit(a, enc::fcmp(n, m)); }
+void scvtf(Assembler &a, VReg d, Reg n) { emit(a, enc::scvtf(d, n)); }
+void ucvtf(Assembler &a, VReg d, Reg n) { emit(a, enc::ucvtf(d, n)); }
+void fcvtzs(Assembler &a, Reg d, VReg n) { emit(a, enc::fcvtzs(d, n)); }
+void fcvtzu(Assembler &a, Reg d, VReg n) { emit(a, enc::fcvtzu(d, n)); }
+
+
+void ldr(Assembler &a, Reg t, Ptr p) { emit(a, enc::ldr(t, p)); }
+void str(Assembler &a, Reg t, Ptr p) { emit(a, enc::str(t, p)); }
+void ldrb(Assembler &a, Reg t, Ptr p) { emit(a, enc::ldrb(t, p)); }
+void strb(Assembler &a, Reg t, Ptr p) { emit(a, enc::strb(t, p)); }
+void ldrh(Assembler &a, Reg t, Ptr p) { emit(a, enc::ldrh(t, p)); }
+void strh(Assembler &a, Reg t, Ptr p) { emit(a, enc::strh(t, p)); }
+void ldrsb(Assembler &a, Reg t, Ptr p) { emit(a, enc::ldrsb(t, p)); }
+void ldrsh(Assembler &a, Reg t, Ptr p) { emit(a, enc::ldrsh(t, p)); }
+void ldrsw(Assembler &a, Reg t, Ptr p) { emit(a, enc::ldrsw(t, p)); }
+void ldr(Assembler &a, VReg t, Ptr p) { emit(a, enc::ldr(t, p)); }
+void str(Assembler &a, VReg t, Ptr p) { emit(a, enc::str(t, p)); }
+void prfm(Assembler &a, Prf op, Ptr p) { emit(a, enc::prfm(op, p)); }
+void ldp(Assembler &a, Reg t, Reg t2, Ptr p) { emit(a, enc::ldp(t, t2, p)); }
+void stp(Assembler &a, Reg t, Reg t2, Ptr p) { emit(a, enc::stp(t, t2, p)); }
+void ldp(Assembler &a, VReg t, VReg t2, Ptr p) { emit(a, enc::ldp(t, t2, p)); }
+void stp(Assembler &a, VReg t, VReg t2, Ptr p) { emit(a, enc::stp(t, t2, p)); }
+
+void ldr(Assembler &a, Reg t, LabelId label)
 {
-	if (d.sf != n.sf || (!d.sf && (u32)imm != imm)) {
-		a.err = ErrSize;
-		return udf(a, 0);
-	}
-	Logical l = encode(imm, 32<<d.sf);
-	if (!l.size) {
-		a.err = ErrLogical;
-		return udf(a, 0);
-	}
-	Inst i = {};
-	push_bits(i, d.code, 5);
-	push_bits(i, n.code, 5);
-	push_logical(i, l);
-	push_bits(i, 0b01100100, 8);
-	push_bits(i, d.sf, 1);
-	push_inst(a, i);
+	island(a, IslandSlack);
+	emit(a, enc::ldr(t, 0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 19, 5);
 }
 
-void orr(Assembler &a, Reg d, Reg n, Reg m, Sh s, u8 imm6) { insts(a, 0b0101010, d, n, m, s, imm6); }
+void ldr(Assembler &a, Reg t, const char *label) { ldr(a, t, label_id(a, label)); }
 
-void mov(Assembler &a, Reg d, Reg n)
+void ldr(Assembler &a, VReg t, LabelId label)
 {
-	if (issp(d) || issp(n))
-		return add(a, d, n, 0);
-	if (d.sf)
-		return orr(a, d, xzr, n);
-	else
-		return orr(a, d, wzr, n);
+	island(a, IslandSlack);
+	emit(a, enc::ldr(t, 0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 19, 5);
 }
 
-void b(Assembler &a, const char *label)
-{
-	Inst i = {};
-	push_bits(i, 0, 26); // label placeholder
-	push_bits(i, 0b000101, 6);
-	push_inst(a, i);
-	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 26, 0);
-}
+void ldr(Assembler &a, VReg t, const char *label) { ldr(a, t, label_id(a, label)); }
 
-void b(Assembler &a, Cond c, const char *label)
+void ldrsw(Assembler &a, Reg t, LabelId label)
 {
-	Inst i = {};
-	push_bits(i, c, 4);
-	push_bits(i, 0, 1);
-	push_bits(i, 0, 19); // label placeholder
-	push_bits(i, 0b01010100, 8);
-	push_inst(a, i);
+	island(a, IslandSlack);
+	emit(a, enc::ldrsw(t, 0)); // label placeholder
 	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 19, 5);
 }
 
-void bl(Assembler &a, const char *label)
-{
-	Inst i = {};
-	push_bits(i, 0, 26); // label placeholder
-	push_bits(i, 0b100101, 6);
-	push_inst(a, i);
-	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 26, 0);
-}
+void ldrsw(Assembler &a, Reg t, const char *label) { ldrsw(a, t, label_id(a, label)); }
 
-static void branchreg(Assembler &a, u32 c, Reg n)
+void prfm(Assembler &a, Prf op, LabelId label)
 {
-	if (issp(n)) {
-		a.err = ErrReg;
-		return udf(a, 0);
-	}
-	Inst i = {};
-	push_bits(i, 0, 5);
-	push_bits(i, n.code, 5);
-	push_bits(i, c, 22);
-	push_inst(a, i);
+	island(a, IslandSlack);
+	emit(a, enc::prfm(op, 0)); // label placeholder
+	label_ref(a, label, a.ip - 4, a.ip - 4, 4, 19, 5);
 }
 
-void br(Assembler &a, Reg n)  { branchreg(a, 0b1101011000011111000000, n); }
-void blr(Assembler &a, Reg n) { branchreg(a, 0b1101011000111111000000, n); }
-void ret(Assembler &a, Reg n) { branchreg(a, 0b1101011001011111000000, n); }
+void prfm(Assembler &a, Prf op, const char *label) { prfm(a, op, label_id(a, label)); }
 
 }
@@ -1,3 +1,5 @@
+// Reference: https://developer.arm.com/documentation/ddi0602/2026-03/Base-Instructions/
+
 namespace arm64 {
 
 struct Reg {
@@ -6,39 +8,90 @@ struct Reg {
 	bool sp;
 };
 
-extern const Reg x0,  w0;
-extern const Reg x1,  w1;
-extern const Reg x2,  w2;
-extern const Reg x3,  w3;
-extern const Reg x4,  w4;
-extern const Reg x5,  w5;
-extern const Reg x6,  w6;
-extern const Reg x7,  w7;
-extern const Reg x8,  w8;
-extern const Reg x9,  w9;
-extern const Reg x10, w10;
-extern const Reg x11, w11;
-extern const Reg x12, w12;
-extern const Reg x13, w13;
-extern const Reg x14, w14;
-extern const Reg x15, w15;
-extern const Reg ip0, x16, w16;
-extern const Reg ip1, x17, w17;
-extern const Reg x18, w18;
-extern const Reg x19, w19;
-extern const Reg x20, w20;
-extern const Reg x21, w21;
-extern const Reg x22, w22;
-extern const Reg x23, w23;
-extern const Reg x24, w24;
-extern const Reg x25, w25;
-extern const Reg x26, w26;
-extern const Reg x27, w27;
-extern const Reg x28, w28;
-extern const Reg fp,  x29, w29;
-extern const Reg lr,  x30, w30;
-extern const Reg xzr, wzr;
-extern const Reg sp,  wsp;
+constexpr Reg x0  = {0,  true, false}, w0  = {0,  false, false};
+constexpr Reg x1  = {1,  true, false}, w1  = {1,  false, false};
+constexpr Reg x2  = {2,  true, false}, w2  = {2,  false, false};
+constexpr Reg x3  = {3,  true, false}, w3  = {3,  false, false};
+constexpr Reg x4  = {4,  true, false}, w4  = {4,  false, false};
+constexpr Reg x5  = {5,  true, false}, w5  = {5,  false, false};
+constexpr Reg x6  = {6,  true, false}, w6  = {6,  false, false};
+constexpr Reg x7  = {7,  true, false}, w7  = {7,  false, false};
+constexpr Reg x8  = {8,  true, false}, w8  = {8,  false, false};
+constexpr Reg x9  = {9,  true, false}, w9  = {9,  false, false};
+constexpr Reg x10 = {10, true, false}, w10 = {10, false, false};
+constexpr Reg x11 = {11, true, false}, w11 = {11, false, false};
+constexpr Reg x12 = {12, true, false}, w12 = {12, false, false};
+constexpr Reg x13 = {13, true, false}, w13 = {13, false, false};
+constexpr Reg x14 = {14, true, false}, w14 = {14, false, false};
+constexpr Reg x15 = {15, true, false}, w15 = {15, false, false};
+constexpr Reg ip0 = {16, true, false}, x16 = {16, true,  false}, w16 = {16, false, false};
+constexpr Reg ip1 = {17, true, false}, x17 = {17, true,  false}, w17 = {17, false, false};
+constexpr Reg x18 = {18, true, false}, w18 = {18, false, false};
+constexpr Reg x19 = {19, true, false}, w19 = {19, false, false};
+constexpr Reg x20 = {20, true, false}, w20 = {20, false, false};
+constexpr Reg x21 = {21, true, false}, w21 = {21, false, false};
+constexpr Reg x22 = {22, true, false}, w22 = {22, false, false};
+constexpr Reg x23 = {23, true, false}, w23 = {23, false, false};
+constexpr Reg x24 = {24, true, false}, w24 = {24, false, false};
+constexpr Reg x25 = {25, true, false}, w25 = {25, false, false};
+constexpr Reg x26 = {26, true, false}, w26 = {26, false, false};
+constexpr Reg x27 = {27, true, false}, w27 = {27, false, false};
+constexpr Reg x28 = {28, true, false}, w28 = {28, false, false};
+constexpr Reg fp  = {29, true, false}, x29 = {29, true,  false}, w29 = {29, false, false};
+constexpr Reg lr  = {30, true, false}, x30 = {30, true,  false}, w30 = {30, false, false};
+constexpr Reg xzr = {31, true, false}, wzr = {31, false, false};
+constexpr Reg sp  = {31, true, true},  wsp = {31, false, true};
+
+// SIMD and floating point register. size is log2 of the bytes of an
+// element, from B to Q, and lanes is 0 for a scalar. Vectors are made
+// by the arrangement functions, v4s(v1) for v1.4s.
+struct VReg {
+	u8 code;
+	u8 size;
+	u8 lanes;
+};
+
+constexpr VReg v0  = {0,  4, 0}, q0  = {0,  4, 0}, d0  = {0,  3, 0}, s0  = {0,  2, 0}, h0  = {0,  1, 0}, b0  = {0,  0, 0};
+constexpr VReg v1  = {1,  4, 0}, q1  = {1,  4, 0}, d1  = {1,  3, 0}, s1  = {1,  2, 0}, h1  = {1,  1, 0}, b1  = {1,  0, 0};
+constexpr VReg v2  = {2,  4, 0}, q2  = {2,  4, 0}, d2  = {2,  3, 0}, s2  = {2,  2, 0}, h2  = {2,  1, 0}, b2  = {2,  0, 0};
+constexpr VReg v3  = {3,  4, 0}, q3  = {3,  4, 0}, d3  = {3,  3, 0}, s3  = {3,  2, 0}, h3  = {3,  1, 0}, b3  = {3,  0, 0};
+constexpr VReg v4  = {4,  4, 0}, q4  = {4,  4, 0}, d4  = {4,  3, 0}, s4  = {4,  2, 0}, h4  = {4,  1, 0}, b4  = {4,  0, 0};
+constexpr VReg v5  = {5,  4, 0}, q5  = {5,  4, 0}, d5  = {5,  3, 0}, s5  = {5,  2, 0}, h5  = {5,  1, 0}, b5  = {5,  0, 0};
+constexpr VReg v6  = {6,  4, 0}, q6  = {6,  4, 0}, d6  = {6,  3, 0}, s6  = {6,  2, 0}, h6  = {6,  1, 0}, b6  = {6,  0, 0};
+constexpr VReg v7  = {7,  4, 0}, q7  = {7,  4, 0}, d7  = {7,  3, 0}, s7  = {7,  2, 0}, h7  = {7,  1, 0}, b7  = {7,  0, 0};
+constexpr VReg v8  = {8,  4, 0}, q8  = {8,  4, 0}, d8  = {8,  3, 0}, s8  = {8,  2, 0}, h8  = {8,  1, 0}, b8  = {8,  0, 0};
+constexpr VReg v9  = {9,  4, 0}, q9  = {9,  4, 0}, d9  = {9,  3, 0}, s9  = {9,  2, 0}, h9  = {9,  1, 0}, b9  = {9,  0, 0};
+constexpr VReg v10 = {10, 4, 0}, q10 = {10, 4, 0}, d10 = {10, 3, 0}, s10 = {10, 2, 0}, h10 = {10, 1, 0}, b10 = {10, 0, 0};
+constexpr VReg v11 = {11, 4, 0}, q11 = {11, 4, 0}, d11 = {11, 3, 0}, s11 = {11, 2, 0}, h11 = {11, 1, 0}, b11 = {11, 0, 0};
+constexpr VReg v12 = {12, 4, 0}, q12 = {12, 4, 0}, d12 = {12, 3, 0}, s12 = {12, 2, 0}, h12 = {12, 1, 0}, b12 = {12, 0, 0};
+constexpr VReg v13 = {13, 4, 0}, q13 = {13, 4, 0}, d13 = {13, 3, 0}, s13 = {13, 2, 0}, h13 = {13, 1, 0}, b13 = {13, 0, 0};
+constexpr VReg v14 = {14, 4, 0}, q14 = {14, 4, 0}, d14 = {14, 3, 0}, s14 = {14, 2, 0}, h14 = {14, 1, 0}, b14 = {14, 0, 0};
+constexpr VReg v15 = {15, 4, 0}, q15 = {15, 4, 0}, d15 = {15, 3, 0}, s15 = {15, 2, 0}, h15 = {15, 1, 0}, b15 = {15, 0, 0};
+constexpr VReg v16 = {16, 4, 0}, q16 = {16, 4, 0}, d16 = {16, 3, 0}, s16 = {16, 2, 0}, h16 = {16, 1, 0}, b16 = {16, 0, 0};
+constexpr VReg v17 = {17, 4, 0}, q17 = {17, 4, 0}, d17 = {17, 3, 0}, s17 = {17, 2, 0}, h17 = {17, 1, 0}, b17 = {17, 0, 0};
+constexpr VReg v18 = {18, 4, 0}, q18 = {18, 4, 0}, d18 = {18, 3, 0}, s18 = {18, 2, 0}, h18 = {18, 1, 0}, b18 = {18, 0, 0};
+constexpr VReg v19 = {19, 4, 0}, q19 = {19, 4, 0}, d19 = {19, 3, 0}, s19 = {19, 2, 0}, h19 = {19, 1, 0}, b19 = {19, 0, 0};
+constexpr VReg v20 = {20, 4, 0}, q20 = {20, 4, 0}, d20 = {20, 3, 0}, s20 = {20, 2, 0}, h20 = {20, 1, 0}, b20 = {20, 0, 0};
+constexpr VReg v21 = {21, 4, 0}, q21 = {21, 4, 0}, d21 = {21, 3, 0}, s21 = {21, 2, 0}, h21 = {21, 1, 0}, b21 = {21, 0, 0};
+constexpr VReg v22 = {22, 4, 0}, q22 = {22, 4, 0}, d22 = {22, 3, 0}, s22 = {22, 2, 0}, h22 = {22, 1, 0}, b22 = {22, 0, 0};
+constexpr VReg v23 = {23, 4, 0}, q23 = {23, 4, 0}, d23 = {23, 3, 0}, s23 = {23, 2, 0}, h23 = {23, 1, 0}, b23 = {23, 0, 0};
+constexpr VReg v24 = {24, 4, 0}, q24 = {24, 4, 0}, d24 = {24, 3, 0}, s24 = {24, 2, 0}, h24 = {24, 1, 0}, b24 = {24, 0, 0};
+constexpr VReg v25 = {25, 4, 0}, q25 = {25, 4, 0}, d25 = {25, 3, 0}, s25 = {25, 2, 0}, h25 = {25, 1, 0}, b25 = {25, 0, 0};
+constexpr VReg v26 = {26, 4, 0}, q26 = {26, 4, 0}, d26 = {26, 3, 0}, s26 = {26, 2, 0}, h26 = {26, 1, 0}, b26 = {26, 0, 0};
+constexpr VReg v27 = {27, 4, 0}, q27 = {27, 4, 0}, d27 = {27, 3, 0}, s27 = {27, 2, 0}, h27 = {27, 1, 0}, b27 = {27, 0, 0};
+constexpr VReg v28 = {28, 4, 0}, q28 = {28, 4, 0}, d28 = {28, 3, 0}, s28 = {28, 2, 0}, h28 = {28, 1, 0}, b28 = {28, 0, 0};
+constexpr VReg v29 = {29, 4, 0}, q29 = {29, 4, 0}, d29 = {29, 3, 0}, s29 = {29, 2, 0}, h29 = {29, 1, 0}, b29 = {29, 0, 0};
+constexpr VReg v30 = {30, 4, 0}, q30 = {30, 4, 0}, d30 = {30, 3, 0}, s30 = {30, 2, 0}, h30 = {30, 1, 0}, b30 = {30, 0, 0};
+constexpr VReg v31 = {31, 4, 0}, q31 = {31, 4, 0}, d31 = {31, 3, 0}, s31 = {31, 2, 0}, h31 = {31, 1, 0}, b31 = {31, 0, 0};
+
+constexpr VReg v8b(VReg v)  { return {v.code, 0, 8}; }
+constexpr VReg v16b(VReg v) { return {v.code, 0, 16}; }
+constexpr VReg v4h(VReg v)  { return {v.code, 1, 4}; }
+constexpr VReg v8h(VReg v)  { return {v.code, 1, 8}; }
+constexpr VReg v2s(VReg v)  { return {v.code, 2, 2}; }
+constexpr VReg v4s(VReg v)  { return {v.code, 2, 4}; }
+constexpr VReg v1d(VReg v)  { return {v.code, 3, 1}; }
+constexpr VReg v2d(VReg v)  { return {v.code, 3, 2}; }
 
 enum Error {
 	ErrReg = AsmErrCount,
@@ -82,8 +135,933 @@ enum Sh {
 	ASR,
 };
 
+enum Addr {
+	AddrOffset, // [base, #offset]
+	AddrPre,    // [base, #offset]!
+	AddrPost,   // [base], #offset
+	AddrReg,    // [base, index, ext #shift]
+};
+
+// Memory operand, the base is an x register or sp. Immediate offsets
+// are in bytes and must fit the form chosen for the access size.
+struct Ptr {
+	Reg  base;
+	Reg  index;
+	s32  offset;
+	u8   mode;
+	Ex   ext;
+	u8   shift; // 0 or log2 of the access size
+};
+
+constexpr Ptr ptr(Reg base, s32 offset = 0) { return {base, {}, offset, AddrOffset, UXTX, 0}; }
+constexpr Ptr pre(Reg base, s32 offset)     { return {base, {}, offset, AddrPre, UXTX, 0}; }
+constexpr Ptr post(Reg base, s32 offset)    { return {base, {}, offset, AddrPost, UXTX, 0}; }
+constexpr Ptr ptr(Reg base, Reg index, Ex e, u8 shift = 0) { return {base, index, 0, AddrReg, e, shift}; }
+
+// Only LSL is allowed, the others are rejected as UXTB
+constexpr Ptr ptr(Reg base, Reg index, Sh s = LSL, u8 shift = 0) { return ptr(base, index, s == LSL ? UXTX : UXTB, shift); }
+
+enum Prf {
+	PLDL1KEEP = 0b00000,
+	PLDL1STRM,
+	PLDL2KEEP,
+	PLDL2STRM,
+	PLDL3KEEP,
+	PLDL3STRM,
+	PLIL1KEEP = 0b01000,
+	PLIL1STRM,
+	PLIL2KEEP,
+	PLIL2STRM,
+	PLIL3KEEP,
+	PLIL3STRM,
+	PSTL1KEEP = 0b10000,
+	PSTL1STRM,
+	PSTL2KEEP,
+	PSTL2STRM,
+	PSTL3KEEP,
+	PSTL3STRM,
+};
+
+// Encoders that only compute the bits of an instruction, so that
+// they can run in constant expressions (see Stencil). The functions
+// after them emit what they return into an Assembler.
+namespace enc {
+
+constexpr bool iszr(Reg r) { return r.code == 31 && !r.sp; }
+constexpr bool issp(Reg r) { return r.sp; }
+
+struct [[nodiscard]] Inst {
+	u32 v;
+	u8  n;
+	int err; // the operands are not encodable
+};
+
+constexpr Inst fail(int err)
+{
+	Inst i = {};
+	i.err = err;
+	return i;
+}
+
+// Fields are pushed from the least significant bit, n bits of v each
+constexpr void push_bits(Inst &i, u32 v, u8 n)
+{
+	i.v |= v << i.n;
+	i.n += n;
+}
+
+constexpr Inst svc(u16 imm)
+{
+	Inst i = {};
+	push_bits(i, 0b00001, 5);
+	push_bits(i, imm, 16);
+	push_bits(i, 0b11010100000, 11);
+	return i;
+}
+
+constexpr Inst udf(u16 imm) { return {imm, 32, 0}; }
+constexpr Inst nop() { return {0xd503201f, 32, 0}; }
+
+constexpr Inst inst3r(u8 c1, u16 c2, Reg d, Reg n, Reg m)
+{
+	if (issp(d) || issp(n) || issp(m))
+		return fail(ErrReg);
+	if (d.sf != n.sf || n.sf != m.sf)
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, c1, 6);
+	push_bits(i, m.code, 5);
+	push_bits(i, c2, 10);
+	push_bits(i, d.sf, 1);
+	return i;
+}
+
+constexpr Inst adc(Reg d, Reg n, Reg m)  { return inst3r(0, 0b0011010000, d, n, m); }
+constexpr Inst sdiv(Reg d, Reg n, Reg m) { return inst3r(3, 0b0011010110, d, n, m); }
+constexpr Inst udiv(Reg d, Reg n, Reg m) { return inst3r(2, 0b0011010110, d, n, m); }
+
+constexpr bool testbit(u64 v, u8 bit)
+{
+	return (v >> bit) & 1;
+}
+
+constexpr Inst inste(u16 c, Reg d, Reg n, Reg m, Ex e, u8 imm3)
+{
+	bool spd = !testbit(c, 8);
+	if ((spd && iszr(d)) || (!spd && issp(d)) || iszr(n) || issp(m))
+		return fail(ErrReg);
+	if (d.sf != n.sf || n.sf != m.sf || imm3 > 4)
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, imm3, 3);
+	push_bits(i, e, 3);
+	push_bits(i, m.code, 5);
+	push_bits(i, c, 10);
+	push_bits(i, d.sf, 1);
+	return i;
+}
+
+constexpr Inst insts(u8 c, Reg d, Reg n, Reg m, Sh s, u8 imm6)
+{
+	if (issp(d) || issp(n) || issp(m))
+		return fail(ErrReg);
+	if (d.sf != n.sf || n.sf != m.sf || imm6 > ((32<<d.sf) - 1))
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, imm6, 6);
+	push_bits(i, m.code, 5);
+	push_bits(i, 0, 1);
+	push_bits(i, s, 2);
+	push_bits(i, c, 7);
+	push_bits(i, d.sf, 1);
+	return i;
+}
+
+constexpr Inst insti(u8 c, Reg d, Reg n, u16 imm12, Sh s, u8 simm)
+{
+	bool spd = !testbit(c, 6);
+	if ((spd && iszr(d)) || (!spd && issp(d)) || iszr(n))
+		return fail(ErrReg);
+	if (d.sf != n.sf || s != LSL || (simm != 0 && simm != 12) || imm12 > 4095)
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, imm12, 12);
+	push_bits(i, simm == 12, 1);
+	push_bits(i, c, 8);
+	push_bits(i, d.sf, 1);
+	return i;
+}
+
+constexpr Inst inst3r2(u8 c1, u16 c2, Reg d, Reg n, Reg m)
+{
+	if (issp(d) || issp(n))
+		return inste(c2, d, n, m, d.sf ? UXTX : UXTW, 0);
+	return insts(c1, d, n, m, LSL, 0);
+}
+
+constexpr Inst add(Reg d, Reg n, Reg m, Ex e, u8 imm3 = 0) { return inste(0b0001011001, d, n, m, e, imm3); }
+constexpr Inst add(Reg d, Reg n, Reg m, Sh s, u8 imm6 = 0) { return insts(0b0001011, d, n, m, s, imm6); }
+constexpr Inst add(Reg d, Reg n, u16 imm12, Sh s = LSL, u8 simm = 0) { return insti(0b00100010, d, n, imm12, s, simm); }
+constexpr Inst add(Reg d, Reg n, Reg m) { return inst3r2(0b0001011, 0b0001011001, d, n, m); }
+
+constexpr Inst sub(Reg d, Reg n, Reg m, Ex e, u8 imm3 = 0) { return inste(0b1001011001, d, n, m, e, imm3); }
+constexpr Inst sub(Reg d, Reg n, Reg m, Sh s, u8 imm6 = 0) { return insts(0b1001011, d, n, m, s, imm6); }
+constexpr Inst sub(Reg d, Reg n, u16 imm12, Sh s = LSL, u8 simm = 0) { return insti(0b10100010, d, n, imm12, s, simm); }
+constexpr Inst sub(Reg d, Reg n, Reg m) { return inst3r2(0b1001011, 0b1001011001, d, n, m); }
+
+constexpr Inst adds(Reg d, Reg n, Reg m, Ex e, u8 imm3 = 0) { return inste(0b0101011001, d, n, m, e, imm3); }
+constexpr Inst adds(Reg d, Reg n, Reg m, Sh s, u8 imm6 = 0) { return insts(0b0101011, d, n, m, s, imm6); }
+constexpr Inst adds(Reg d, Reg n, u16 imm12, Sh s = LSL, u8 simm = 0) { return insti(0b01100010, d, n, imm12, s, simm); }
+constexpr Inst adds(Reg d, Reg n, Reg m) { return inst3r2(0b0101011, 0b0101011001, d, n, m); }
+
+constexpr Inst subs(Reg d, Reg n, Reg m, Ex e, u8 imm3 = 0) { return inste(0b1101011001, d, n, m, e, imm3); }
+constexpr Inst subs(Reg d, Reg n, Reg m, Sh s, u8 imm6 = 0) { return insts(0b1101011, d, n, m, s, imm6); }
+constexpr Inst subs(Reg d, Reg n, u16 imm12, Sh s = LSL, u8 simm = 0) { return insti(0b11100010, d, n, imm12, s, simm); }
+constexpr Inst subs(Reg d, Reg n, Reg m) { return inst3r2(0b1101011, 0b1101011001, d, n, m); }
+
+constexpr Inst cmp(Reg n, Reg m) { return subs(xzr, n, m); }
+constexpr Inst cmp(Reg n, Reg m, Ex e, u8 imm3 = 0) { return subs(xzr, n, m, e, imm3); }
+constexpr Inst cmp(Reg n, Reg m, Sh s, u8 imm6 = 0) { return subs(xzr, n, m, s, imm6); }
+constexpr Inst cmp(Reg n, u16 imm12, Sh s = LSL, u8 simm = 0) { return subs(xzr, n, imm12, s, simm); }
+
+constexpr u64 lsb(u64 x)
+{
+	return x ^ (x & (x - 1));
+}
+
+constexpr u8 cnt1(u64 x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555);
+	x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0F;
+	return (x * 0x0101010101010101) >> 56;
+}
+
+constexpr u8 nlz(u64 x)
+{
+	u8 n = 64;
+	u8 c = 0;
+	c = !!(x >> 32) << 5;
+	x >>= c, n -= c;
+	c = !!(x >> 16) << 4;
+	x >>= c, n -= c;
+	c = !!(x >> 8) << 3;
+	x >>= c, n -= c;
+	c = !!(x >> 4) << 2;
+	x >>= c, n -= c;
+	c = !!(x >> 2) << 1;
+	x >>= c, n -= c;
+	c = x >> 1;
+	x >>= c, n -= c;
+	return (n - x);
+}
+
+struct Logical {
+	u8 size;
+	u8 ones;
+	u8 rot;
+};
+
+constexpr Logical encode(u64 v, u8 vsize)
+{
+	u8 size = vsize;
+	u64 mask = (u64)-1 >> (64 - size);
+	for (u8 tmp = size/2; tmp; tmp /= 2) {
+		u64 tmask = mask >> tmp;
+		if ((v & tmask) != ((v >> tmp) & tmask))
+			break;
+		size = tmp, mask = tmask;
+	}
+	u64 seg = v & mask;
+	if (!seg || !(seg ^ mask))
+		return Logical{}; // reject 1* and 0*
+	u8 ones = cnt1(seg);
+	u8 rot = 0;
+	if (seg & 1) { // 1*0*1*
+		u64 top = seg & (seg + 1);
+		if ((top + lsb(top)) & mask)
+			return Logical{};
+		rot = cnt1(top);
+	} else {       // 0*1*0*
+		if (seg & (seg + lsb(seg)))
+			return Logical{};
+		rot = ones + nlz(seg) - (64 - size);
+	}
+	return Logical{size, ones, rot};
+}
+
+constexpr void push_logical(Inst &i, Logical l)
+{
+	// I actually wonder why arm chose such a fucked up way of
+	// encoding imms and not simply l.size | (l.ones - 1)
+	push_bits(i, (~(l.size*2 - 1) & 0x3f) | (l.ones - 1) , 6);
+	push_bits(i, l.rot, 6);
+	push_bits(i, l.size == 64, 1);
+}
+
+constexpr Inst logical(u8 opc, Reg d, Reg n, u64 imm)
+{
+	if (d.sf != n.sf || (!d.sf && (u32)imm != imm))
+		return fail(ErrSize);
+	Logical l = encode(imm, 32<<d.sf);
+	if (!l.size)
+		return fail(ErrLogical);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_logical(i, l);
+	push_bits(i, 0b100100, 6);
+	push_bits(i, opc, 2);
+	push_bits(i, d.sf, 1);
+	return i;
+}
+
+constexpr Inst and_(Reg d, Reg n, u64 imm) { return logical(0b00, d, n, imm); }
+constexpr Inst orr(Reg d, Reg n, u64 imm) { return logical(0b01, d, n, imm); }
+constexpr Inst eor(Reg d, Reg n, u64 imm) { return logical(0b10, d, n, imm); }
+
+constexpr Inst and_(Reg d, Reg n, Reg m, Sh s = LSL, u8 imm6 = 0) { return insts(0b0001010, d, n, m, s, imm6); }
+constexpr Inst orr(Reg d, Reg n, Reg m, Sh s = LSL, u8 imm6 = 0) { return insts(0b0101010, d, n, m, s, imm6); }
+constexpr Inst eor(Reg d, Reg n, Reg m, Sh s = LSL, u8 imm6 = 0) { return insts(0b1001010, d, n, m, s, imm6); }
+constexpr Inst mul(Reg d, Reg n, Reg m) { return inst3r(0b011111, 0b0011011000, d, n, m); }
+
+// Bitfield move, opc is 0b00 for sbfm and 0b10 for ubfm
+constexpr Inst bitfield(u8 opc, Reg d, Reg n, u8 immr, u8 imms)
+{
+	if (issp(d) || issp(n))
+		return fail(ErrReg);
+	if (d.sf != n.sf || immr >= 32<<d.sf || imms >= 32<<d.sf)
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, imms, 6);
+	push_bits(i, immr, 6);
+	push_bits(i, d.sf, 1);
+	push_bits(i, 0b100110, 6);
+	push_bits(i, opc, 2);
+	push_bits(i, d.sf, 1);
+	return i;
+}
+
+constexpr Inst lsl(Reg d, Reg n, u8 s) { return bitfield(0b10, d, n, -s & ((32<<d.sf) - 1), (32<<d.sf) - 1 - s); }
+constexpr Inst lsr(Reg d, Reg n, u8 s) { return bitfield(0b10, d, n, s, (32<<d.sf) - 1); }
+constexpr Inst asr(Reg d, Reg n, u8 s) { return bitfield(0b00, d, n, s, (32<<d.sf) - 1); }
+
+// Move wide, imm goes into the 16 bit half hw of d
+constexpr Inst movwide(u8 opc, Reg d, u16 imm, u8 hw)
+{
+	if (issp(d))
+		return fail(ErrReg);
+	if (hw >= (d.sf ? 4 : 2))
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, imm, 16);
+	push_bits(i, hw, 2);
+	push_bits(i, 0b100101, 6);
+	push_bits(i, opc, 2);
+	push_bits(i, d.sf, 1);
+	return i;
+}
+
+constexpr Inst movn(Reg d, u16 imm, u8 hw = 0) { return movwide(0b00, d, imm, hw); }
+constexpr Inst movz(Reg d, u16 imm, u8 hw = 0) { return movwide(0b10, d, imm, hw); }
+constexpr Inst movk(Reg d, u16 imm, u8 hw = 0) { return movwide(0b11, d, imm, hw); }
+
+constexpr Inst mov(Reg d, Reg n)
+{
+	if (issp(d) || issp(n))
+		return add(d, n, 0);
+	if (d.sf)
+		return orr(d, xzr, n);
+	else
+		return orr(d, wzr, n);
+}
+
+// Branch offsets are in bytes from the branch itself
+constexpr Inst branch(u32 op, u8 opbits, s32 off, u8 bits, u8 shift)
+{
+	s32 imm = off / 4;
+	if (off % 4)
+		return fail(ErrPatchParam);
+	if (imm < -(1 << (bits - 1)) || imm >= 1 << (bits - 1))
+		return fail(ErrOverflow);
+	Inst i = {};
+	push_bits(i, 0, shift);
+	push_bits(i, imm & ((1 << bits) - 1), bits);
+	push_bits(i, op, opbits);
+	return i;
+}
+
+constexpr Inst b(s32 off) { return branch(0b000101, 6, off, 26, 0); }
+constexpr Inst bl(s32 off) { return branch(0b100101, 6, off, 26, 0); }
+constexpr Inst b(Cond c, s32 off) { Inst i = branch(0b01010100, 8, off, 19, 5); i.v |= c; return i; }
+
+constexpr Inst cb(bool nz, Reg t, s32 off)
+{
+	if (t.sp)
+		return fail(ErrReg);
+	Inst i = branch(t.sf << 7 | 0b011010 << 1 | nz, 8, off, 19, 5);
+	i.v |= t.code;
+	return i;
+}
+
+constexpr Inst cbz(Reg t, s32 off) { return cb(false, t, off); }
+constexpr Inst cbnz(Reg t, s32 off) { return cb(true, t, off); }
+
+constexpr Inst branchreg(u32 c, Reg n)
+{
+	if (issp(n))
+		return fail(ErrReg);
+	Inst i = {};
+	push_bits(i, 0, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, c, 22);
+	return i;
+}
+
+constexpr Inst br(Reg n)  { return branchreg(0b1101011000011111000000, n); }
+constexpr Inst blr(Reg n) { return branchreg(0b1101011000111111000000, n); }
+constexpr Inst ret(Reg n = lr) { return branchreg(0b1101011001011111000000, n); }
+
+// Advanced SIMD, vector operands must have the same arrangement
+constexpr bool samearr(VReg a, VReg b) { return a.size == b.size && a.lanes == b.lanes; }
+constexpr u8 vq(VReg v) { return (v.lanes << v.size) == 16; }
+
+constexpr Inst simd3(u8 u, u8 size, u8 op, VReg d, VReg n, VReg m)
+{
+	if (!d.lanes || !samearr(d, n) || !samearr(n, m))
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, 1, 1);
+	push_bits(i, op, 5);
+	push_bits(i, m.code, 5);
+	push_bits(i, 1, 1);
+	push_bits(i, size, 2);
+	push_bits(i, 0b01110, 5);
+	push_bits(i, u, 1);
+	push_bits(i, vq(d), 1);
+	push_bits(i, 0, 1);
+	return i;
+}
+
+// Integer element arithmetic, nomax is the first size not supported
+constexpr Inst simdint(u8 u, u8 op, u8 nomax, VReg d, VReg n, VReg m)
+{
+	if (d.size >= nomax || (d.size == 3 && d.lanes == 1))
+		return fail(ErrSize);
+	return simd3(u, d.size, op, d, n, m);
+}
+
+// Bitwise operations, opc takes the place of the size
+constexpr Inst simdlogic(u8 u, u8 opc, VReg d, VReg n, VReg m)
+{
+	if (d.size != 0)
+		return fail(ErrSize);
+	return simd3(u, opc, 0b00011, d, n, m);
+}
+
+constexpr Inst add(VReg d, VReg n, VReg m)  { return simdint(0, 0b10000, 4, d, n, m); }
+constexpr Inst sub(VReg d, VReg n, VReg m)  { return simdint(1, 0b10000, 4, d, n, m); }
+constexpr Inst mul(VReg d, VReg n, VReg m)  { return simdint(0, 0b10011, 3, d, n, m); }
+constexpr Inst smax(VReg d, VReg n, VReg m) { return simdint(0, 0b01100, 3, d, n, m); }
+constexpr Inst smin(VReg d, VReg n, VReg m) { return simdint(0, 0b01101, 3, d, n, m); }
+constexpr Inst umax(VReg d, VReg n, VReg m) { return simdint(1, 0b01100, 3, d, n, m); }
+constexpr Inst umin(VReg d, VReg n, VReg m) { return simdint(1, 0b01101, 3, d, n, m); }
+constexpr Inst cmeq(VReg d, VReg n, VReg m) { return simdint(1, 0b10001, 4, d, n, m); }
+constexpr Inst cmgt(VReg d, VReg n, VReg m) { return simdint(0, 0b00110, 4, d, n, m); }
+constexpr Inst cmge(VReg d, VReg n, VReg m) { return simdint(0, 0b00111, 4, d, n, m); }
+constexpr Inst cmhi(VReg d, VReg n, VReg m) { return simdint(1, 0b00110, 4, d, n, m); }
+constexpr Inst cmhs(VReg d, VReg n, VReg m) { return simdint(1, 0b00111, 4, d, n, m); }
+constexpr Inst and_(VReg d, VReg n, VReg m) { return simdlogic(0, 0b00, d, n, m); }
+constexpr Inst bic(VReg d, VReg n, VReg m)  { return simdlogic(0, 0b01, d, n, m); }
+constexpr Inst orr(VReg d, VReg n, VReg m)  { return simdlogic(0, 0b10, d, n, m); }
+constexpr Inst orn(VReg d, VReg n, VReg m)  { return simdlogic(0, 0b11, d, n, m); }
+constexpr Inst eor(VReg d, VReg n, VReg m)  { return simdlogic(1, 0b00, d, n, m); }
+constexpr Inst bsl(VReg d, VReg n, VReg m)  { return simdlogic(1, 0b01, d, n, m); }
+constexpr Inst bit(VReg d, VReg n, VReg m)  { return simdlogic(1, 0b10, d, n, m); }
+constexpr Inst bif(VReg d, VReg n, VReg m)  { return simdlogic(1, 0b11, d, n, m); }
+constexpr Inst mov(VReg d, VReg n) { return orr(d, n, n); }
+
+constexpr Inst simd2(u8 u, u8 size, u8 op, u8 c, VReg d, VReg n)
+{
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, 0b10, 2);
+	push_bits(i, op, 5);
+	push_bits(i, c, 5);
+	push_bits(i, size, 2);
+	push_bits(i, 0b01110, 5);
+	push_bits(i, u, 1);
+	push_bits(i, vq(n), 1);
+	push_bits(i, 0, 1);
+	return i;
+}
+
+// Two registers of the same arrangement, size limits it as in simdint
+constexpr Inst simdmisc(u8 u, u8 op, u8 nomax, VReg d, VReg n)
+{
+	if (!d.lanes || !samearr(d, n) || d.size >= nomax || (d.size == 3 && d.lanes == 1))
+		return fail(ErrSize);
+	return simd2(u, d.size, op, 0b10000, d, n);
+}
+
+constexpr Inst cnt(VReg d, VReg n) { return simdmisc(0, 0b00101, 1, d, n); }
+constexpr Inst mvn(VReg d, VReg n) { return simdmisc(1, 0b00101, 1, d, n); }
+constexpr Inst abs(VReg d, VReg n) { return simdmisc(0, 0b01011, 4, d, n); }
+constexpr Inst neg(VReg d, VReg n) { return simdmisc(1, 0b01011, 4, d, n); }
+
+// Reductions across the lanes of n into a scalar of the element size
+constexpr Inst simdacross(u8 u, u8 op, VReg d, VReg n)
+{
+	if (d.lanes || d.size != n.size || !n.lanes || n.size > 2 || n.lanes == 2)
+		return fail(ErrSize);
+	return simd2(u, n.size, op, 0b11000, d, n);
+}
+
+constexpr Inst addv(VReg d, VReg n)  { return simdacross(0, 0b11011, d, n); }
+constexpr Inst smaxv(VReg d, VReg n) { return simdacross(0, 0b01010, d, n); }
+constexpr Inst sminv(VReg d, VReg n) { return simdacross(0, 0b11010, d, n); }
+constexpr Inst umaxv(VReg d, VReg n) { return simdacross(1, 0b01010, d, n); }
+constexpr Inst uminv(VReg d, VReg n) { return simdacross(1, 0b11010, d, n); }
+
+constexpr Inst simdperm(u8 op, VReg d, VReg n, VReg m)
+{
+	if (!d.lanes || !samearr(d, n) || !samearr(n, m) || (d.size == 3 && d.lanes == 1))
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, 0b10, 2);
+	push_bits(i, op, 3);
+	push_bits(i, 0, 1);
+	push_bits(i, m.code, 5);
+	push_bits(i, 0, 1);
+	push_bits(i, d.size, 2);
+	push_bits(i, 0b001110, 6);
+	push_bits(i, vq(d), 1);
+	push_bits(i, 0, 1);
+	return i;
+}
+
+constexpr Inst uzp1(VReg d, VReg n, VReg m) { return simdperm(0b001, d, n, m); }
+constexpr Inst trn1(VReg d, VReg n, VReg m) { return simdperm(0b010, d, n, m); }
+constexpr Inst zip1(VReg d, VReg n, VReg m) { return simdperm(0b011, d, n, m); }
+constexpr Inst uzp2(VReg d, VReg n, VReg m) { return simdperm(0b101, d, n, m); }
+constexpr Inst trn2(VReg d, VReg n, VReg m) { return simdperm(0b110, d, n, m); }
+constexpr Inst zip2(VReg d, VReg n, VReg m) { return simdperm(0b111, d, n, m); }
+
+// Table lookup in the len registers from t, tbl zeroes the bytes of d
+// with indexes out of range and tbx keeps them
+constexpr Inst table(u8 op, VReg d, VReg t, u8 len, VReg idx)
+{
+	if (!d.lanes || d.size != 0 || !samearr(d, idx))
+		return fail(ErrSize);
+	if (len < 1 || len > 4)
+		return fail(ErrReg);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, t.code, 5);
+	push_bits(i, 0, 2);
+	push_bits(i, op, 1);
+	push_bits(i, len - 1, 2);
+	push_bits(i, 0, 1);
+	push_bits(i, idx.code, 5);
+	push_bits(i, 0, 3);
+	push_bits(i, 0b001110, 6);
+	push_bits(i, vq(d), 1);
+	push_bits(i, 0, 1);
+	return i;
+}
+
+constexpr Inst tbl(VReg d, VReg t, u8 len, VReg idx) { return table(0, d, t, len, idx); }
+constexpr Inst tbx(VReg d, VReg t, u8 len, VReg idx) { return table(1, d, t, len, idx); }
+
+// Element moves, imm5 holds the element size and the index
+constexpr Inst simdcopy(u8 q, u8 op, u8 imm4, u8 size, u8 index, u8 d, u8 n)
+{
+	if (size > 3 || index >= 16 >> size)
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d, 5);
+	push_bits(i, n, 5);
+	push_bits(i, 1, 1);
+	push_bits(i, imm4, 4);
+	push_bits(i, 0, 1);
+	push_bits(i, (index << 1 | 1) << size, 5);
+	push_bits(i, 0b01110000, 8);
+	push_bits(i, op, 1);
+	push_bits(i, q, 1);
+	push_bits(i, 0, 1);
+	return i;
+}
+
+// Element index of n to all lanes of d
+constexpr Inst dup(VReg d, VReg n, u8 index)
+{
+	if (!d.lanes || d.size != n.size || (d.size == 3 && d.lanes == 1))
+		return fail(ErrSize);
+	return simdcopy(vq(d), 0, 0b0000, d.size, index, d.code, n.code);
+}
+
+constexpr Inst dup(VReg d, Reg n)
+{
+	if (issp(n))
+		return fail(ErrReg);
+	if (!d.lanes || n.sf != (d.size == 3) || (d.size == 3 && d.lanes == 1))
+		return fail(ErrSize);
+	return simdcopy(vq(d), 0, 0b0001, d.size, 0, d.code, n.code);
+}
+
+constexpr Inst ins(VReg d, u8 index, Reg n)
+{
+	if (issp(n))
+		return fail(ErrReg);
+	if (n.sf != (d.size == 3))
+		return fail(ErrSize);
+	return simdcopy(1, 0, 0b0011, d.size, index, d.code, n.code);
+}
+
+constexpr Inst umov(Reg d, VReg n, u8 index)
+{
+	if (issp(d))
+		return fail(ErrReg);
+	if (d.sf != (n.size == 3))
+		return fail(ErrSize);
+	return simdcopy(d.sf, 0, 0b0111, n.size, index, d.code, n.code);
+}
+
+// Floating point, on 2s, 4s and 2d vectors or on s and d scalars
+constexpr bool isfvec(VReg v) { return v.lanes && (v.size == 2 || v.size == 3) && v.lanes != 1; }
+constexpr bool isfscalar(VReg v) { return !v.lanes && (v.size == 2 || v.size == 3); }
+
+constexpr Inst fpscalar2(u8 op, VReg d, VReg n, VReg m)
+{
+	if (!isfscalar(d) || !samearr(d, n) || !samearr(n, m))
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, 0b10, 2);
+	push_bits(i, op, 4);
+	push_bits(i, m.code, 5);
+	push_bits(i, 1, 1);
+	push_bits(i, d.size == 3, 2);
+	push_bits(i, 0b11110, 5);
+	push_bits(i, 0, 3);
+	return i;
+}
+
+// sop is the opcode of the scalar form, 0xff if there is none
+constexpr Inst fp3(u8 u, u8 hi, u8 op, u8 sop, VReg d, VReg n, VReg m)
+{
+	if (!d.lanes) {
+		if (sop == 0xff)
+			return fail(ErrSize);
+		return fpscalar2(sop, d, n, m);
+	}
+	if (!isfvec(d))
+		return fail(ErrSize);
+	return simd3(u, hi << 1 | (d.size == 3), op, d, n, m);
+}
+
+constexpr Inst fadd(VReg d, VReg n, VReg m)  { return fp3(0, 0, 0b11010, 0b0010, d, n, m); }
+constexpr Inst fsub(VReg d, VReg n, VReg m)  { return fp3(0, 1, 0b11010, 0b0011, d, n, m); }
+constexpr Inst fmul(VReg d, VReg n, VReg m)  { return fp3(1, 0, 0b11011, 0b0000, d, n, m); }
+constexpr Inst fdiv(VReg d, VReg n, VReg m)  { return fp3(1, 0, 0b11111, 0b0001, d, n, m); }
+constexpr Inst fmax(VReg d, VReg n, VReg m)  { return fp3(0, 0, 0b11110, 0b0100, d, n, m); }
+constexpr Inst fmin(VReg d, VReg n, VReg m)  { return fp3(0, 1, 0b11110, 0b0101, d, n, m); }
+constexpr Inst fmla(VReg d, VReg n, VReg m)  { return fp3(0, 0, 0b11001, 0xff, d, n, m); }
+constexpr Inst fcmeq(VReg d, VReg n, VReg m) { return fp3(0, 0, 0b11100, 0xff, d, n, m); }
+constexpr Inst fcmge(VReg d, VReg n, VReg m) { return fp3(1, 0, 0b11100, 0xff, d, n, m); }
+constexpr Inst fcmgt(VReg d, VReg n, VReg m) { return fp3(1, 1, 0b11100, 0xff, d, n, m); }
+
+constexpr Inst fpscalar1(u8 op, VReg d, VReg n)
+{
+	Inst i = {};
+	push_bits(i, d.code, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, 0b10000, 5);
+	push_bits(i, op, 6);
+	push_bits(i, 1, 1);
+	push_bits(i, n.size == 3, 2);
+	push_bits(i, 0b11110, 5);
+	push_bits(i, 0, 3);
+	return i;
+}
+
+constexpr Inst fp2(u8 u, u8 op, u8 sop, VReg d, VReg n)
+{
+	if (!samearr(d, n))
+		return fail(ErrSize);
+	if (!d.lanes)
+		return isfscalar(d) ? fpscalar1(sop, d, n) : fail(ErrSize);
+	if (!isfvec(d))
+		return fail(ErrSize);
+	return simd2(u, 0b10 | (d.size == 3), op, 0b10000, d, n);
+}
+
+constexpr Inst fabs(VReg d, VReg n)  { return fp2(0, 0b01111, 0b000001, d, n); }
+constexpr Inst fneg(VReg d, VReg n)  { return fp2(1, 0b01111, 0b000010, d, n); }
+constexpr Inst fsqrt(VReg d, VReg n) { return fp2(1, 0b11111, 0b000011, d, n); }
+
+constexpr Inst fmov(VReg d, VReg n)
+{
+	if (!isfscalar(d) || !samearr(d, n))
+		return fail(ErrSize);
+	return fpscalar1(0b000000, d, n);
+}
+
+// Between single and double precision
+constexpr Inst fcvt(VReg d, VReg n)
+{
+	if (!isfscalar(d) || !isfscalar(n) || d.size == n.size)
+		return fail(ErrSize);
+	return fpscalar1(0b000100 | (d.size == 3), d, n);
+}
+
+constexpr Inst fcmp(VReg n, VReg m)
+{
+	if (!isfscalar(n) || !samearr(n, m))
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, 0, 5);
+	push_bits(i, n.code, 5);
+	push_bits(i, 0b001000, 6);
+	push_bits(i, m.code, 5);
+	push_bits(i, 1, 1);
+	push_bits(i, n.size == 3, 2);
+	push_bits(i, 0b11110, 5);
+	push_bits(i, 0, 3);
+	return i;
+}
+
+// Conversions between general purpose and floating point registers
+constexpr Inst fpconv(u8 rmode, u8 op, bool sf, VReg v, u8 d, u8 n)
+{
+	if (!isfscalar(v))
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, d, 5);
+	push_bits(i, n, 5);
+	push_bits(i, 0, 6);
+	push_bits(i, op, 3);
+	push_bits(i, rmode, 2);
+	push_bits(i, 1, 1);
+	push_bits(i, v.size == 3, 2);
+	push_bits(i, 0b11110, 5);
+	push_bits(i, 0, 2);
+	push_bits(i, sf, 1);
+	return i;
+}
+
+constexpr Inst scvtf(VReg d, Reg n)  { return issp(n) ? fail(ErrReg) : fpconv(0b00, 0b010, n.sf, d, d.code, n.code); }
+constexpr Inst ucvtf(VReg d, Reg n)  { return issp(n) ? fail(ErrReg) : fpconv(0b00, 0b011, n.sf, d, d.code, n.code); }
+constexpr Inst fcvtzs(Reg d, VReg n) { return issp(d) ? fail(ErrReg) : fpconv(0b11, 0b000, d.sf, n, d.code, n.code); }
+constexpr Inst fcvtzu(Reg d, VReg n) { return issp(d) ? fail(ErrReg) : fpconv(0b11, 0b001, d.sf, n, d.code, n.code); }
+
+// Bit copies, s to w and d to x
+constexpr Inst fmov(VReg d, Reg n)
+{
+	if (issp(n))
+		return fail(ErrReg);
+	if (n.sf != (d.size == 3))
+		return fail(ErrSize);
+	return fpconv(0b00, 0b111, n.sf, d, d.code, n.code);
+}
+
+constexpr Inst fmov(Reg d, VReg n)
+{
+	if (issp(d))
+		return fail(ErrReg);
+	if (d.sf != (n.size == 3))
+		return fail(ErrSize);
+	return fpconv(0b00, 0b110, d.sf, n, d.code, n.code);
+}
+
+// Loads and stores, size is log2 of the bytes accessed and t the
+// register transferred. The immediate offset uses the scaled unsigned
+// form when it can and the unscaled signed one otherwise.
+constexpr Inst ldst(u8 size, bool v, u8 opc, u8 t, Ptr p)
+{
+	if (!p.base.sf || iszr(p.base))
+		return fail(ErrReg);
+	bool wb = p.mode == AddrPre || p.mode == AddrPost;
+	if (wb && !v && t == p.base.code && t != 31)
+		return fail(ErrReg);
+	u8 field = size & 3; // q is size 0 with the high bit of opc set
+	if (size == 4)
+		opc |= 0b10;
+	Inst i = {};
+	push_bits(i, t, 5);
+	push_bits(i, p.base.code, 5);
+	s32 off = p.offset;
+	if (p.mode == AddrReg) {
+		if (issp(p.index) || !(p.ext & 0b010) || p.index.sf != (p.ext & 1))
+			return fail(ErrReg);
+		if (p.shift && p.shift != size)
+			return fail(ErrSize);
+		push_bits(i, 0b10, 2);
+		push_bits(i, p.shift != 0, 1);
+		push_bits(i, p.ext, 3);
+		push_bits(i, p.index.code, 5);
+		push_bits(i, 1, 1);
+		push_bits(i, opc, 2);
+		push_bits(i, 0b00, 2);
+	} else if (p.mode == AddrOffset && off >= 0 && !(off & ((1 << size) - 1)) && off >> size <= 4095) {
+		push_bits(i, off >> size, 12);
+		push_bits(i, opc, 2);
+		push_bits(i, 0b01, 2);
+	} else {
+		if (off < -256 || off > 255)
+			return fail(ErrSize);
+		push_bits(i, p.mode == AddrOffset ? 0b00 : p.mode == AddrPre ? 0b11 : 0b01, 2);
+		push_bits(i, off & 0x1ff, 9);
+		push_bits(i, 0, 1);
+		push_bits(i, opc, 2);
+		push_bits(i, 0b00, 2);
+	}
+	push_bits(i, v, 1);
+	push_bits(i, 0b111, 3);
+	push_bits(i, field, 2);
+	return i;
+}
+
+constexpr Inst ldstr(u8 size, u8 opc, Reg t, Ptr p)
+{
+	if (issp(t))
+		return fail(ErrReg);
+	return ldst(size, false, opc, t.code, p);
+}
+
+// Access size of a SIMD register, vectors are d or q
+constexpr u8 vsize(VReg v)
+{
+	if (!v.lanes)
+		return v.size;
+	return 3 + vq(v);
+}
+
+constexpr Inst ldr(Reg t, Ptr p)  { return ldstr(2 + t.sf, 0b01, t, p); }
+constexpr Inst str(Reg t, Ptr p)  { return ldstr(2 + t.sf, 0b00, t, p); }
+constexpr Inst ldrb(Reg t, Ptr p) { return t.sf ? fail(ErrSize) : ldstr(0, 0b01, t, p); }
+constexpr Inst strb(Reg t, Ptr p) { return t.sf ? fail(ErrSize) : ldstr(0, 0b00, t, p); }
+constexpr Inst ldrh(Reg t, Ptr p) { return t.sf ? fail(ErrSize) : ldstr(1, 0b01, t, p); }
+constexpr Inst strh(Reg t, Ptr p) { return t.sf ? fail(ErrSize) : ldstr(1, 0b00, t, p); }
+constexpr Inst ldrsb(Reg t, Ptr p) { return ldstr(0, t.sf ? 0b10 : 0b11, t, p); }
+constexpr Inst ldrsh(Reg t, Ptr p) { return ldstr(1, t.sf ? 0b10 : 0b11, t, p); }
+constexpr Inst ldrsw(Reg t, Ptr p) { return !t.sf ? fail(ErrSize) : ldstr(2, 0b10, t, p); }
+constexpr Inst ldr(VReg t, Ptr p) { return ldst(vsize(t), true, 0b01, t.code, p); }
+constexpr Inst str(VReg t, Ptr p) { return ldst(vsize(t), true, 0b00, t.code, p); }
+
+// The unscaled form of a prefetch is prfum
+constexpr Inst prfm(Prf op, Ptr p)
+{
+	if (p.mode == AddrPre || p.mode == AddrPost)
+		return fail(ErrSize);
+	return ldst(3, false, 0b10, op, p);
+}
+
+// Pairs, with a signed 7 bit offset scaled by the size of a register
+constexpr Inst ldstp(u8 opc, bool v, bool l, u8 size, u8 t, u8 t2, Ptr p)
+{
+	if (!p.base.sf || iszr(p.base) || p.mode == AddrReg)
+		return fail(ErrReg);
+	bool wb = p.mode == AddrPre || p.mode == AddrPost;
+	if (!v && wb && (t == p.base.code || t2 == p.base.code) && p.base.code != 31)
+		return fail(ErrReg);
+	if (l && t == t2)
+		return fail(ErrReg);
+	s32 imm = p.offset >> size;
+	if (p.offset & ((1 << size) - 1) || imm < -64 || imm > 63)
+		return fail(ErrSize);
+	Inst i = {};
+	push_bits(i, t, 5);
+	push_bits(i, p.base.code, 5);
+	push_bits(i, t2, 5);
+	push_bits(i, imm & 0x7f, 7);
+	push_bits(i, l, 1);
+	push_bits(i, p.mode == AddrOffset ? 0b010 : p.mode == AddrPre ? 0b011 : 0b001, 3);
+	push_bits(i, v, 1);
+	push_bits(i, 0b101, 3);
+	push_bits(i, opc, 2);
+	return i;
+}
+
+constexpr Inst ldstp(bool l, Reg t, Reg t2, Ptr p)
+{
+	if (issp(t) || issp(t2))
+		return fail(ErrReg);
+	if (t.sf != t2.sf)
+		return fail(ErrSize);
+	return ldstp(t.sf << 1, false, l, 2 + t.sf, t.code, t2.code, p);
+}
+
+constexpr Inst ldstp(bool l, VReg t, VReg t2, Ptr p)
+{
+	u8 size = vsize(t);
+	if (size != vsize(t2) || size < 2)
+		return fail(ErrSize);
+	return ldstp(size - 2, true, l, size, t.code, t2.code, p);
+}
+
+constexpr Inst ldp(Reg t, Reg t2, Ptr p)   { return ldstp(true, t, t2, p); }
+constexpr Inst stp(Reg t, Reg t2, Ptr p)   { return ldstp(false, t, t2, p); }
+constexpr Inst ldp(VReg t, VReg t2, Ptr p) { return ldstp(true, t, t2, p); }
+constexpr Inst stp(VReg t, VReg t2, Ptr p) { return ldstp(false, t, t2, p); }
+
+// PC relative loads, off is in bytes from the load as for branch
+constexpr Inst literal(u8 opc, bool v, u8 t, s32 off)
+{
+	Inst i = branch(opc << 6 | 0b011 << 3 | v << 2, 8, off, 19, 5);
+	i.v |= t;
+	return i;
+}
+
+constexpr Inst ldr(Reg t, s32 off)   { return issp(t) ? fail(ErrReg) : literal(t.sf, false, t.code, off); }
+constexpr Inst ldrsw(Reg t, s32 off) { return issp(t) || !t.sf ? fail(ErrSize) : literal(0b10, false, t.code, off); }
+constexpr Inst prfm(Prf op, s32 off) { return literal(0b11, false, op, off); }
+
+constexpr Inst ldr(VReg t, s32 off)
+{
+	u8 size = vsize(t);
+	if (size < 2)
+		return fail(ErrSize);
+	return literal(size - 2, true, t.code, off);
+}
+
+}
+
+template <u32 N, u32 H>
+constexpr void emit(Stencil<N, H> &s, const enc::Inst &i)
+{
+	if (i.err || i.n != 32)
+		stencil_error("invalid operands");
+	push_u32(s, i.v);
+}
+
 void udf(Assembler &a, u16 imm);
 void svc(Assembler &a, u16 imm);
+void nop(Assembler &a);
+
+// Pad to a multiple of n bytes with nops, or with udf for padding
+// that is never executed, such as between functions. label binds l
+// after nops.
+void align(Assembler &a, u32 n, bool trap = false);
+void label(Assembler &a, LabelId l, u32 align);
+void label(Assembler &a, const char *name, u32 align);
 void adc(Assembler &a, Reg d, Reg n, Reg m);
 void add(Assembler &a, Reg d, Reg n, Reg m);
 void add(Assembler &a, Reg d, Reg n, Reg m, Ex e, u8 imm3 = 0);
@@ -107,14 +1085,133 @@ void cmp(Assembler &a, Reg n, Reg m, Sh s, u8 imm6 = 0);
 void cmp(Assembler &a, Reg n, u16 imm12, Sh s = LSL, u8 simm = 0);
 void sdiv(Assembler &a, Reg d, Reg n, Reg m);
 void udiv(Assembler &a, Reg d, Reg n, Reg m);
+void b(Assembler &a, LabelId label);
 void b(Assembler &a, const char *label);
+void b(Assembler &a, Cond c, LabelId label);
 void b(Assembler &a, Cond c, const char *label);
+void cbz(Assembler &a, Reg t, LabelId label);
+void cbz(Assembler &a, Reg t, const char *label);
+void cbnz(Assembler &a, Reg t, LabelId label);
+void cbnz(Assembler &a, Reg t, const char *label);
+void bl(Assembler &a, LabelId label);
 void bl(Assembler &a, const char *label);
 void br(Assembler &a, Reg n);
 void blr(Assembler &a, Reg n);
 void orr(Assembler &a, Reg d, Reg n, Reg m, Sh s = LSL, u8 imm6 = 0);
 void orr(Assembler &a, Reg d, Reg n, u64 imm);
+void and_(Assembler &a, Reg d, Reg n, Reg m, Sh s = LSL, u8 imm6 = 0);
+void and_(Assembler &a, Reg d, Reg n, u64 imm);
+void eor(Assembler &a, Reg d, Reg n, Reg m, Sh s = LSL, u8 imm6 = 0);
+void eor(Assembler &a, Reg d, Reg n, u64 imm);
+void mul(Assembler &a, Reg d, Reg n, Reg m);
+void lsl(Assembler &a, Reg d, Reg n, u8 s);
+void lsr(Assembler &a, Reg d, Reg n, u8 s);
+void asr(Assembler &a, Reg d, Reg n, u8 s);
 void mov(Assembler &a, Reg d, Reg n);
+void mov(Assembler &a, Reg d, u64 imm);
+void movn(Assembler &a, Reg d, u16 imm, u8 hw = 0);
+void movz(Assembler &a, Reg d, u16 imm, u8 hw = 0);
+void movk(Assembler &a, Reg d, u16 imm, u8 hw = 0);
 void ret(Assembler &a, Reg n = lr);
 
+// Advanced SIMD and floating point
+void add(Assembler &a, VReg d, VReg n, VReg m);
+void sub(Assembler &a, VReg d, VReg n, VReg m);
+void mul(Assembler &a, VReg d, VReg n, VReg m);
+void smax(Assembler &a, VReg d, VReg n, VReg m);
+void smin(Assembler &a, VReg d, VReg n, VReg m);
+void umax(Assembler &a, VReg d, VReg n, VReg m);
+void umin(Assembler &a, VReg d, VReg n, VReg m);
+void cmeq(Assembler &a, VReg d, VReg n, VReg m);
+void cmgt(Assembler &a, VReg d, VReg n, VReg m);
+void cmge(Assembler &a, VReg d, VReg n, VReg m);
+void cmhi(Assembler &a, VReg d, VReg n, VReg m);
+void cmhs(Assembler &a, VReg d, VReg n, VReg m);
+void and_(Assembler &a, VReg d, VReg n, VReg m);
+void bic(Assembler &a, VReg d, VReg n, VReg m);
+void orr(Assembler &a, VReg d, VReg n, VReg m);
+void orn(Assembler &a, VReg d, VReg n, VReg m);
+void eor(Assembler &a, VReg d, VReg n, VReg m);
+void bsl(Assembler &a, VReg d, VReg n, VReg m);
+void bit(Assembler &a, VReg d, VReg n, VReg m);
+void bif(Assembler &a, VReg d, VReg n, VReg m);
+void mov(Assembler &a, VReg d, VReg n);
+void cnt(Assembler &a, VReg d, VReg n);
+void mvn(Assembler &a, VReg d, VReg n);
+void abs(Assembler &a, VReg d, VReg n);
+void neg(Assembler &a, VReg d, VReg n);
+void addv(Assembler &a, VReg d, VReg n);
+void smaxv(Assembler &a, VReg d, VReg n);
+void sminv(Assembler &a, VReg d, VReg n);
+void umaxv(Assembler &a, VReg d, VReg n);
+void uminv(Assembler &a, VReg d, VReg n);
+void uzp1(Assembler &a, VReg d, VReg n, VReg m);
+void uzp2(Assembler &a, VReg d, VReg n, VReg m);
+void trn1(Assembler &a, VReg d, VReg n, VReg m);
+void trn2(Assembler &a, VReg d, VReg n, VReg m);
+void zip1(Assembler &a, VReg d, VReg n, VReg m);
+void zip2(Assembler &a, VReg d, VReg n, VReg m);
+void tbl(Assembler &a, VReg d, VReg t, u8 len, VReg idx);
+void tbx(Assembler &a, VReg d, VReg t, u8 len, VReg idx);
+void dup(Assembler &a, VReg d, VReg n, u8 index);
+void dup(Assembler &a, VReg d, Reg n);
+void ins(Assembler &a, VReg d, u8 index, Reg n);
+void umov(Assembler &a, Reg d, VReg n, u8 index);
+void fadd(Assembler &a, VReg d, VReg n, VReg m);
+void fsub(Assembler &a, VReg d, VReg n, VReg m);
+void fmul(Assembler &a, VReg d, VReg n, VReg m);
+void fdiv(Assembler &a, VReg d, VReg n, VReg m);
+void fmax(Assembler &a, VReg d, VReg n, VReg m);
+void fmin(Assembler &a, VReg d, VReg n, VReg m);
+void fmla(Assembler &a, VReg d, VReg n, VReg m);
+void fcmeq(Assembler &a, VReg d, VReg n, VReg m);
+void fcmge(Assembler &a, VReg d, VReg n, VReg m);
+void fcmgt(Assembler &a, VReg d, VReg n, VReg m);
+void fabs(Assembler &a, VReg d, VReg n);
+void fneg(Assembler &a, VReg d, VReg n);
+void fsqrt(Assembler &a, VReg d, VReg n);
+void fmov(Assembler &a, VReg d, VReg n);
+void fmov(Assembler &a, VReg d, Reg n);
+void fmov(Assembler &a, Reg d, VReg n);
+void fcvt(Assembler &a, VReg d, VReg n);
+void fcmp(Assembler &a, VReg n, VReg m);
+void scvtf(Assembler &a, VReg d, Reg n);
+void ucvtf(Assembler &a, VReg d, Reg n);
+void fcvtzs(Assembler &a, Reg d, VReg n);
+void fcvtzu(Assembler &a, Reg d, VReg n);
+
+// Loads and stores
+void ldr(Assembler &a, Reg t, Ptr p);
+void str(Assembler &a, Reg t, Ptr p);
+void ldrb(Assembler &a, Reg t, Ptr p);
+void strb(Assembler &a, Reg t, Ptr p);
+void ldrh(Assembler &a, Reg t, Ptr p);
+void strh(Assembler &a, Reg t, Ptr p);
+void ldrsb(Assembler &a, Reg t, Ptr p);
+void ldrsh(Assembler &a, Reg t, Ptr p);
+void ldrsw(Assembler &a, Reg t, Ptr p);
+void ldr(Assembler &a, VReg t, Ptr p);
+void str(Assembler &a, VReg t, Ptr p);
+void prfm(Assembler &a, Prf op, Ptr p);
+void ldp(Assembler &a, Reg t, Reg t2, Ptr p);
+void stp(Assembler &a, Reg t, Reg t2, Ptr p);
+void ldp(Assembler &a, VReg t, VReg t2, Ptr p);
+void stp(Assembler &a, VReg t, VReg t2, Ptr p);
+// Literal loads reach 1MB. Pending literals (see ::pool) are placed
+// in an island, with a branch around it, by a branch or literal load
+// once they would go out of reach within the next 64KB. A stretch of
+// more than 64KB without those, where the pool falls due, fails with
+// ErrOverflow at finalize unless it calls island at least every ahead
+// bytes, which places the island once the literals would go out of
+// reach within them.
+void island(Assembler &a, u32 ahead = 0);
+void ldr(Assembler &a, Reg t, LabelId label);
+void ldr(Assembler &a, Reg t, const char *label);
+void ldr(Assembler &a, VReg t, LabelId label);
+void ldr(Assembler &a, VReg t, const char *label);
+void ldrsw(Assembler &a, Reg t, LabelId label);
+void ldrsw(Assembler &a, Reg t, const char *label);
+void prfm(Assembler &a, Prf op, LabelId label);
+void prfm(Assembler &a, Prf op, const char *label);
+
 }
@@ -1,4 +1,5 @@
 #include <sys/mman.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -9,25 +10,108 @@
 // We just reserve 4GiB of space upfront
 static const u64 CodeSize = 4*((u64)1 << 30);
 
+// How much of the memory rewind keeps resident by default
+static const u64 DefaultKeep = (u64)1 << 20;
+
+void init(Assembler &a, u8 *buf, u64 size)
+{
+	a = {};
+	a.backing = BackFixed;
+	a.code = buf;
+	a.cap = size < CodeSize ? size : CodeSize;
+}
+
+void init(Assembler &a, u64 size)
+{
+	a = {};
+	a.backing = BackGrow;
+	a.cap = size ? (size + 4095) & ~(u64)4095 : 4096;
+	a.code = (u8 *)mmap(0, a.cap, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+	assert(a.code != MAP_FAILED);
+}
+
+// Free everything but the backing: a caller provided buffer stays
+// and a growable mapping starts over from a page on the next use
 void clear(Assembler &a)
 {
 	reset(a.tmp);
-	munmap(a.code, CodeSize);
-	a = {};
+	if (a.code && a.backing != BackFixed)
+		munmap(a.code, a.cap);
+	Assembler r = {};
+	r.backing = a.backing;
+	if (a.backing == BackFixed) {
+		r.code = a.code;
+		r.cap = a.cap;
+	}
+	a = r;
 }
 
-void push_bytes(Assembler &a, u64 v, u8 count)
+// Start over, keeping the code mapping and the arena pages around
+// for the next function. Whatever was touched above the first keep
+// bytes is handed back to the kernel lazily, up to the highest ip
+// reached even if relaxing moved it back.
+void rewind(Assembler &a)
+{
+	u64 keep = a.keep ? a.keep : DefaultKeep;
+	u64 top = a.top > a.ip ? a.top : a.ip;
+	rewind(a.tmp, keep);
+	if (a.code && a.backing != BackFixed)
+		release(a.code, keep, a.cap - top < 16 ? a.cap : top + 16);
+	Assembler r = {};
+	r.tmp = a.tmp;
+	r.flags = a.flags;
+	r.backing = a.backing;
+	r.code = a.code;
+	r.cap = a.cap;
+	r.keep = a.keep;
+	a = r;
+}
+
+// Slow path of the emitters: maps or grows the code if the backing
+// allows it and checks that n more bytes fit.
+static bool reserve(Assembler &a, u64 n)
 {
-	if (!a.code)
+	if (!a.code && a.backing == BackReserve) {
 		a.code = (u8 *)mmap(0, CodeSize, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_NORESERVE, -1, 0);
-	assert(a.code != MAP_FAILED);
-	if (a.ip > CodeSize - count) {
+		assert(a.code != MAP_FAILED);
+		a.cap = CodeSize;
+	}
+	if (!a.code && a.backing == BackGrow) {
+		a.cap = 4096;
+		a.code = (u8 *)mmap(0, a.cap, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+		assert(a.code != MAP_FAILED);
+	}
+	// grow with room for the fast paths to kick in again
+	if (a.backing == BackGrow && a.cap - a.ip < n + 16 && a.cap < CodeSize) {
+		u64 cap = a.cap*2 > a.ip + n + 16 ? a.cap*2 : (a.ip + n + 16 + 4095) & ~(u64)4095;
+		if (cap > CodeSize)
+			cap = CodeSize;
+		u8 *code = (u8 *)mremap(a.code, a.cap, cap, MREMAP_MAYMOVE);
+		if (code != MAP_FAILED) {
+			a.code = code;
+			a.cap = cap;
+		}
+	}
+	if (a.cap - a.ip < n) {
 		a.err = ErrOverflow;
-		return;
+		return false;
 	}
-	for (u8 i = 0; i < count; i++) {
-		a.code[a.ip+i] = v & 0xff;
-		v = v >> 8;
+	return true;
+}
+
+// The emitters below store a fixed number of bytes at once and then
+// advance ip only by the meaningful count. The garbage past ip is
+// overwritten by the next instruction.
+
+void push_bytes(Assembler &a, u64 v, u8 count)
+{
+	if (a.cap - a.ip < 8 && !reserve(a, count))
+		return;
+	if (a.cap - a.ip < 8) {
+		for (u8 i = 0; i < count; i++, v >>= 8)
+			a.code[a.ip+i] = v & 0xff;
+	} else {
+		memcpy(a.code + a.ip, &v, 8); // little-endian
 	}
 	a.ip += count;
 }
@@ -37,27 +121,243 @@ void push_byte(Assembler &a, u8 b)
 	push_bytes(a, b, 1);
 }
 
-static Symbol *get_sym(Assembler &a, const char *name)
+// lo and hi hold the instruction bytes, n of them in total
+void push_inst(Assembler &a, u64 lo, u64 hi, u8 n)
+{
+	if (a.cap - a.ip < 16) {
+		if (!reserve(a, n))
+			return;
+		if (a.cap - a.ip < 16) {
+			for (u8 i = 0; i < n; i++, lo = lo >> 8 | hi << 56, hi >>= 8)
+				a.code[a.ip+i] = lo & 0xff;
+			a.ip += n;
+			return;
+		}
+	}
+	memcpy(a.code + a.ip, &lo, 8); // little-endian
+	memcpy(a.code + a.ip + 8, &hi, 8);
+	a.ip += n;
+}
+
+void push_u32(Assembler &a, u32 v)
+{
+	if (a.cap - a.ip < 4 && !reserve(a, 4))
+		return;
+	memcpy(a.code + a.ip, &v, 4); // little-endian
+	a.ip += 4;
+}
+
+void stencil_error(const char *why)
 {
-	Symbol *s = a.syms;
-	while (s && strcmp(name, s->name))
-		s = s->next;
-	if (!s) {
-		s = (Symbol *)alloc(a.tmp, sizeof(Symbol));
-		*s = {a.syms, 0, name, 0, 0};
-		a.syms = s;
+	(void)why;
+	assert(!"stencil_error");
+}
+
+// Stencil code is padded to 16 bytes (see Stencil), so with room for
+// the overshoot it is copied in whole blocks and the holes are patched
+// with 8 byte loads and stores.
+void push_stencil(Assembler &a, const u8 *code, u32 size, const Hole *holes, u32 nhole, const Fill *f)
+{
+	bool fast = a.cap - a.ip >= size + 16;
+	if (!fast) {
+		if (!reserve(a, size))
+			return;
+		fast = a.cap - a.ip >= size + 16;
+	}
+	u32 start = a.ip;
+	u8 *p = a.code + start;
+	if (fast) {
+		for (u32 i = 0; i < size; i += 16)
+			memcpy(p + i, code + i, 16);
+	} else {
+		memcpy(p, code, size);
+	}
+	a.ip += size;
+	for (u32 i = 0; i < nhole; i++) {
+		const Hole &h = holes[i];
+		u32 pos = start + h.pos;
+		switch (h.kind) {
+			case HoleValue: {
+				u64 mask = h.bits == 64 ? ~(u64)0 : ((u64)1 << h.bits) - 1;
+				u64 v = (f[i].v & mask) << h.shift, w;
+				if (fast) {
+					memcpy(&w, p + h.pos, 8); // little-endian
+					w |= v;
+					memcpy(p + h.pos, &w, 8);
+				} else {
+					for (u8 k = 0; k < h.size; k++, v >>= 8)
+						p[h.pos + k] |= v & 0xff;
+				}
+				break;
+			}
+			case HoleRel32: label_ref(a, f[i].l, pos, pos + 4, 1, 32, 0); break;
+			case HoleImm26: label_ref(a, f[i].l, pos, pos, 4, 26, 0); break;
+			case HoleImm19: label_ref(a, f[i].l, pos, pos, 4, 19, 5); break;
+		}
 	}
+}
+
+static u32 hash(const char *s)
+{
+	u32 h = 2166136261; // FNV-1a
+	while (*s)
+		h = (h ^ (u8)*s++) * 16777619;
+	return h;
+}
+
+static void insert_sym(Symbol **tab, u32 cap, Symbol *s)
+{
+	u32 i = s->hash & (cap - 1);
+	while (tab[i])
+		i = (i + 1) & (cap - 1);
+	tab[i] = s;
+}
+
+static void grow_symtab(Assembler &a)
+{
+	u32 cap = a.symcap ? a.symcap*2 : 64;
+	Symbol **tab = (Symbol **)alloc(a.tmp, cap*sizeof(Symbol *));
+	memset(tab, 0, cap*sizeof(Symbol *));
+	for (u32 i = 0; i < a.symcap; i++) {
+		if (a.symtab[i])
+			insert_sym(tab, cap, a.symtab[i]);
+	}
+	a.symtab = tab;
+	a.symcap = cap;
+}
+
+// Slot of the symbol with the given name, or of the empty slot where it goes
+static u32 probe(const Assembler &a, const char *name, u32 h)
+{
+	u32 i = h & (a.symcap - 1);
+	for (Symbol *s; (s = a.symtab[i]); i = (i + 1) & (a.symcap - 1)) {
+		if (s->hash == h && !strcmp(name, s->name))
+			break;
+	}
+	return i;
+}
+
+static Symbol *get_sym(Assembler &a, const char *name)
+{
+	// keep the load factor under 3/4
+	if ((a.symcnt + 1)*4 > a.symcap*3)
+		grow_symtab(a);
+	u32 h = hash(name);
+	u32 i = probe(a, name, h);
+	if (a.symtab[i])
+		return a.symtab[i];
+	Symbol *s = (Symbol *)alloc(a.tmp, sizeof(Symbol));
+	*s = {a.syms, 0, h, name, 0, 0, 0};
+	a.syms = s;
+	a.symtab[i] = s;
+	a.symcnt++;
 	return s;
 }
 
-static void patch_ref(Assembler &a, u32 addr, u32 pos, u32 sub, u32 div, u8 len, u8 off)
+// Fresh label without a name, it never goes into the index
+LabelId new_label(Assembler &a)
+{
+	Symbol *s = (Symbol *)alloc(a.tmp, sizeof(Symbol));
+	*s = {a.syms, 0, 0, 0, 0, 0, 0};
+	a.syms = s;
+	return {s};
+}
+
+Symbol *lookup(const Assembler &a, const char *name)
+{
+	if (!a.symcnt)
+		return 0;
+	return a.symtab[probe(a, name, hash(name))];
+}
+
+LabelId label_id(Assembler &a, const char *name)
+{
+	return {get_sym(a, name)};
+}
+
+static int byaddr(const void *x, const void *y)
+{
+	u32 a = (*(Symbol **)x)->addr, b = (*(Symbol **)y)->addr;
+	return a < b ? -1 : a > b;
+}
+
+// The n named and bound labels by address, in a.tmp
+Symbol **sorted_syms(Assembler &a, u32 &n)
+{
+	n = 0;
+	for (Symbol *s = a.syms; s; s = s->next)
+		n += s->name && s->resolved;
+	Symbol **syms = (Symbol **)alloc(a.tmp, n*sizeof(Symbol *));
+	n = 0;
+	for (Symbol *s = a.syms; s; s = s->next) {
+		if (s->name && s->resolved)
+			syms[n++] = s;
+	}
+	qsort(syms, n, sizeof(Symbol *), byaddr);
+	return syms;
+}
+
+static u32 hash(const Symbol *s, s32 add)
+{
+	return ((u64)s >> 4)*0x9e3779b1u ^ (u32)add*0x85ebca6bu;
+}
+
+// Grows nums and rebuilds numtab at twice its size
+static void grow_nums(Assembler &a)
+{
+	u32 cap = a.numcap ? a.numcap*2 : 64;
+	LabelNum *nums = (LabelNum *)alloc(a.tmp, cap*sizeof(LabelNum));
+	if (a.numcnt)
+		memcpy(nums, a.nums, (a.numcnt + 1)*sizeof(LabelNum));
+	u32 *tab = (u32 *)alloc(a.tmp, 2*cap*sizeof(u32));
+	memset(tab, 0, 2*cap*sizeof(u32));
+	for (u32 n = 1; n <= a.numcnt; n++) {
+		if (!nums[n].add)
+			continue;
+		u32 i = hash(nums[n].sym, nums[n].add) & (2*cap - 1);
+		while (tab[i])
+			i = (i + 1) & (2*cap - 1);
+		tab[i] = n;
+	}
+	a.nums = nums;
+	a.numtab = tab;
+	a.numcap = cap;
+}
+
+// Small number for add bytes after a label, for operands with no
+// room for a pointer such as amd64::Ptr, turned back by a.nums. The
+// first one is 1 so that 0 can mean none. It is the same for every
+// use of the label with the same add: without one it is kept in the
+// symbol, with one it is found through numtab.
+u32 label_num(Assembler &a, LabelId l, s32 add)
+{
+	Symbol *s = l.sym;
+	if (!add && s->num)
+		return s->num;
+	if (a.numcnt + 1 >= a.numcap)
+		grow_nums(a);
+	u32 i = hash(s, add) & (2*a.numcap - 1);
+	for (u32 n; add && (n = a.numtab[i]); i = (i + 1) & (2*a.numcap - 1)) {
+		if (a.nums[n].sym == s && a.nums[n].add == add)
+			return n;
+	}
+	u32 n = ++a.numcnt;
+	a.nums[n] = {s, add};
+	if (add)
+		a.numtab[i] = n;
+	else
+		s->num = n;
+	return n;
+}
+
+static void patch_ref(Assembler &a, u32 addr, u32 pos, u32 sub, u32 div, u8 len, u8 off, s32 add)
 {
 	u32 n = (off + len + 7)/8;
 	if (pos > a.ip || a.ip - pos < n) {
 		a.err = ErrOverflow;
 		return;
 	}
-	s64 v = (s64)addr - (s64)sub;
+	s64 v = (s64)addr + add - (s64)sub;
 	if (!len || len > 32 || off >= 32 || !div || v % div) {
 		a.err = ErrPatchParam;
 		return;
@@ -76,28 +376,400 @@ static void patch_ref(Assembler &a, u32 addr, u32 pos, u32 sub, u32 div, u8 len,
 	}
 }
 
-void label(Assembler &a, const char *name)
+void label(Assembler &a, LabelId l)
 {
-	Symbol *s = get_sym(a, name);
+	Symbol *s = l.sym;
 	if (s->resolved) {
 		a.err = ErrDupLabel;
 		return;
 	}
 	s->resolved = 1;
 	s->addr = a.ip;
+	// with relaxation enabled the code may still move,
+	// so all patching is deferred until finalize
+	if (a.flags & AsmRelax)
+		return;
 	for (Ref *r = s->refs; r; r = r->next)
-		patch_ref(a, s->addr, r->pos, r->sub, r->div, r->len, r->off);
+		patch_ref(a, s->addr, r->pos, r->sub, r->div, r->len, r->off, r->add);
 	s->refs = 0;
 }
 
-void label_ref(Assembler &a, const char *name, u32 pos, u32 sub, u32 div, u8 len, u8 off)
+void label(Assembler &a, const char *name)
 {
-	Symbol *s = get_sym(a, name);
-	if (s->resolved) {
-		patch_ref(a, s->addr, pos, sub, div, len, off);
+	label(a, label_id(a, name));
+}
+
+static int fixup_kind(u32 pos, u32 sub, u32 div, u8 len, u8 off)
+{
+	if (sub == pos + 4 && div == 1 && len == 32 && off == 0)
+		return FixRel32;
+	if (sub == pos && div == 4 && len == 26 && off == 0)
+		return FixImm26;
+	if (sub == pos && div == 4 && len == 19 && off == 5)
+		return FixImm19;
+	return FixKinds;
+}
+
+static void add_fixup(Assembler &a, int kind, u32 pos, Symbol *s)
+{
+	Fixups *f = a.fixups[kind];
+	if (!f || f->n == FixupChunk) {
+		f = (Fixups *)alloc(a.tmp, sizeof(Fixups));
+		f->next = a.fixups[kind];
+		f->n = 0;
+		a.fixups[kind] = f;
+	}
+	f->pos[f->n] = pos;
+	f->sym[f->n] = s;
+	f->n++;
+}
+
+// Patch len bits at bit off of the code at pos with the address of
+// l plus add, minus sub and divided by div, once l is bound
+void label_ref(Assembler &a, LabelId l, u32 pos, u32 sub, u32 div, u8 len, u8 off, s32 add)
+{
+	Symbol *s = l.sym;
+	if (a.flags & AsmBatch && !add) {
+		int kind = fixup_kind(pos, sub, div, len, off);
+		if (kind != FixKinds)
+			return add_fixup(a, kind, pos, s);
+	}
+	if (s->resolved && !(a.flags & AsmRelax)) {
+		patch_ref(a, s->addr, pos, sub, div, len, off, add);
 	} else {
 		Ref *r = (Ref *)alloc(a.tmp, sizeof(Ref));
-		*r = {s->refs, pos, sub, div, len, off};
+		*r = {s->refs, pos, sub, div, add, len, off};
 		s->refs = r;
 	}
 }
+
+void label_ref(Assembler &a, const char *name, u32 pos, u32 sub, u32 div, u8 len, u8 off, s32 add)
+{
+	label_ref(a, label_id(a, name), pos, sub, div, len, off, add);
+}
+
+void branch_ref(Assembler &a, LabelId l, u32 pos, u8 len, u8 op)
+{
+	if (!(a.flags & AsmRelax))
+		return label_ref(a, l, pos + len - 4, pos + len, 1, 32, 0);
+	Branch *b = (Branch *)alloc(a.tmp, sizeof(Branch));
+	*b = {a.branches, l.sym, pos, len, op, 0};
+	a.branches = b;
+	a.nbranch++;
+}
+
+// Pad ip to a multiple of n, a power of two up to 64, with what fill
+// writes. Alignment is relative to the start of the code, which the
+// code heap places at a multiple of 64.
+void align(Assembler &a, u32 n, void (*fill)(u8 *p, u32 size))
+{
+	if (!n || n & (n - 1) || n > 64) {
+		a.err = ErrAlign;
+		return;
+	}
+	u32 pos = a.ip, size = -pos & (n - 1);
+	for (u32 i = 0; i < size; i++)
+		push_byte(a, 0);
+	if (a.ip - pos != size)
+		return;
+	fill(a.code + pos, size);
+	if (!(a.flags & AsmRelax))
+		return;
+	Branch *b = (Branch *)alloc(a.tmp, sizeof(Branch));
+	*b = {a.branches, 0, pos, (u8)size, (u8)__builtin_ctz(n), fill};
+	a.branches = b;
+	a.nbranch++;
+}
+
+// Address of x after the code before it was relaxed, cut[i] is the
+// number of bytes removed before branches[i]. A label at the start
+// of padding (after is set) moves to its end, which only skips what
+// fill wrote, while a reference there stays in front of it.
+static u32 moved(Branch **bs, u32 *cut, u32 n, u32 x, bool after = false)
+{
+	u32 lo = 0, hi = n;
+	while (lo < hi) {
+		u32 mid = (lo + hi)/2;
+		if (bs[mid]->pos < x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; after && lo < n && !bs[lo]->sym && bs[lo]->pos == x; lo++);
+	return x - cut[lo];
+}
+
+// Bytes removed by the padding at pos, which is at pos - c after
+// the code before it shrank by c
+static u32 unpad(Branch *b, u32 c)
+{
+	return b->len - (-(b->pos - c) & ((1 << b->op) - 1));
+}
+
+static void relax(Assembler &a)
+{
+	u32 n = a.nbranch;
+	Branch **bs = (Branch **)alloc(a.tmp, n*sizeof(Branch *));
+	u32 *cut = (u32 *)alloc(a.tmp, (n + 1)*sizeof(u32));
+	for (Branch *b = a.branches; b; b = b->next)
+		bs[--n] = b;
+	n = a.nbranch;
+	// Shortening a branch can only bring others closer to their targets,
+	// so once a branch fits into rel8 it stays that way. Marking them
+	// until nothing changes gives the fixed point. Short ones are marked
+	// by clearing op after it is written to the code. Padding is taken
+	// as its largest size here, so the real one never moves code apart.
+	// The cuts wrap around below zero when it grows.
+	for (bool changed = true; changed;) {
+		changed = false;
+		cut[0] = 0;
+		for (u32 i = 0; i < n; i++) {
+			Branch *b = bs[i];
+			if (!b->sym)
+				cut[i+1] = cut[i] + b->len - ((1 << b->op) - 1);
+			else
+				cut[i+1] = cut[i] + (b->op ? 0 : b->len - 2);
+		}
+		for (u32 i = 0; i < n; i++) {
+			Branch *b = bs[i];
+			if (!b->sym || !b->op || !b->sym->resolved)
+				continue;
+			s64 t = moved(bs, cut, n, b->sym->addr, true);
+			s64 end = b->pos - cut[i] + (b->sym->addr > b->pos ? b->len : 2);
+			if (t - end >= -128 && t - end <= 127) {
+				a.code[b->pos] = b->op;
+				b->op = 0;
+				changed = true;
+			}
+		}
+	}
+	for (u32 i = 0; i < n; i++) {
+		Branch *b = bs[i];
+		if (!b->sym)
+			cut[i+1] = cut[i] + unpad(b, cut[i]);
+		else
+			cut[i+1] = cut[i] + (b->op ? 0 : b->len - 2);
+	}
+	u32 dst = 0, src = 0;
+	for (u32 i = 0; i < n; i++) {
+		Branch *b = bs[i];
+		memmove(a.code + dst, a.code + src, b->pos - src);
+		dst += b->pos - src;
+		src = b->pos;
+		if (!b->sym) {
+			u32 size = b->len - (cut[i+1] - cut[i]);
+			b->fill(a.code + dst, size);
+			dst += size;
+			src += b->len;
+			continue;
+		}
+		if (b->op)
+			continue;
+		a.code[dst] = a.code[src];
+		a.code[dst+1] = 0;
+		dst += 2;
+		src += b->len;
+	}
+	memmove(a.code + dst, a.code + src, a.ip - src);
+	if (a.top < a.ip)
+		a.top = a.ip;
+	a.ip = dst + a.ip - src;
+	for (Symbol *s = a.syms; s; s = s->next) {
+		for (Ref *r = s->refs; r; r = r->next) {
+			r->pos = moved(bs, cut, n, r->pos);
+			r->sub = moved(bs, cut, n, r->sub);
+		}
+		if (s->resolved)
+			s->addr = moved(bs, cut, n, s->addr, true);
+	}
+	for (Fixups *f : a.fixups) {
+		for (; f; f = f->next) {
+			for (u32 i = 0; i < f->n; i++)
+				f->pos[i] = moved(bs, cut, n, f->pos[i]);
+		}
+	}
+	for (u32 i = 0; i < n; i++) {
+		Branch *b = bs[i];
+		if (!b->sym)
+			continue;
+		u32 pos = b->pos - cut[i];
+		if (!b->op)
+			label_ref(a, {b->sym}, pos + 1, pos + 2, 1, 8, 0);
+		else
+			label_ref(a, {b->sym}, pos + b->len - 4, pos + b->len, 1, 32, 0);
+	}
+	a.branches = 0;
+	a.nbranch = 0;
+}
+
+// Patch kernels for the fixups, references to labels that
+// are still undefined are moved to the symbol's Ref list.
+
+static void unresolved(Assembler &a, Symbol *s, u32 pos, int kind)
+{
+	Ref *r = (Ref *)alloc(a.tmp, sizeof(Ref));
+	if (kind == FixRel32)
+		*r = {s->refs, pos, pos + 4, 1, 0, 32, 0};
+	else
+		*r = {s->refs, pos, pos, 4, 0, (u8)(kind == FixImm26 ? 26 : 19), (u8)(kind == FixImm26 ? 0 : 5)};
+	s->refs = r;
+}
+
+static void fix_rel32(Assembler &a, Fixups *f)
+{
+	for (u32 i = 0; i < f->n; i++) {
+		Symbol *s = f->sym[i];
+		u32 pos = f->pos[i];
+		if (!s->resolved) {
+			unresolved(a, s, pos, FixRel32);
+			continue;
+		}
+		s64 v = (s64)s->addr - ((s64)pos + 4);
+		if (v != (s32)v)
+			a.err = ErrOverflow;
+		s32 d = v;
+		memcpy(a.code + pos, &d, 4);
+	}
+}
+
+static void fix_arm64(Assembler &a, Fixups *f, int kind)
+{
+	u8 len = kind == FixImm26 ? 26 : 19;
+	u8 off = kind == FixImm26 ? 0 : 5;
+	u32 mask = ((u32)1 << len) - 1;
+	for (u32 i = 0; i < f->n; i++) {
+		Symbol *s = f->sym[i];
+		u32 pos = f->pos[i];
+		if (!s->resolved) {
+			unresolved(a, s, pos, kind);
+			continue;
+		}
+		s64 v = (s64)s->addr - pos;
+		if (v & 3)
+			a.err = ErrPatchParam;
+		if (v >= (s64)2 << len || v < -((s64)2 << len))
+			a.err = ErrOverflow;
+		u32 w;
+		memcpy(&w, a.code + pos, 4);
+		w |= ((u32)(v >> 2) & mask) << off;
+		memcpy(a.code + pos, &w, 4);
+	}
+}
+
+static void fixup(Assembler &a)
+{
+	for (Fixups *f = a.fixups[FixRel32]; f; f = f->next)
+		fix_rel32(a, f);
+	for (Fixups *f = a.fixups[FixImm26]; f; f = f->next)
+		fix_arm64(a, f, FixImm26);
+	for (Fixups *f = a.fixups[FixImm19]; f; f = f->next)
+		fix_arm64(a, f, FixImm19);
+	for (Fixups *&f : a.fixups)
+		f = 0;
+}
+
+static u32 hash(const u8 *p, u8 size)
+{
+	u32 h = 2166136261; // FNV-1a
+	for (u8 i = 0; i < size; i++)
+		h = (h ^ p[i]) * 16777619;
+	return h;
+}
+
+static void grow_littab(Assembler &a)
+{
+	u32 cap = a.litcap ? a.litcap*2 : 64;
+	Literal **tab = (Literal **)alloc(a.tmp, cap*sizeof(Literal *));
+	memset(tab, 0, cap*sizeof(Literal *));
+	for (u32 i = 0; i < a.litcap; i++) {
+		Literal *l = a.littab[i];
+		if (!l)
+			continue;
+		u32 j = l->hash & (cap - 1);
+		while (tab[j])
+			j = (j + 1) & (cap - 1);
+		tab[j] = l;
+	}
+	a.littab = tab;
+	a.litcap = cap;
+}
+
+// Label of a constant of size bytes, 4, 8, 16 or 32, placed by the
+// next pool. Equal ones waiting for the same pool share it.
+LabelId literal(Assembler &a, const void *p, u8 size)
+{
+	assert(size == 4 || size == 8 || size == 16 || size == 32);
+	if ((a.litcnt + 1)*4 > a.litcap*3)
+		grow_littab(a);
+	u32 h = hash((const u8 *)p, size);
+	u32 i = h & (a.litcap - 1);
+	for (Literal *l; (l = a.littab[i]); i = (i + 1) & (a.litcap - 1)) {
+		if (l->hash == h && l->size == size && !memcmp(l->v, p, size))
+			return l->l;
+	}
+	Literal *l = (Literal *)alloc(a.tmp, sizeof(Literal));
+	*l = {a.lits, new_label(a), h, size, {}};
+	memcpy(l->v, p, size);
+	if (!a.lits)
+		a.litpos = a.ip;
+	a.lits = l;
+	a.littab[i] = l;
+	a.litcnt++;
+	a.litsize += size;
+	return l->l;
+}
+
+LabelId literal(Assembler &a, u64 v)
+{
+	return literal(a, &v, 8);
+}
+
+static void zeros(u8 *p, u32 size)
+{
+	memset(p, 0, size);
+}
+
+// Place the pending literals at ip, somewhere that is not executed,
+// such as after the return of a function. The largest go first, so
+// that each is aligned to its size.
+void pool(Assembler &a)
+{
+	if (!a.lits)
+		return;
+	u8 max = 4;
+	for (Literal *l = a.lits; l; l = l->next)
+		max = l->size > max ? l->size : max;
+	align(a, max, zeros);
+	for (u8 size = max; size >= 4; size /= 2) {
+		for (Literal *l = a.lits; l; l = l->next) {
+			if (l->size != size)
+				continue;
+			label(a, l->l);
+			for (u8 i = 0; i < size; i += 4) {
+				u32 v;
+				memcpy(&v, l->v + i, 4);
+				push_bytes(a, v, 4);
+			}
+		}
+	}
+	a.lits = 0;
+	a.littab = 0;
+	a.litcap = a.litcnt = a.litsize = 0;
+}
+
+void finalize(Assembler &a)
+{
+	pool(a);
+	if (a.flags & AsmRelax) {
+		relax(a);
+		for (Symbol *s = a.syms; s; s = s->next) {
+			if (!s->resolved)
+				continue;
+			for (Ref *r = s->refs; r; r = r->next)
+				patch_ref(a, s->addr, r->pos, r->sub, r->div, r->len, r->off, r->add);
+			s->refs = 0;
+		}
+	}
+	if (a.flags & AsmBatch)
+		fixup(a);
+}
@@ -2,34 +2,251 @@ struct Ref {
 	Ref *next;
 	u32 pos;
 	u32 sub, div;
+	s32 add;
 	u8  len, off;
 };
 
 struct Symbol {
 	Symbol     *next;
 	u32        addr;
-	const char *name;
+	u32        hash;
+	const char *name; // 0 for anonymous labels
 	Ref        *refs;
 	int        resolved;
+	u32        num;  // see label_num, 0 until it is asked for
+};
+
+// Label and an offset from it standing behind a label_num
+struct LabelNum {
+	Symbol *sym;
+	s32    add;
+};
+
+// Relaxable branch: a jump of len bytes at pos whose displacement
+// is the trailing rel32, that can be replaced by a 2 byte op rel8.
+// Without sym it is len bytes of padding to a multiple of 1 << op,
+// redone by fill when the code before it shrinks (see align).
+struct Branch {
+	Branch *next;
+	Symbol *sym;
+	u32    pos;
+	u8     len, op;
+	void   (*fill)(u8 *p, u32 size);
+};
+
+enum FixupKind {
+	FixRel32, // amd64 rel32 at the end of the instruction
+	FixImm26, // arm64 b/bl
+	FixImm19, // arm64 b.cond
+	FixKinds,
+};
+
+static const u32 FixupChunk = 4096;
+
+// References of one kind in structure-of-arrays chunks
+struct Fixups {
+	Fixups *next;
+	u32    n;
+	u32    pos[FixupChunk];
+	Symbol *sym[FixupChunk];
+};
+
+// Interned label handle, refers to the symbol directly so
+// using it does not require any hashing or string comparison
+struct LabelId {
+	Symbol *sym;
+};
+
+// Constant of size bytes waiting for the next pool, loaded pc relative
+struct Literal {
+	Literal *next;
+	LabelId l;
+	u32     hash;
+	u8      size;
+	u8      v[32];
 };
 
 enum AsmError {
 	ErrDupLabel = 1,
 	ErrOverflow,
 	ErrPatchParam,
+	ErrAlign,
 	AsmErrCount,
 };
 
+enum AsmBacking {
+	BackReserve, // 4GiB of address space reserved on first use
+	BackFixed,   // caller provided buffer, ErrOverflow once it is full
+	BackGrow,    // small mapping grown with mremap
+};
+
+enum AsmFlag {
+	AsmRelax = 1, // shorten branches at finalize, see branch_ref
+	AsmBatch = 2, // collect common references into fixups for finalize
+	AsmShort = 4, // pick the shortest encodings, see amd64::enc::movshort
+};
+
 struct Assembler {
 	Arena  tmp;
 	Symbol *syms;
+	Symbol **symtab; // open-addressing index of syms by name
+	u32    symcap, symcnt;
+	Branch *branches;
+	u32    nbranch;
+	Fixups *fixups[FixKinds];
+	Literal *lits;    // pending, see pool
+	Literal **littab; // open-addressing index of lits by value
+	u32    litcap, litcnt;
+	u32    litpos;    // ip when the first of lits was made
+	u32    litsize;   // bytes of lits
+	LabelNum *nums;   // by label_num
+	u32    *numtab;   // open-addressing index of nums with an add, 2*numcap
+	u32    numcap, numcnt;
+	u32    flags;
+	u8     backing;
 	u8     *code;
+	u64    cap;
+	u64    keep; // bytes kept resident by rewind, 0 for the default
+	u32    top;  // highest ip before relaxing shortened the code, see rewind
 	u32    ip;
 	int    err;
 };
 
+void init(Assembler &a, u8 *buf, u64 size);
+void init(Assembler &a, u64 size);
 void clear(Assembler &a);
+void rewind(Assembler &a);
 void push_byte(Assembler &a, u8 b);
 void push_bytes(Assembler &a, u64 v, u8 count);
+void push_inst(Assembler &a, u64 lo, u64 hi, u8 n);
+void push_u32(Assembler &a, u32 v);
+LabelId label_id(Assembler &a, const char *name);
+LabelId new_label(Assembler &a);
+Symbol *lookup(const Assembler &a, const char *name);
+Symbol **sorted_syms(Assembler &a, u32 &n);
+void label(Assembler &a, LabelId l);
 void label(Assembler &a, const char *name);
-void label_ref(Assembler &a, const char *name, u32 pos, u32 sub, u32 div, u8 len, u8 off);
+void label_ref(Assembler &a, LabelId l, u32 pos, u32 sub, u32 div, u8 len, u8 off, s32 add = 0);
+void label_ref(Assembler &a, const char *name, u32 pos, u32 sub, u32 div, u8 len, u8 off, s32 add = 0);
+void branch_ref(Assembler &a, LabelId l, u32 pos, u8 len, u8 op);
+u32 label_num(Assembler &a, LabelId l, s32 add = 0);
+void align(Assembler &a, u32 n, void (*fill)(u8 *p, u32 size));
+LabelId literal(Assembler &a, const void *p, u8 size);
+LabelId literal(Assembler &a, u64 v);
+void pool(Assembler &a);
+void finalize(Assembler &a);
+
+enum HoleKind {
+	HoleValue,                // a number
+	HoleRel32 = 1 + FixRel32, // a label, referenced like by the fixups
+	HoleImm26 = 1 + FixImm26,
+	HoleImm19 = 1 + FixImm19,
+};
+
+// Field of a stencil that is patched when it is emitted: bits bits of
+// the value go to bit shift of the size little-endian bytes at pos.
+struct Hole {
+	const char *name;
+	u32        pos;
+	u8         size;
+	u8         shift;
+	u8         bits;
+	u8         kind;
+};
+
+// What a hole is filled with, l for branches to labels
+union Fill {
+	u64     v;
+	LabelId l;
+};
+
+// Fixed instruction sequence encoded in a constant expression, e.g.
+//
+//	constexpr auto s = [] {
+//		Stencil<16> s{};
+//		emit(s, enc::sub(rsp, 0));
+//		hole(s, "frame", 4);
+//		return s;
+//	}();
+//
+// Operands are checked while it is built, so emitting it is a copy
+// and a patch per hole (see push_stencil).
+template <u32 N, u32 H = 4>
+struct Stencil {
+	u8   code[(N + 15) & ~15u]; // padded for push_stencil
+	u32  size;
+	Hole holes[H];
+	u32  nhole;
+};
+
+// Not constexpr: calling it while building a stencil fails the build
+void stencil_error(const char *why);
+
+template <u32 N, u32 H>
+constexpr void push_inst(Stencil<N, H> &s, u64 lo, u64 hi, u8 n)
+{
+	if (s.size + n > N)
+		stencil_error("stencil too small");
+	for (u8 i = 0; i < n; i++, lo = lo >> 8 | hi << 56, hi >>= 8)
+		s.code[s.size++] = lo & 0xff;
+}
+
+template <u32 N, u32 H>
+constexpr void push_u32(Stencil<N, H> &s, u32 v)
+{
+	push_inst(s, v, 0, 4);
+}
+
+// Turn bits bits at shift of the last size bytes into a hole, bits
+// defaults to all of them. Whatever was encoded there is cleared.
+template <u32 N, u32 H>
+constexpr void hole(Stencil<N, H> &s, const char *name, u8 size, u8 shift = 0, u8 bits = 0)
+{
+	if (!bits)
+		bits = 8*size;
+	if (s.nhole == H)
+		stencil_error("too many holes");
+	if (size > 8 || size > s.size || shift + bits > 8*size)
+		stencil_error("hole out of range");
+	u32 pos = s.size - size;
+	for (u32 i = shift; i < shift + bits; i++)
+		s.code[pos + i/8] &= ~(1 << i%8);
+	s.holes[s.nhole++] = {name, pos, size, shift, bits, HoleValue};
+}
+
+// Turn the displacement of the last instruction, a branch, into a hole
+template <u32 N, u32 H>
+constexpr void hole(Stencil<N, H> &s, const char *name, HoleKind kind)
+{
+	switch (kind) {
+		case HoleRel32: hole(s, name, 4); break;
+		case HoleImm26: hole(s, name, 4, 0, 26); break;
+		case HoleImm19: hole(s, name, 4, 5, 19); break;
+		default: stencil_error("not a branch");
+	}
+	s.holes[s.nhole - 1].kind = kind;
+}
+
+// Index of the named hole, that is, of its value for push_stencil
+template <u32 N, u32 H>
+constexpr u32 hole(const Stencil<N, H> &s, const char *name)
+{
+	for (u32 i = 0; i < s.nhole; i++) {
+		const char *p = s.holes[i].name, *q = name;
+		while (*p && *p == *q)
+			p++, q++;
+		if (*p == *q)
+			return i;
+	}
+	stencil_error("no such hole");
+	return 0;
+}
+
+void push_stencil(Assembler &a, const u8 *code, u32 size, const Hole *holes, u32 nhole, const Fill *f);
+
+// f fills every hole, in the order they were made
+template <u32 N, u32 H>
+inline void push_stencil(Assembler &a, const Stencil<N, H> &s, const Fill *f)
+{
+	push_stencil(a, s.code, s.size, s.holes, s.nhole, f);
+}
@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "amd64.hh"
+#include "arm64.hh"
+#include "heap.hh"
+#include "stencil.hh"
+#include "peep.hh"
+#include "masm.hh"
+#include "ir.hh"
+
+static double now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// One tab separated line per benchmark, so that runs can be diffed
+static void report(const char *name, u64 n, const char *unit, double t, u64 bytes)
+{
+	printf("%s\t%lu\t%s\t%.0f\t%.0f\n", name, n, unit, n/t, bytes/t);
+}
+
+static void error(Assembler &a)
+{
+	if (a.err)
+		fprintf(stderr, "error: assembly error: %d\n", a.err);
+}
+
+// Each label gets a forward reference before it is defined and
+// a backward one after it, like a loop with an exit branch.
+static void labels_str(Assembler &a, char **names, u32 n)
+{
+	using namespace amd64;
+	for (u32 i = 0; i < n; i++) {
+		jmp(a, names[i]);
+		label(a, names[i]);
+		jcc(a, NE, names[i]);
+	}
+}
+
+static void labels_id(Assembler &a, char **names, u32 n)
+{
+	using namespace amd64;
+	for (u32 i = 0; i < n; i++) {
+		LabelId l = label_id(a, names[i]);
+		jmp(a, l);
+		label(a, l);
+		jcc(a, NE, l);
+	}
+}
+
+static void labels_anon(Assembler &a, char **, u32 n)
+{
+	using namespace amd64;
+	for (u32 i = 0; i < n; i++) {
+		LabelId l = new_label(a);
+		jmp(a, l);
+		label(a, l);
+		jcc(a, NE, l);
+	}
+}
+
+static void bench_labels(const char *name, void (*f)(Assembler &, char **, u32), u32 n)
+{
+	char **names = (char **)malloc(n*sizeof(char *));
+	for (u32 i = 0; i < n; i++) {
+		names[i] = (char *)malloc(16);
+		snprintf(names[i], 16, "L%u", i);
+	}
+	Assembler a{};
+	double t = now();
+	f(a, names, n);
+	t = now() - t;
+	error(a);
+	report(name, n, "labels", t, a.ip);
+	clear(a);
+	for (u32 i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+}
+
+// Instruction workloads, each emits 4 instructions per iteration
+static void amd64_reg(Assembler &a, u32 n)
+{
+	using namespace amd64;
+	for (u32 i = 0; i < n; i++) {
+		mov(a, rax, rbx);
+		add(a, r10, r11);
+		xor_(a, esi, edi);
+		cmp(a, r8w, cx);
+	}
+}
+
+static void amd64_mem(Assembler &a, u32 n)
+{
+	using namespace amd64;
+	for (u32 i = 0; i < n; i++) {
+		mov(a, r9, ptr(rsp, rcx*8, 16));
+		mov(a, ptr(rbp, -8), rax);
+		lea(a, rdx, ptr(rax, rbx*4, 1024));
+		xchg(a, ecx, ptr(r13));
+	}
+}
+
+static void amd64_imm(Assembler &a, u32 n)
+{
+	using namespace amd64;
+	for (u32 i = 0; i < n; i++) {
+		add(a, rcx, 5);
+		sub(a, r12d, 100000);
+		and_(a, al, 0x0f);
+		mov(a, rax, (u64)i << 32);
+	}
+}
+
+static void amd64_mix(Assembler &a, u32 n)
+{
+	using namespace amd64;
+	LabelId l = new_label(a);
+	label(a, l);
+	for (u32 i = 0; i < n; i++) {
+		mov(a, r9, ptr(rsp, rcx*8, 16));
+		add(a, rcx, 5);
+		add(a, r10, r11);
+		jcc(a, NE, l);
+	}
+}
+
+// adc and sdiv
+static void arm64_3r(Assembler &a, u32 n)
+{
+	using namespace arm64;
+	for (u32 i = 0; i < n; i++) {
+		adc(a, x0, x1, x2);
+		adc(a, w3, w4, w5);
+		sdiv(a, x6, x7, x8);
+		sdiv(a, w9, w10, w11);
+	}
+}
+
+// shifted register forms
+static void arm64_s(Assembler &a, u32 n)
+{
+	using namespace arm64;
+	for (u32 i = 0; i < n; i++) {
+		add(a, x0, x1, x2, LSL, 3);
+		sub(a, w3, w4, w5, LSR, 7);
+		adds(a, x6, x7, x8, ASR, 63);
+		orr(a, x9, x10, x11, LSL, 0);
+	}
+}
+
+static void arm64_i(Assembler &a, u32 n)
+{
+	using namespace arm64;
+	for (u32 i = 0; i < n; i++) {
+		add(a, x0, x1, i & 0xfff, LSL, 0);
+		sub(a, sp, sp, 16, LSL, 0);
+		adds(a, w2, w3, 1, LSL, 12);
+		cmp(a, x4, 4095, LSL, 0);
+	}
+}
+
+// Valid logical immediates of every element size
+static u64 logical[256];
+
+static void init_logical()
+{
+	for (u32 i = 0; i < 256; i++) {
+		u32 e = 2 << i%6, len = 1 + i*7 % (e - 1), rot = i*13 % e;
+		u64 emask = e == 64 ? ~0UL : (1UL << e) - 1;
+		u64 v = (1UL << len) - 1;
+		v = rot ? (v >> rot | v << (e - rot)) & emask : v;
+		for (u32 s = e; s < 64; s *= 2)
+			v |= v << s;
+		logical[i] = v;
+	}
+}
+
+static void arm64_logical(Assembler &a, u32 n)
+{
+	using namespace arm64;
+	for (u32 i = 0; i < n; i++) {
+		orr(a, x0, x1, logical[i*4 % 256]);
+		orr(a, x2, x3, logical[(i*4 + 1) % 256]);
+		orr(a, x4, xzr, logical[(i*4 + 2) % 256]);
+		orr(a, x5, x6, logical[(i*4 + 3) % 256]);
+	}
+}
+
+static void bench_insts(const char *name, void (*f)(Assembler &, u32), u32 n)
+{
+	Assembler a{};
+	f(a, n); // fault the pages in
+	a.ip = 0;
+	double t = now();
+	f(a, n);
+	t = now() - t;
+	error(a);
+	report(name, 4*n, "insts", t, a.ip);
+	clear(a);
+}
+
+// A small function, like the ones a JIT compiles by the thousand
+static void func(Assembler &a)
+{
+	using namespace amd64;
+	LabelId loop = label_id(a, "loop"), out = label_id(a, "out");
+	push(a, rbx);
+	mov(a, rax, 0UL);
+	label(a, loop);
+	cmp(a, rdi, 0);
+	jcc(a, E, out);
+	add(a, rax, rdi);
+	dec(a, rdi);
+	jmp(a, loop);
+	label(a, out);
+	pop(a, rbx);
+	ret(a);
+}
+
+static void bench_funcs(const char *name, void (*done)(Assembler &), u32 n)
+{
+	Assembler a{};
+	u64 bytes = 0;
+	double t = now();
+	for (u32 i = 0; i < n; i++) {
+		func(a);
+		error(a);
+		bytes += a.ip;
+		done(a);
+	}
+	t = now() - t;
+	report(name, n, "funcs", t, bytes);
+	clear(a);
+}
+
+// n forward references spread over 1000 labels defined at the end
+static void bench_fixups(const char *name, u32 flags, u32 n)
+{
+	using namespace amd64;
+	Assembler a{};
+	a.flags = flags;
+	LabelId ls[1000];
+	char names[1000][8];
+	for (u32 i = 0; i < 1000; i++) {
+		snprintf(names[i], sizeof(names[i]), "L%u", i);
+		ls[i] = label_id(a, names[i]);
+	}
+	double t = now();
+	for (u32 i = 0; i < n; i++)
+		call(a, ls[(i*7919) % 1000]);
+	for (u32 i = 0; i < 1000; i++)
+		label(a, ls[i]);
+	finalize(a);
+	t = now() - t;
+	error(a);
+	report(name, n, "fixups", t, a.ip);
+	clear(a);
+}
+
+// Bytecode over 8 byte slots at rdi, compiled by a baseline tier
+enum { OpConst, OpAdd, OpJnz, OpRet, OpCount };
+
+struct Op {
+	u8  op, x, y, z;
+	u32 imm; // the value of OpConst, the target of OpJnz
+};
+
+// Every 16th op is a branch target, so that labels cost the same
+// in both tiers
+static void bytecode(Op *p, u32 n)
+{
+	for (u32 i = 0; i < n - 1; i++) {
+		u8 x = i % 32, y = i*7 % 32, z = i*13 % 32;
+		switch (i % 4) {
+			case 0: p[i] = {OpConst, x, 0, 0, i*2654435761u}; break;
+			case 1: case 2: p[i] = {OpAdd, x, y, z, 0}; break;
+			case 3: p[i] = {OpJnz, x, 0, 0, i/16}; break;
+		}
+	}
+	p[n - 1] = {OpRet, 0, 0, 0, 0};
+}
+
+static void compile_direct(Assembler &a, const Op *p, u32 n, LabelId *ls)
+{
+	using namespace amd64;
+	for (u32 i = 0; i < n; i++) {
+		if (i % 16 == 0)
+			label(a, ls[i/16]);
+		const Op &o = p[i];
+		switch (o.op) {
+			case OpConst:
+				mov(a, rax, (u64)o.imm);
+				mov(a, ptr(rdi, 8*o.x), rax);
+				break;
+			case OpAdd:
+				mov(a, rax, ptr(rdi, 8*o.y));
+				mov(a, rcx, ptr(rdi, 8*o.z));
+				add(a, rax, rcx);
+				mov(a, ptr(rdi, 8*o.x), rax);
+				break;
+			case OpJnz:
+				mov(a, rax, ptr(rdi, 8*o.x));
+				cmp(a, rax, 0);
+				jcc(a, NE, ls[o.imm]);
+				break;
+			case OpRet:
+				ret(a);
+				break;
+		}
+	}
+}
+
+// Slot displacements are holes, the placeholders force disp32
+static constexpr amd64::Ptr slot = amd64::ptr(amd64::rdi, 0x1000);
+
+static constexpr auto opconst = [] {
+	using namespace amd64;
+	Stencil<32, 2> s{};
+	emit(s, enc::mov(rax, 0UL));
+	hole(s, "imm", 8);
+	emit(s, enc::mov(slot, rax));
+	hole(s, "x", 4);
+	return s;
+}();
+
+static constexpr auto opadd = [] {
+	using namespace amd64;
+	Stencil<32, 3> s{};
+	emit(s, enc::mov(rax, slot));
+	hole(s, "y", 4);
+	emit(s, enc::mov(rcx, slot));
+	hole(s, "z", 4);
+	emit(s, enc::add(rax, rcx));
+	emit(s, enc::mov(slot, rax));
+	hole(s, "x", 4);
+	return s;
+}();
+
+static constexpr auto opjnz = [] {
+	using namespace amd64;
+	Stencil<32, 2> s{};
+	emit(s, enc::mov(rax, slot));
+	hole(s, "x", 4);
+	emit(s, enc::cmp(rax, 0));
+	emit(s, enc::jcc(NE, 0));
+	hole(s, "target", HoleRel32);
+	return s;
+}();
+
+static constexpr auto opret = [] {
+	using namespace amd64;
+	Stencil<1, 0> s{};
+	emit(s, enc::ret());
+	return s;
+}();
+
+static void compile_stencil(Assembler &a, const StencilLib &l, const Op *p, u32 n, LabelId *ls)
+{
+	Fill f[3];
+	for (u32 i = 0; i < n; i++) {
+		if (i % 16 == 0)
+			label(a, ls[i/16]);
+		const Op &o = p[i];
+		switch (o.op) {
+			case OpConst: f[0].v = o.imm; f[1].v = 8*o.x; break;
+			case OpAdd: f[0].v = 8*o.y; f[1].v = 8*o.z; f[2].v = 8*o.x; break;
+			case OpJnz: f[0].v = 8*o.x; f[1].l = ls[o.imm]; break;
+		}
+		push_stencil(a, l, o.op, f);
+	}
+}
+
+// Compile latency of the same n op function, r times over
+static void bench_tier(const char *name, bool stencil, u32 n, u32 r)
+{
+	Op *p = (Op *)malloc(n*sizeof(Op));
+	bytecode(p, n);
+	StencilLib l;
+	init(l, OpCount);
+	add(l, OpConst, opconst);
+	add(l, OpAdd, opadd);
+	add(l, OpJnz, opjnz);
+	add(l, OpRet, opret);
+	LabelId *ls = (LabelId *)malloc((n/16 + 1)*sizeof(LabelId));
+	Assembler a{};
+	u64 bytes = 0;
+	double t = now();
+	for (u32 k = 0; k < r; k++) {
+		for (u32 i = 0; i < n/16 + 1; i++)
+			ls[i] = new_label(a);
+		if (stencil)
+			compile_stencil(a, l, p, n, ls);
+		else
+			compile_direct(a, p, n, ls);
+		finalize(a);
+		error(a);
+		bytes += a.ip;
+		rewind(a);
+	}
+	t = now() - t;
+	report(name, (u64)n*r, "ops", t, bytes);
+	clear(a);
+	clear(l);
+	free(ls);
+	free(p);
+}
+
+// The loop of examples/fib.cc the way a naive front end emits it
+static void fib_naive(amd64::Peep &p)
+{
+	using namespace amd64;
+label(p, "fib");
+	mov(p, rax, 0UL);
+	mov(p, rcx, 1);
+label(p, "loop");
+	cmp(p, rdi, 0);
+	jcc(p, E, "done");
+	mov(p, rdx, rcx);
+	add(p, rdx, rax);
+	mov(p, rax, rcx);
+	mov(p, rcx, rdx);
+	sub(p, rdi, 1);
+	jmp(p, "loop");
+label(p, "done");
+	mov(p, rax, rax);
+	jmp(p, "return");
+label(p, "return");
+	ret(flush(p));
+}
+
+// Compile rate and code size of fib_naive through the peephole
+// stage with the given rules, then the speed of the result
+static void bench_peep(const char *name, const char *run, u32 rules, u32 n, u32 r)
+{
+	using namespace amd64;
+	Assembler a{};
+	Peep p;
+	u64 bytes = 0;
+	double t = now();
+	for (u32 i = 0; i < n; i++) {
+		init(p, a, rules);
+		fib_naive(p);
+		finalize(a);
+		error(a);
+		bytes += a.ip;
+		rewind(a);
+	}
+	t = now() - t;
+	report(name, n, "funcs", t, bytes);
+	init(p, a, rules);
+	fib_naive(p);
+	CodeHeap h;
+	init(h, 1 << 16);
+	u64 (*fib)(u64) = (u64 (*)(u64))publish(h, a);
+	volatile u64 sink = 0;
+	t = now();
+	for (u32 i = 0; i < r; i++)
+		sink = sink + fib(90);
+	t = now() - t;
+	report(run, r, "calls", t, (u64)a.ip*r);
+	clear(h);
+	clear(a);
+}
+
+// Code size of fib_naive with none, each one and all of the rules,
+// as a comment line since there is nothing to time
+static void bench_peep_size()
+{
+	using namespace amd64;
+	static const char *names[PeepRules] = {"jmp-next", "zero", "fold", "self-mov", "mov-back"};
+	Assembler a{};
+	Peep p;
+	printf("# peep/size bytes(hits):");
+	for (u32 r = 0; r <= PeepRules + 1; r++) {
+		u32 rules = r == 0 ? 0 : r > PeepRules ? ~0u : 1u << (r - 1);
+		init(p, a, rules);
+		fib_naive(p);
+		finalize(a);
+		error(a);
+		if (r == 0 || r > PeepRules)
+			printf(" %s %u", r ? "all" : "none", a.ip);
+		else
+			printf(" %s %u(%u)", names[r - 1], a.ip, p.hits[r - 1]);
+		rewind(a);
+	}
+	printf("\n");
+	clear(a);
+}
+
+// The loop of examples/fib.cc with its head at the end of a 32 byte
+// block, so that the loop straddles two, or aligned to the next one
+static void bench_align(const char *name, bool aligned, u32 r)
+{
+	using namespace amd64;
+	Assembler a{};
+	a.flags = AsmRelax;
+	nop(a, 5);
+	mov(a, rax, 0UL);
+	mov(a, rcx, 1);
+	if (aligned)
+		label(a, "loop", 32);
+	else
+		label(a, "loop");
+	cmp(a, rdi, 0);
+	jcc(a, E, "return");
+	mov(a, rdx, rcx);
+	add(a, rcx, rax);
+	mov(a, rax, rdx);
+	dec(a, rdi);
+	jmp(a, "loop");
+label(a, "return");
+	ret(a);
+	CodeHeap h;
+	init(h, 1 << 16);
+	u64 (*fib)(u64) = (u64 (*)(u64))publish(h, a);
+	error(a);
+	volatile u64 sink = 0;
+	double t = now();
+	for (u32 i = 0; i < r; i++)
+		sink = sink + fib(1000);
+	t = now() - t;
+	report(name, (u64)r*1000, "iters", t, 0);
+	clear(h);
+	clear(a);
+}
+
+// About n ops of loops over a handful of values, with a call in
+// each so that some of them need callee saved registers
+static void ir_func(Ir &ir, LabelId f, u32 n)
+{
+	Val p = val(ir), acc = val(ir);
+	arg(ir, p, 0);
+	mov(ir, acc, 0UL);
+	u32 seed = 1;
+	while (ir.nop + 32 < n) {
+		Val v[8];
+		IrLabel loop = label(ir);
+		for (u32 i = 0; i < 8; i++) {
+			v[i] = val(ir);
+			load(ir, v[i], p, 8*i);
+		}
+		bind(ir, loop);
+		for (u32 i = 0; i < 16; i++) {
+			seed = seed*1103515245 + 12345;
+			Val d = v[seed >> 24 & 7], x = v[seed >> 8 & 7], y = v[seed >> 16 & 7];
+			seed & 1 ? add(ir, d, x, y) : xor_(ir, d, x, y);
+		}
+		Val args[] = {v[0], v[1]};
+		call(ir, v[2], f, args, 2);
+		sub(ir, v[3], v[3], 1);
+		br(ir, masm::NE, v[3], 0, loop);
+		add(ir, acc, acc, v[4]);
+	}
+	ret(ir, acc);
+}
+
+// Allocation, then lowering to amd64, of n op functions
+static void bench_ir(u32 n, u32 r)
+{
+	Assembler a{};
+	masm::Masm<masm::Amd64> m = {&a};
+	Ir ir{};
+	double talloc = 0, tlower = 0;
+	u64 ops = 0, bytes = 0;
+	for (u32 i = 0; i < r; i++) {
+		clear(ir);
+		ir_func(ir, label_id(a, "f"), n);
+		double t = now();
+		allocate(ir);
+		talloc += now() - t;
+		t = now();
+		label(m, "f");
+		lower(ir, m);
+		finalize(a);
+		tlower += now() - t;
+		error(a);
+		ops += ir.nop;
+		bytes += a.ip;
+		rewind(a);
+	}
+	report("ir/alloc", ops, "ops", talloc, 0);
+	report("ir/lower", ops, "ops", tlower, bytes);
+	clear(ir);
+	clear(a);
+}
+
+int main()
+{
+	init_logical();
+	printf("# name\tcount\tunit\tunits/s\tbytes/s\n");
+	bench_insts("amd64/reg", amd64_reg, 1000000);
+	bench_insts("amd64/mem", amd64_mem, 1000000);
+	bench_insts("amd64/imm", amd64_imm, 1000000);
+	bench_insts("amd64/mix", amd64_mix, 1000000);
+	bench_insts("arm64/3r", arm64_3r, 1000000);
+	bench_insts("arm64/s", arm64_s, 1000000);
+	bench_insts("arm64/i", arm64_i, 1000000);
+	bench_insts("arm64/logical", arm64_logical, 1000000);
+	bench_fixups("fixups/list", 0, 1000000);
+	bench_fixups("fixups/batch", AsmBatch, 1000000);
+	bench_tier("tier/direct", false, 10000, 200);
+	bench_tier("tier/stencil", true, 10000, 200);
+	bench_peep("peep/off", "peep/off/run", 0, 100000, 1000000);
+	bench_peep("peep/on", "peep/on/run", ~0u, 100000, 1000000);
+	bench_peep_size();
+	bench_align("align/off", false, 100000);
+	bench_align("align/on", true, 100000);
+	bench_ir(10000, 1000);
+	bench_funcs("funcs/clear", clear, 10000);
+	bench_funcs("funcs/rewind", rewind, 10000);
+	u32 sizes[] = {1000, 100000, 1000000};
+	for (u32 n : sizes) {
+		bench_labels("labels/str", labels_str, n);
+		bench_labels("labels/id", labels_id, n);
+		bench_labels("labels/anon", labels_anon, n);
+	}
+	return 0;
+}
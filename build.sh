@@ -1,15 +1,25 @@
 #!/bin/sh -ex
 
 CXXFLAGS="-g -fsanitize=address,undefined -Wall -Wextra"
+BENCHFLAGS="-O2 -g -Wall -Wextra"
 
 c++ -c $CXXFLAGS arena.cc &
 c++ -c $CXXFLAGS asm.cc &
 c++ -c $CXXFLAGS amd64.cc &
 c++ -c $CXXFLAGS arm64.cc &
+c++ -c $CXXFLAGS heap.cc &
+c++ -c $CXXFLAGS elf.cc &
+c++ -c $CXXFLAGS perf.cc &
+c++ -c $CXXFLAGS gdb.cc &
+c++ -c $CXXFLAGS stencil.cc &
+c++ -c $CXXFLAGS peep.cc &
+c++ -c $CXXFLAGS masm.cc &
+c++ -c $CXXFLAGS ir.cc &
 wait
-ar crs libasm.a arena.o asm.o amd64.o arm64.o
+ar crs libasm.a arena.o asm.o amd64.o arm64.o heap.o elf.o perf.o gdb.o stencil.o peep.o masm.o ir.o
 c++ $CXXFLAGS -o test test.cc libasm.a &
 c++ -L . -I . $CXXFLAGS -o examples/fib examples/fib.cc libasm.a &
 c++ -L . -I . $CXXFLAGS -o examples/link examples/link.cc libasm.a &
+c++ $BENCHFLAGS -o bench bench.cc arena.cc asm.cc amd64.cc arm64.cc heap.cc elf.cc perf.cc gdb.cc stencil.cc peep.cc masm.cc ir.cc &
 wait
 ./test
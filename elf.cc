@@ -0,0 +1,179 @@
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <elf.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "elf.hh"
+
+// Where ld puts executables by default
+static const u64 ExecBase = 0x400000;
+
+enum Section {
+	SecNull,
+	SecText,
+	SecSymtab,
+	SecStrtab,
+	SecShstrtab,
+	SecCount,
+};
+
+static const char Shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+
+static u64 align(u64 v, u64 a) { return (v + a - 1) & ~(a - 1); }
+
+bool elf_image(Arena &tmp, ElfImage &img, u16 machine, u16 type, u64 addr, const u8 *code, u64 codesize, const ElfSym *syms, u32 n, u64 entry)
+{
+	u32 nsym = n + 2, strsize = 1;
+	for (u32 i = 0; i < n; i++)
+		strsize += strlen(syms[i].name) + 1;
+	u32 phnum = type == ET_EXEC;
+	u64 textoff = align(sizeof(Elf64_Ehdr) + phnum*sizeof(Elf64_Phdr), 16);
+	u64 textsize = code ? codesize : 0;
+	if (type == ET_EXEC && !addr)
+		addr = ExecBase + textoff;
+	u64 symoff = align(textoff + textsize, 8);
+	u64 stroff = symoff + nsym*sizeof(Elf64_Sym);
+	u64 shstroff = stroff + strsize;
+	u64 shoff = align(shstroff + sizeof(Shstrtab), 8);
+	u64 size = shoff + SecCount*sizeof(Elf64_Shdr);
+
+	u8 *head = (u8 *)alloc(tmp, textoff);
+	memset(head, 0, textoff);
+	Elf64_Ehdr *eh = (Elf64_Ehdr *)head;
+	memcpy(eh->e_ident, ELFMAG, SELFMAG);
+	eh->e_ident[EI_CLASS] = ELFCLASS64;
+	eh->e_ident[EI_DATA] = ELFDATA2LSB;
+	eh->e_ident[EI_VERSION] = EV_CURRENT;
+	eh->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+	eh->e_type = type;
+	eh->e_machine = machine;
+	eh->e_version = EV_CURRENT;
+	eh->e_entry = type == ET_EXEC ? addr + entry : 0;
+	eh->e_phoff = phnum ? sizeof(Elf64_Ehdr) : 0;
+	eh->e_shoff = shoff;
+	eh->e_ehsize = sizeof(Elf64_Ehdr);
+	eh->e_phentsize = phnum ? sizeof(Elf64_Phdr) : 0;
+	eh->e_phnum = phnum;
+	eh->e_shentsize = sizeof(Elf64_Shdr);
+	eh->e_shnum = SecCount;
+	eh->e_shstrndx = SecShstrtab;
+	if (phnum) {
+		// a single segment with the headers and the code
+		Elf64_Phdr *ph = (Elf64_Phdr *)(eh + 1);
+		ph->p_type = PT_LOAD;
+		ph->p_flags = PF_R|PF_X;
+		ph->p_offset = 0;
+		ph->p_vaddr = ph->p_paddr = addr - textoff;
+		ph->p_filesz = ph->p_memsz = textoff + textsize;
+		ph->p_align = 0x1000;
+	}
+
+	// Everything after the code, starting with its padding. The buffer
+	// starts a bit earlier to keep the tables aligned in memory.
+	u64 tailoff = textoff + textsize;
+	u64 bufoff = tailoff & ~(u64)7;
+	u8 *buf = (u8 *)alloc(tmp, size - bufoff);
+	memset(buf, 0, size - bufoff);
+	Elf64_Sym *sym = (Elf64_Sym *)(buf + (symoff - bufoff));
+	char *str = (char *)buf + (stroff - bufoff);
+	sym[1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+	sym[1].st_shndx = SecText;
+	sym[1].st_value = type == ET_REL ? 0 : addr;
+	for (u32 i = 0, istr = 1; i < n; i++) {
+		Elf64_Sym *s = sym + i + 2;
+		u32 len = strlen(syms[i].name) + 1;
+		memcpy(str + istr, syms[i].name, len);
+		s->st_name = istr;
+		s->st_info = ELF64_ST_INFO(STB_GLOBAL, syms[i].size ? STT_FUNC : STT_NOTYPE);
+		s->st_shndx = SecText;
+		s->st_value = (type == ET_REL ? 0 : addr) + syms[i].value;
+		s->st_size = syms[i].size;
+		istr += len;
+	}
+	memcpy(buf + (shstroff - bufoff), Shstrtab, sizeof(Shstrtab));
+	Elf64_Shdr *sh = (Elf64_Shdr *)(buf + (shoff - bufoff));
+	sh[SecText].sh_name = 1;
+	sh[SecText].sh_type = code ? SHT_PROGBITS : SHT_NOBITS;
+	sh[SecText].sh_flags = SHF_ALLOC|SHF_EXECINSTR;
+	sh[SecText].sh_addr = addr;
+	sh[SecText].sh_offset = textoff;
+	sh[SecText].sh_size = codesize;
+	sh[SecText].sh_addralign = 16;
+	sh[SecSymtab].sh_name = 7;
+	sh[SecSymtab].sh_type = SHT_SYMTAB;
+	sh[SecSymtab].sh_offset = symoff;
+	sh[SecSymtab].sh_size = nsym*sizeof(Elf64_Sym);
+	sh[SecSymtab].sh_link = SecStrtab;
+	sh[SecSymtab].sh_info = 2; // first global symbol
+	sh[SecSymtab].sh_addralign = 8;
+	sh[SecSymtab].sh_entsize = sizeof(Elf64_Sym);
+	sh[SecStrtab].sh_name = 15;
+	sh[SecStrtab].sh_type = SHT_STRTAB;
+	sh[SecStrtab].sh_offset = stroff;
+	sh[SecStrtab].sh_size = strsize;
+	sh[SecStrtab].sh_addralign = 1;
+	sh[SecShstrtab].sh_name = 23;
+	sh[SecShstrtab].sh_type = SHT_STRTAB;
+	sh[SecShstrtab].sh_offset = shstroff;
+	sh[SecShstrtab].sh_size = sizeof(Shstrtab);
+	sh[SecShstrtab].sh_addralign = 1;
+
+	img.iov = (iovec *)alloc(tmp, 3*sizeof(iovec));
+	img.iov[0] = {head, textoff};
+	img.iov[1] = {(void *)code, textsize};
+	img.iov[2] = {buf + (tailoff - bufoff), size - tailoff};
+	img.niov = 3;
+	img.size = size;
+	return true;
+}
+
+bool elf_image(Assembler &a, ElfImage &img, u16 machine, u16 type, const char *entry)
+{
+	if (a.err)
+		return false;
+	u32 n = 0;
+	for (Symbol *s = a.syms; s; s = s->next) {
+		if (s->refs)
+			return false;
+		n += s->name && s->resolved;
+	}
+	u64 entryaddr = 0;
+	if (entry) {
+		Symbol *s = lookup(a, entry);
+		if (!s || !s->resolved)
+			return false;
+		entryaddr = s->addr;
+	}
+	ElfSym *syms = (ElfSym *)alloc(a.tmp, n*sizeof(ElfSym));
+	n = 0;
+	for (Symbol *s = a.syms; s; s = s->next) {
+		if (s->name && s->resolved)
+			syms[n++] = {s->name, s->addr, 0};
+	}
+	return elf_image(a.tmp, img, machine, type, 0, a.code, a.ip, syms, n, entryaddr);
+}
+
+bool write_elf(Assembler &a, int fd, u16 machine, u16 type, const char *entry)
+{
+	ElfImage img;
+	if (!elf_image(a, img, machine, type, entry))
+		return false;
+	iovec *iov = img.iov;
+	u32 n = img.niov;
+	while (n) {
+		ssize_t w = writev(fd, iov, n);
+		if (w < 0)
+			return false;
+		// only retry after a short write
+		for (; n && (u64)w >= iov->iov_len; iov++, n--)
+			w -= iov->iov_len;
+		if (n) {
+			iov->iov_base = (u8 *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	return true;
+}
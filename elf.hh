@@ -0,0 +1,26 @@
+struct iovec;
+
+// Pieces of an ELF64 image of the code in an Assembler: the headers,
+// the code itself and the symbol and section tables.
+struct ElfImage {
+	iovec *iov;
+	u32   niov;
+	u64   size;
+};
+
+struct ElfSym {
+	const char *name;
+	u64        value; // offset into the code
+	u64        size;  // 0 if unknown
+};
+
+// Builds an image of type (ET_EXEC or ET_REL) for machine (EM_X86_64
+// or EM_AARCH64) with syms in .symtab. The code is placed at addr (0
+// picks the usual address for ET_EXEC) and entry is the offset where
+// an executable starts. Without code .text takes no space in the file
+// and only describes codesize bytes that live elsewhere.
+bool elf_image(Arena &tmp, ElfImage &img, u16 machine, u16 type, u64 addr, const u8 *code, u64 codesize, const ElfSym *syms, u32 nsym, u64 entry);
+// Same for the code of a, with its resolved named labels as symbols
+// and the one called entry as the entry point.
+bool elf_image(Assembler &a, ElfImage &img, u16 machine, u16 type, const char *entry = 0);
+bool write_elf(Assembler &a, int fd, u16 machine, u16 type, const char *entry = 0);
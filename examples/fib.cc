@@ -1,26 +1,28 @@
 #include <stdio.h>
+#include <elf.h>
 
 #include "types.hh"
 #include "arena.hh"
 #include "asm.hh"
 #include "amd64.hh"
+#include "elf.hh"
 
 using namespace amd64;
 
 void dump(Assembler &a)
 {
 	if (a.err) {
-		printf("error: assembly error: %d\n", a.err);
+		fprintf(stderr, "error: assembly error: %d\n", a.err);
 		return;
 	}
 	for (Symbol *s = a.syms; s; s = s->next) {
 		if (s->refs) {
-			printf("error: found unresolved references\n");
+			fprintf(stderr, "error: found unresolved references\n");
 			return;
 		}
 	}
-	for (u32 i = 0; i < a.ip; i++)
-		putchar(a.code[i]);
+	if (!write_elf(a, 1, EM_X86_64, ET_EXEC, "_start"))
+		fprintf(stderr, "error: failed to write the executable\n");
 }
 
 void fib(Assembler &a)
@@ -42,6 +44,7 @@ label(a, "return");
 
 void start(Assembler &a)
 {
+label(a, "_start");
 	mov(a, rdi, 10);
 	call(a, "fib");
 	mov(a, rdi, rax);
@@ -49,11 +52,12 @@ void start(Assembler &a)
 	syscall(a);
 }
 
-// You can use bin2elf.sh on the output of this program to get an executable
-// that exits with 10nth fibonacci number as it's exit code.
+// The output of this program is an executable that exits
+// with 10nth fibonacci number as it's exit code.
 int main()
 {
 	Assembler a{};
+	a.flags = AsmShort;
 	start(a);
 	fib(a);
 	dump(a);
@@ -1,14 +1,14 @@
 #include <stdio.h>
-#include <sys/mman.h>
 
 #include "types.hh"
 #include "arena.hh"
 #include "asm.hh"
 #include "amd64.hh"
+#include "heap.hh"
 
 using namespace amd64;
 
-void *link(Assembler &a)
+void *link(CodeHeap &h, Assembler &a)
 {
 	if (a.err) {
 		printf("error: assembly error: %d\n", a.err);
@@ -20,8 +20,10 @@ void *link(Assembler &a)
 			return 0;
 		}
 	}
-	mprotect(a.code, a.ip, PROT_READ|PROT_EXEC);
-	return a.code;
+	void *code = publish(h, a);
+	if (!code)
+		printf("error: code heap is full\n");
+	return code;
 }
 
 void sum(Assembler &a)
@@ -53,15 +55,20 @@ void hello(Assembler &a)
 // We can do dynamic code generation!
 int main()
 {
+	CodeHeap h;
+	init(h, 1 << 20);
 	Assembler a{};
+	a.flags = AsmShort;
 	hello(a);
-	void (*hellop)() = (void(*)())link(a);
+	void (*hellop)() = (void(*)())link(h, a);
 	hellop();
-	clear(a);
+	rewind(a);
 	sum(a);
-	u64 (*sump)(u64) = (u64(*)(u64))link(a);
+	void *code = link(h, a);
+	u64 (*sump)(u64) = (u64(*)(u64))entry(a, code, "sum");
 	for (u64 i = 0; i <= 10; i++)
 		printf("sum(%lu) = %lu\n", i, sump(i));
 	clear(a);
+	clear(h);
 	return 0;
 }
@@ -0,0 +1,118 @@
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "elf.hh"
+#include "gdb.hh"
+
+extern "C" {
+
+jit_descriptor __jit_debug_descriptor = {1, JIT_NOACTION, 0, 0};
+
+// GDB sets a breakpoint here, the body keeps the call from being elided
+__attribute__((noinline)) void __jit_debug_register_code()
+{
+	asm volatile("" ::: "memory");
+}
+
+}
+
+struct GdbFunc {
+	GdbFunc *next;
+	ElfSym  sym; // with an absolute value
+};
+
+void init(GdbJit &g)
+{
+	g = {};
+}
+
+void clear(GdbJit &g)
+{
+	reset(g.tmp);
+	g = {};
+}
+
+// Queue the code published from a: every named label starts a function
+// that extends to the next one.
+void add(GdbJit &g, Assembler &a, void *code)
+{
+	u32 n;
+	Symbol **syms = sorted_syms(a, n);
+	u64 base = (u64)code;
+	for (u32 i = 0; i < n; i++) {
+		u32 end = i + 1 < n ? syms[i + 1]->addr : a.ip;
+		if (end == syms[i]->addr)
+			continue;
+		u32 len = strlen(syms[i]->name) + 1;
+		char *name = (char *)alloc(g.tmp, len, 1);
+		memcpy(name, syms[i]->name, len);
+		GdbFunc *f = (GdbFunc *)alloc(g.tmp, sizeof(GdbFunc));
+		*f = {g.funcs, {name, base + syms[i]->addr, end - syms[i]->addr}};
+		g.funcs = f;
+		if (!g.nfunc++ || f->sym.value < g.lo)
+			g.lo = f->sym.value;
+		if (f->sym.value + f->sym.size > g.hi)
+			g.hi = f->sym.value + f->sym.size;
+	}
+}
+
+// Register everything added since the last flush as one object file.
+// The entry stays valid until it is passed to unregister.
+jit_code_entry *flush(GdbJit &g)
+{
+	if (!g.nfunc)
+		return 0;
+#ifdef __aarch64__
+	u16 machine = EM_AARCH64;
+#else
+	u16 machine = EM_X86_64;
+#endif
+	ElfSym *syms = (ElfSym *)alloc(g.tmp, g.nfunc*sizeof(ElfSym));
+	u32 n = 0;
+	for (GdbFunc *f = g.funcs; f; f = f->next) {
+		syms[n] = f->sym;
+		syms[n++].value -= g.lo;
+	}
+	ElfImage img;
+	elf_image(g.tmp, img, machine, ET_REL, g.lo, 0, g.hi - g.lo, syms, n, 0);
+	jit_code_entry *e = (jit_code_entry *)malloc(sizeof(jit_code_entry) + img.size);
+	char *file = (char *)(e + 1);
+	for (u32 i = 0, off = 0; i < img.niov; off += img.iov[i++].iov_len) {
+		if (img.iov[i].iov_len)
+			memcpy(file + off, img.iov[i].iov_base, img.iov[i].iov_len);
+	}
+	rewind(g.tmp, 0);
+	g.funcs = 0;
+	g.nfunc = 0;
+	g.lo = g.hi = 0;
+
+	jit_descriptor &d = __jit_debug_descriptor;
+	*e = {d.first_entry, 0, file, img.size};
+	if (d.first_entry)
+		d.first_entry->prev_entry = e;
+	d.first_entry = e;
+	d.relevant_entry = e;
+	d.action_flag = JIT_REGISTER_FN;
+	__jit_debug_register_code();
+	return e;
+}
+
+void unregister(jit_code_entry *e)
+{
+	jit_descriptor &d = __jit_debug_descriptor;
+	if (e->prev_entry)
+		e->prev_entry->next_entry = e->next_entry;
+	else
+		d.first_entry = e->next_entry;
+	if (e->next_entry)
+		e->next_entry->prev_entry = e->prev_entry;
+	d.relevant_entry = e;
+	d.action_flag = JIT_UNREGISTER_FN;
+	__jit_debug_register_code();
+	free(e);
+}
@@ -0,0 +1,47 @@
+// GDB's JIT interface, see "JIT Compilation Interface" in its manual.
+// The debugger breaks in __jit_debug_register_code and reads an object
+// file for every entry linked into __jit_debug_descriptor.
+extern "C" {
+
+enum {
+	JIT_NOACTION = 0,
+	JIT_REGISTER_FN,
+	JIT_UNREGISTER_FN,
+};
+
+struct jit_code_entry {
+	jit_code_entry *next_entry;
+	jit_code_entry *prev_entry;
+	const char     *symfile_addr;
+	u64            symfile_size;
+};
+
+struct jit_descriptor {
+	u32            version;
+	u32            action_flag;
+	jit_code_entry *relevant_entry;
+	jit_code_entry *first_entry;
+};
+
+extern jit_descriptor __jit_debug_descriptor;
+void __jit_debug_register_code();
+
+}
+
+struct GdbFunc;
+
+// Functions waiting to be registered. Every registration makes the
+// debugger reread its symbols, so they are announced in batches with
+// one object file per flush.
+struct GdbJit {
+	Arena   tmp; // pending functions and their names
+	GdbFunc *funcs;
+	u32     nfunc;
+	u64     lo, hi; // address range of the pending functions
+};
+
+void init(GdbJit &g);
+void clear(GdbJit &g);
+void add(GdbJit &g, Assembler &a, void *code);
+jit_code_entry *flush(GdbJit &g);
+void unregister(jit_code_entry *e);
@@ -0,0 +1,140 @@
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "heap.hh"
+#include "perf.hh"
+#include "gdb.hh"
+
+static const u64 HugeSize = 2*((u64)1 << 20);
+static const u64 Align = 64;
+
+// Lives in front of every function in the heap, padded so that the
+// code starts at a multiple of Align for align()
+struct alignas(Align) Block {
+	u64   size; // including the header
+	Block *next;
+};
+
+static bool map(CodeHeap &h)
+{
+	if (h.fd < 0 || ftruncate(h.fd, h.size))
+		return false;
+	h.rw = (u8 *)mmap(0, h.size, PROT_READ|PROT_WRITE, MAP_SHARED, h.fd, 0);
+	if (h.rw == MAP_FAILED)
+		return false;
+	h.rx = (u8 *)mmap(0, h.size, PROT_READ|PROT_EXEC, MAP_SHARED, h.fd, 0);
+	if (h.rx == MAP_FAILED) {
+		munmap(h.rw, h.size);
+		return false;
+	}
+	return true;
+}
+
+void init(CodeHeap &h, u64 size)
+{
+	h = {};
+	h.size = (size + HugeSize - 1) & ~(HugeSize - 1);
+	// Prefer explicit huge pages, but they are usually not reserved,
+	// so fall back to asking for transparent ones.
+	h.fd = memfd_create("code", MFD_CLOEXEC|MFD_HUGETLB);
+	if (map(h))
+		return;
+	if (h.fd >= 0)
+		close(h.fd);
+	h.fd = memfd_create("code", MFD_CLOEXEC);
+	bool ok = map(h);
+	assert(ok);
+	madvise(h.rw, h.size, MADV_HUGEPAGE);
+	madvise(h.rx, h.size, MADV_HUGEPAGE);
+}
+
+void clear(CodeHeap &h)
+{
+	munmap(h.rw, h.size);
+	munmap(h.rx, h.size);
+	close(h.fd);
+	h = {};
+}
+
+static Block *take(CodeHeap &h, u64 size)
+{
+	for (Block **p = &h.free; *p; p = &(*p)->next) {
+		Block *b = *p;
+		if (b->size < size)
+			continue;
+		if (b->size - size >= 4*Align) {
+			Block *rest = (Block *)((u8 *)b + size);
+			*rest = {b->size - size, b->next};
+			*p = rest;
+			b->size = size;
+		} else {
+			*p = b->next;
+		}
+		return b;
+	}
+	if (h.size - h.top < size)
+		return 0;
+	Block *b = (Block *)(h.rw + h.top);
+	b->size = size;
+	h.top += size;
+	return b;
+}
+
+// Copy the code of a into the heap and return its executable address,
+// or 0 if it has errors, unresolved references or does not fit.
+void *publish(CodeHeap &h, Assembler &a)
+{
+	finalize(a);
+	if (a.err)
+		return 0;
+	for (Symbol *s = a.syms; s; s = s->next) {
+		if (s->refs)
+			return 0;
+	}
+	Block *b = take(h, (sizeof(Block) + a.ip + Align - 1) & ~(Align - 1));
+	if (!b)
+		return 0;
+	memcpy(b + 1, a.code, a.ip);
+	u8 *code = h.rx + ((u8 *)(b + 1) - h.rw);
+#ifdef __aarch64__
+	// instruction fetch is not coherent with data writes on arm64
+	__builtin___clear_cache((char *)code, (char *)code + a.ip);
+#endif
+	if (h.perf)
+		record(*h.perf, a, code);
+	if (h.gdb)
+		add(*h.gdb, a, code);
+	return code;
+}
+
+void *entry(const Assembler &a, void *code, const char *label)
+{
+	Symbol *s = lookup(a, label);
+	if (!s || !s->resolved)
+		return 0;
+	return (u8 *)code + s->addr;
+}
+
+// Give the memory of published code back, it must not be running anymore
+void retire(CodeHeap &h, void *code)
+{
+	Block *b = (Block *)(h.rw + ((u8 *)code - h.rx)) - 1;
+	Block **p = &h.free, *prev = 0;
+	for (; *p && *p < b; p = &(*p)->next)
+		prev = *p;
+	b->next = *p;
+	*p = b;
+	if (b->next && (u8 *)b + b->size == (u8 *)b->next) {
+		b->size += b->next->size;
+		b->next = b->next->next;
+	}
+	if (prev && (u8 *)prev + prev->size == (u8 *)b) {
+		prev->size += b->size;
+		prev->next = b->next;
+	}
+}
@@ -0,0 +1,22 @@
+struct Block;
+struct Perf;
+struct GdbJit;
+
+// Executable memory shared by many functions. The same memfd is
+// mapped twice so that no page is ever writable and executable.
+struct CodeHeap {
+	int    fd;
+	u8     *rw;
+	u8     *rx;
+	u64    size;
+	u64    top;
+	Block  *free; // retired blocks ordered by address
+	Perf   *perf; // if set, published code is recorded there
+	GdbJit *gdb;  // if set, published code is queued there for flush
+};
+
+void init(CodeHeap &h, u64 size);
+void clear(CodeHeap &h);
+void *publish(CodeHeap &h, Assembler &a);
+void *entry(const Assembler &a, void *code, const char *label);
+void retire(CodeHeap &h, void *code);
@@ -0,0 +1,460 @@
+#include <string.h>
+#include <assert.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "masm.hh"
+#include "ir.hh"
+
+// Registers given to values, the caller saved ones first so that
+// values not living across a call do not cost a save and restore.
+// The argument registers and the result only go to values that do
+// not reach a call, and each argument register only once its
+// argument is read. The result is a0 on arm64, so the two of them
+// are never handed out at the same time.
+static const masm::Reg regs[] = {
+	masm::t0, masm::t1,
+	masm::a0, masm::a1, masm::a2, masm::a3, masm::rv,
+	masm::s0, masm::s1, masm::s2, masm::s3, masm::s4,
+};
+
+static const u32 IrRegs = sizeof(regs)/sizeof(regs[0]);
+static const u32 IrCallerSaved = 7;
+static const u32 IrCalleeMask = ((1 << IrRegs) - 1) & ~((1 << IrCallerSaved) - 1);
+static const u32 IrArgMask = 0x7c; // a0 to a3 and rv
+static const u32 IrA0 = 2, IrRv = 6;
+
+static const masm::Reg argregs[] = {masm::a0, masm::a1, masm::a2, masm::a3, masm::a4, masm::a5};
+
+// Spilled values are loaded into these for the op using them, the
+// argument registers are free outside of calls once the arguments
+// are read
+static const masm::Reg scratch[] = {masm::a4, masm::a5};
+
+void clear(Ir &ir)
+{
+	reset(ir.tmp);
+	ir = {};
+}
+
+static IrOp &push(Ir &ir, u8 kind)
+{
+	if (ir.nop == ir.opcap) {
+		u32 cap = ir.opcap ? ir.opcap*2 : 256;
+		IrOp *ops = (IrOp *)alloc(ir.tmp, cap*sizeof(IrOp));
+		if (ir.nop)
+			memcpy(ops, ir.ops, ir.nop*sizeof(IrOp));
+		ir.ops = ops;
+		ir.opcap = cap;
+	}
+	IrOp &o = ir.ops[ir.nop++];
+	o = {};
+	o.kind = kind;
+	return o;
+}
+
+Val val(Ir &ir) { return {++ir.nval}; }
+IrLabel label(Ir &ir) { return {ir.nlabel++}; }
+void bind(Ir &ir, IrLabel l) { push(ir, IrBind).l = l.n; }
+
+void arg(Ir &ir, Val d, u8 i)
+{
+	assert(i < sizeof(argregs)/sizeof(argregs[0]));
+	assert(!ir.nop || ir.ops[ir.nop-1].kind == IrArg);
+	IrOp &o = push(ir, IrArg);
+	o.d = d;
+	o.imm = i;
+}
+
+void mov(Ir &ir, Val d, u64 imm)
+{
+	IrOp &o = push(ir, IrConst);
+	o.d = d;
+	o.imm = imm;
+}
+
+void mov(Ir &ir, Val d, Val x)
+{
+	IrOp &o = push(ir, IrMov);
+	o.d = d;
+	o.x = x;
+}
+
+static void binary(Ir &ir, u8 kind, Val d, Val x, Val y, s64 imm)
+{
+	IrOp &o = push(ir, kind);
+	o.d = d;
+	o.x = x;
+	o.y = y;
+	o.imm = imm;
+}
+
+void add(Ir &ir, Val d, Val x, Val y) { binary(ir, IrAdd, d, x, y, 0); }
+void add(Ir &ir, Val d, Val x, s32 imm) { binary(ir, IrAdd, d, x, {}, imm); }
+void sub(Ir &ir, Val d, Val x, Val y) { binary(ir, IrSub, d, x, y, 0); }
+void sub(Ir &ir, Val d, Val x, s32 imm) { binary(ir, IrSub, d, x, {}, imm); }
+void mul(Ir &ir, Val d, Val x, Val y) { binary(ir, IrMul, d, x, y, 0); }
+void and_(Ir &ir, Val d, Val x, Val y) { binary(ir, IrAnd, d, x, y, 0); }
+void and_(Ir &ir, Val d, Val x, s32 imm) { binary(ir, IrAnd, d, x, {}, imm); }
+void or_(Ir &ir, Val d, Val x, Val y) { binary(ir, IrOr, d, x, y, 0); }
+void or_(Ir &ir, Val d, Val x, s32 imm) { binary(ir, IrOr, d, x, {}, imm); }
+void xor_(Ir &ir, Val d, Val x, Val y) { binary(ir, IrXor, d, x, y, 0); }
+void xor_(Ir &ir, Val d, Val x, s32 imm) { binary(ir, IrXor, d, x, {}, imm); }
+void shl(Ir &ir, Val d, Val x, u8 n) { binary(ir, IrShl, d, x, {}, n); }
+void shr(Ir &ir, Val d, Val x, u8 n) { binary(ir, IrShr, d, x, {}, n); }
+void sar(Ir &ir, Val d, Val x, u8 n) { binary(ir, IrSar, d, x, {}, n); }
+
+void load(Ir &ir, Val d, Val base, s32 offset, u8 size)
+{
+	IrOp &o = push(ir, IrLoad);
+	o.d = d;
+	o.x = base;
+	o.imm = offset;
+	o.size = size;
+}
+
+void store(Ir &ir, Val base, s32 offset, Val s, u8 size)
+{
+	IrOp &o = push(ir, IrStore);
+	o.x = base;
+	o.y = s;
+	o.imm = offset;
+	o.size = size;
+}
+
+void jmp(Ir &ir, IrLabel l) { push(ir, IrJmp).l = l.n; }
+
+void br(Ir &ir, masm::Cond c, Val x, Val y, IrLabel l)
+{
+	IrOp &o = push(ir, IrBr);
+	o.c = c;
+	o.x = x;
+	o.y = y;
+	o.l = l.n;
+}
+
+void br(Ir &ir, masm::Cond c, Val x, s32 imm, IrLabel l)
+{
+	IrOp &o = push(ir, IrBr);
+	o.c = c;
+	o.x = x;
+	o.imm = imm;
+	o.l = l.n;
+}
+
+void call(Ir &ir, Val d, LabelId f, const Val *args, u32 n)
+{
+	assert(n <= sizeof(argregs)/sizeof(argregs[0]));
+	if (ir.narg + n > ir.argcap) {
+		u32 cap = ir.argcap ? ir.argcap*2 : 64;
+		Val *a = (Val *)alloc(ir.tmp, cap*sizeof(Val));
+		if (ir.narg)
+			memcpy(a, ir.args, ir.narg*sizeof(Val));
+		ir.args = a;
+		ir.argcap = cap;
+	}
+	IrOp &o = push(ir, IrCall);
+	o.d = d;
+	o.f = f;
+	o.imm = ir.narg;
+	o.l = n;
+	memcpy(ir.args + ir.narg, args, n*sizeof(Val));
+	ir.narg += n;
+}
+
+void ret(Ir &ir, Val x) { push(ir, IrRet).x = x; }
+
+static void touch(Ir &ir, Val v, u32 pos)
+{
+	if (!v.n)
+		return;
+	IrLive &l = ir.live[v.n];
+	if (l.start > pos)
+		l.start = pos;
+	l.end = pos;
+}
+
+static bool jumps(const IrOp &o) { return o.kind == IrJmp || o.kind == IrBr; }
+
+// Live intervals from the first to the last op using a value, the
+// ones of values that enter a loop span all of it since they have
+// to survive every iteration
+void liveness(Ir &ir)
+{
+	ir.live = (IrLive *)alloc(ir.tmp, (ir.nval + 1)*sizeof(IrLive));
+	for (u32 v = 0; v <= ir.nval; v++)
+		ir.live[v] = {~0u, 0, 0};
+	ir.labels = (u32 *)alloc(ir.tmp, (ir.nlabel + 1)*sizeof(u32));
+	memset(ir.labels, 0xff, (ir.nlabel + 1)*sizeof(u32));
+	for (u32 i = 0; i < ir.nop; i++) {
+		const IrOp &o = ir.ops[i];
+		if (o.kind == IrBind)
+			ir.labels[o.l] = i;
+		touch(ir, o.x, i);
+		touch(ir, o.y, i);
+		for (u32 j = 0; o.kind == IrCall && j < o.l; j++)
+			touch(ir, ir.args[o.imm + j], i);
+		touch(ir, o.d, i);
+	}
+	// last back edge to each loop header, then intervals grow over
+	// the headers they reach, which can take them into further loops.
+	// next chains the headers so that only the loops an interval
+	// overlaps are visited.
+	u32 *back = (u32 *)alloc(ir.tmp, (ir.nop + 1)*sizeof(u32));
+	memset(back, 0, (ir.nop + 1)*sizeof(u32));
+	for (u32 i = 0; i < ir.nop; i++) {
+		const IrOp &o = ir.ops[i];
+		u32 h = jumps(o) ? ir.labels[o.l] : ~0u;
+		if (h < i)
+			back[h] = i;
+	}
+	u32 *next = (u32 *)alloc(ir.tmp, (ir.nop + 1)*sizeof(u32));
+	next[ir.nop] = ~0u;
+	for (u32 i = ir.nop; i--;)
+		next[i] = back[i + 1] ? i + 1 : next[i + 1];
+	for (u32 v = 1; v <= ir.nval; v++) {
+		IrLive &l = ir.live[v];
+		for (u32 h = l.start < ir.nop ? next[l.start] : ~0u; h <= l.end; h = next[h]) {
+			if (back[h] > l.end)
+				l.end = back[h];
+		}
+	}
+}
+
+static u32 lowest(u32 mask) { return __builtin_ctz(mask); }
+
+// Bits taken by the register at loc, see regs
+static u32 taken(u32 loc)
+{
+	if (loc == IrA0 || loc == IrRv)
+		return 1 << IrA0 | 1 << IrRv;
+	return 1 << loc;
+}
+
+// Linear scan (Poletto and Sarkar): values get a register when one
+// is free, values crossing a call only a callee saved one, see regs
+// for the others. When none is, the value ending last between the
+// new one and those holding a suitable register goes to the stack.
+void allocate(Ir &ir)
+{
+	liveness(ir);
+	ir.nslot = 0;
+	ir.nsaved = 0;
+	// values in order of their start, with a counting sort
+	u32 *first = (u32 *)alloc(ir.tmp, (ir.nop + 1)*sizeof(u32));
+	memset(first, 0, (ir.nop + 1)*sizeof(u32));
+	u32 n = 0;
+	for (u32 v = 1; v <= ir.nval; v++) {
+		if (ir.live[v].start < ir.nop) {
+			first[ir.live[v].start + 1]++;
+			n++;
+		}
+	}
+	for (u32 i = 0; i < ir.nop; i++)
+		first[i + 1] += first[i];
+	u32 *order = (u32 *)alloc(ir.tmp, (n + 1)*sizeof(u32));
+	for (u32 v = 1; v <= ir.nval; v++) {
+		if (ir.live[v].start < ir.nop)
+			order[first[ir.live[v].start]++] = v;
+	}
+	u32 *calls = (u32 *)alloc(ir.tmp, (ir.nop + 1)*sizeof(u32));
+	u32 ncall = 0;
+	for (u32 i = 0; i < ir.nop; i++) {
+		if (ir.ops[i].kind == IrCall)
+			calls[ncall++] = i;
+	}
+	// position of the argument op reading each argument register
+	u32 read[IrRegs] = {};
+	for (u32 i = 0; i < ir.nop && ir.ops[i].kind == IrArg; i++) {
+		if (ir.ops[i].imm < 4)
+			read[IrA0 + ir.ops[i].imm] = i;
+	}
+	read[IrRv] = read[IrA0];
+	u32 active[IrRegs]; // by increasing end
+	u32 nactive = 0, busy = 0, used = 0;
+	for (u32 i = 0, k = 0; i < n; i++) {
+		u32 v = order[i];
+		IrLive &l = ir.live[v];
+		u32 keep = 0;
+		for (u32 j = 0; j < nactive; j++) {
+			if (ir.live[active[j]].end <= l.start)
+				busy &= ~taken(ir.live[active[j]].loc);
+			else
+				active[keep++] = active[j];
+		}
+		nactive = keep;
+		while (k < ncall && calls[k] <= l.start)
+			k++;
+		u32 allowed = k < ncall && calls[k] < l.end ? IrCalleeMask : (1 << IrRegs) - 1;
+		if (k < ncall && calls[k] <= l.end)
+			allowed &= ~IrArgMask;
+		for (u32 r = IrA0; r <= IrRv; r++) {
+			if (read[r] > l.start)
+				allowed &= ~(1 << r);
+		}
+		if (allowed & ~busy) {
+			l.loc = lowest(allowed & ~busy);
+		} else {
+			u32 victim = nactive;
+			for (u32 j = 0; j < nactive; j++) {
+				IrLive &a = ir.live[active[j]];
+				if ((allowed >> a.loc & 1) && a.end > l.end && (victim == nactive || a.end > ir.live[active[victim]].end))
+					victim = j;
+			}
+			if (victim == nactive) {
+				l.loc = IrRegs + ir.nslot++;
+				continue;
+			}
+			IrLive &a = ir.live[active[victim]];
+			l.loc = a.loc;
+			a.loc = IrRegs + ir.nslot++;
+			busy &= ~taken(l.loc);
+			memmove(active + victim, active + victim + 1, (--nactive - victim)*sizeof(u32));
+		}
+		busy |= taken(l.loc);
+		used |= 1 << l.loc;
+		u32 j = nactive++;
+		for (; j && ir.live[active[j-1]].end > l.end; j--)
+			active[j] = active[j-1];
+		active[j] = v;
+	}
+	if (used & IrCalleeMask)
+		ir.nsaved = 32 - __builtin_clz(used) - IrCallerSaved;
+}
+
+static bool spilled(const Ir &ir, Val v) { return ir.live[v.n].loc >= IrRegs; }
+
+static masm::Mem slot(const Ir &ir, Val v) { return masm::mem(masm::sp, 8*(ir.live[v.n].loc - IrRegs)); }
+
+// Register with the value of v, spilled values are loaded into s
+template <typename T>
+static masm::Reg use(const Ir &ir, masm::Masm<T> &m, Val v, masm::Reg s)
+{
+	if (!spilled(ir, v))
+		return regs[ir.live[v.n].loc];
+	load(m, s, slot(ir, v));
+	return s;
+}
+
+// Register to compute v in, see def
+static masm::Reg dst(const Ir &ir, Val v) { return spilled(ir, v) ? scratch[0] : regs[ir.live[v.n].loc]; }
+
+template <typename T>
+static void def(const Ir &ir, masm::Masm<T> &m, Val v)
+{
+	if (spilled(ir, v))
+		store(m, slot(ir, v), scratch[0]);
+}
+
+// Copy r to v, or v to r when load is set
+template <typename T>
+static void move(const Ir &ir, masm::Masm<T> &m, Val v, masm::Reg r, bool load)
+{
+	if (spilled(ir, v) && load)
+		return masm::load(m, r, slot(ir, v));
+	if (spilled(ir, v))
+		return store(m, slot(ir, v), r);
+	masm::Reg vr = regs[ir.live[v.n].loc];
+	if (vr.n != r.n)
+		load ? mov(m, r, vr) : mov(m, vr, r);
+}
+
+template <typename T>
+static void binary(const Ir &ir, masm::Masm<T> &m, const IrOp &o)
+{
+	masm::Reg x = use(ir, m, o.x, scratch[0]);
+	masm::Reg d = dst(ir, o.d);
+	if (o.y.n) {
+		masm::Reg y = use(ir, m, o.y, scratch[1]);
+		switch (o.kind) {
+			case IrAdd: add(m, d, x, y); break;
+			case IrSub: sub(m, d, x, y); break;
+			case IrMul: mul(m, d, x, y); break;
+			case IrAnd: and_(m, d, x, y); break;
+			case IrOr:  or_(m, d, x, y); break;
+			case IrXor: xor_(m, d, x, y); break;
+		}
+	} else {
+		s32 imm = o.imm;
+		switch (o.kind) {
+			case IrAdd: add(m, d, x, imm); break;
+			case IrSub: sub(m, d, x, imm); break;
+			case IrAnd: and_(m, d, x, imm); break;
+			case IrOr:  or_(m, d, x, imm); break;
+			case IrXor: xor_(m, d, x, imm); break;
+			case IrShl: shl(m, d, x, imm); break;
+			case IrShr: shr(m, d, x, imm); break;
+			case IrSar: sar(m, d, x, imm); break;
+		}
+	}
+	def(ir, m, o.d);
+}
+
+template <typename T>
+static void lower_ops(Ir &ir, masm::Masm<T> &m)
+{
+	LabelId *labels = (LabelId *)alloc(ir.tmp, (ir.nlabel + 1)*sizeof(LabelId));
+	for (u32 i = 0; i < ir.nlabel; i++)
+		labels[i] = new_label(*m.a);
+	s32 frame = (ir.nslot*8 + 15) & ~15;
+	enter(m, ir.nsaved);
+	if (frame)
+		sub(m, masm::sp, masm::sp, frame);
+	for (u32 i = 0; i < ir.nop; i++) {
+		const IrOp &o = ir.ops[i];
+		switch (o.kind) {
+			case IrArg:
+				move(ir, m, o.d, argregs[o.imm], false);
+				break;
+			case IrConst:
+				mov(m, dst(ir, o.d), (u64)o.imm);
+				def(ir, m, o.d);
+				break;
+			case IrMov:
+				move(ir, m, o.d, use(ir, m, o.x, scratch[0]), false);
+				break;
+			case IrLoad:
+				load(m, dst(ir, o.d), masm::mem(use(ir, m, o.x, scratch[1]), o.imm), o.size);
+				def(ir, m, o.d);
+				break;
+			case IrStore: {
+				masm::Reg base = use(ir, m, o.x, scratch[0]);
+				store(m, masm::mem(base, o.imm), use(ir, m, o.y, scratch[1]), o.size);
+				break;
+		}
+		case IrBind:
+			label(m, labels[o.l]);
+			break;
+		case IrJmp:
+			jmp(m, labels[o.l]);
+			break;
+		case IrBr: {
+			masm::Reg x = use(ir, m, o.x, scratch[0]);
+			if (o.y.n)
+				br(m, (masm::Cond)o.c, x, use(ir, m, o.y, scratch[1]), labels[o.l]);
+			else
+				br(m, (masm::Cond)o.c, x, (s32)o.imm, labels[o.l]);
+			break;
+		}
+		case IrCall:
+			for (u32 j = 0; j < o.l; j++)
+				move(ir, m, ir.args[o.imm + j], argregs[j], true);
+			call(m, o.f);
+			if (o.d.n)
+				move(ir, m, o.d, masm::rv, false);
+			break;
+		case IrRet:
+			move(ir, m, o.x, masm::rv, true);
+			if (frame)
+				add(m, masm::sp, masm::sp, frame);
+			leave(m, ir.nsaved);
+			break;
+		default:
+			binary(ir, m, o);
+		}
+	}
+}
+
+void lower(Ir &ir, masm::Masm<masm::Amd64> &m) { lower_ops(ir, m); }
+void lower(Ir &ir, masm::Masm<masm::Arm64> &m) { lower_ops(ir, m); }
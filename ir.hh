@@ -0,0 +1,107 @@
+// Linear IR for the JIT: operations on any number of virtual values,
+// given machine registers by a linear scan over their live intervals
+// and lowered to either target through the macro assembler.
+//
+//	Ir ir{};
+//	Val n = val(ir), s = val(ir);
+//	arg(ir, n, 0);
+//	...
+//	allocate(ir);
+//	lower(ir, m);
+//
+// Values are 64 bit like the registers of masm. The argument ops
+// have to come before all others, values stay in their registers
+// across calls only when they can get a callee saved one.
+struct Val {
+	u32 n; // 0 is none
+};
+
+struct IrLabel {
+	u32 n;
+};
+
+enum IrKind {
+	IrArg,   // d = argument imm
+	IrConst, // d = imm
+	IrMov,   // d = x
+	IrAdd,   // d = x op y, or x op imm without y
+	IrSub,
+	IrMul,
+	IrAnd,
+	IrOr,
+	IrXor,
+	IrShl,   // d = x op imm
+	IrShr,
+	IrSar,
+	IrLoad,  // d = [x+imm] of size bits, zero extended
+	IrStore, // [x+imm] = y, of size bits
+	IrBind,  // label l
+	IrJmp,   // to label l
+	IrBr,    // to label l if x c y, or x c imm without y
+	IrCall,  // d = f(args), l of them from args[imm]
+	IrRet,   // return x
+};
+
+struct IrOp {
+	u8      kind;
+	u8      c;    // masm::Cond
+	u8      size;
+	Val     d, x, y;
+	u32     l;    // IrLabel or number of arguments
+	s64     imm;
+	LabelId f;
+};
+
+// Where allocate put a value: one of the registers it hands out
+// or a stack slot after them
+struct IrLive {
+	u32 start, end; // positions of the first and last op using it
+	u32 loc;
+};
+
+struct Ir {
+	Arena  tmp;
+	IrOp   *ops;
+	u32    nop, opcap;
+	Val    *args;
+	u32    narg, argcap;
+	u32    nval, nlabel;
+	IrLive *live;   // by value, set by liveness
+	u32    *labels; // position of each label, set by liveness
+	u32    nslot;   // spill slots, set by allocate
+	u8     nsaved;  // callee saved registers used, set by allocate
+};
+
+void clear(Ir &ir);
+Val val(Ir &ir);
+IrLabel label(Ir &ir);
+void bind(Ir &ir, IrLabel l);
+void arg(Ir &ir, Val d, u8 i);
+void mov(Ir &ir, Val d, u64 imm);
+void mov(Ir &ir, Val d, Val x);
+void add(Ir &ir, Val d, Val x, Val y);
+void add(Ir &ir, Val d, Val x, s32 imm);
+void sub(Ir &ir, Val d, Val x, Val y);
+void sub(Ir &ir, Val d, Val x, s32 imm);
+void mul(Ir &ir, Val d, Val x, Val y);
+void and_(Ir &ir, Val d, Val x, Val y);
+void and_(Ir &ir, Val d, Val x, s32 imm);
+void or_(Ir &ir, Val d, Val x, Val y);
+void or_(Ir &ir, Val d, Val x, s32 imm);
+void xor_(Ir &ir, Val d, Val x, Val y);
+void xor_(Ir &ir, Val d, Val x, s32 imm);
+void shl(Ir &ir, Val d, Val x, u8 n);
+void shr(Ir &ir, Val d, Val x, u8 n);
+void sar(Ir &ir, Val d, Val x, u8 n);
+void load(Ir &ir, Val d, Val base, s32 offset, u8 size = 64);
+void store(Ir &ir, Val base, s32 offset, Val s, u8 size = 64);
+void jmp(Ir &ir, IrLabel l);
+void br(Ir &ir, masm::Cond c, Val x, Val y, IrLabel l);
+void br(Ir &ir, masm::Cond c, Val x, s32 imm, IrLabel l);
+void call(Ir &ir, Val d, LabelId f, const Val *args, u32 n);
+void ret(Ir &ir, Val x);
+
+void liveness(Ir &ir);
+void allocate(Ir &ir);
+void lower(Ir &ir, masm::Masm<masm::Amd64> &m);
+void lower(Ir &ir, masm::Masm<masm::Arm64> &m);
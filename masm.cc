@@ -0,0 +1,320 @@
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "amd64.hh"
+#include "arm64.hh"
+#include "masm.hh"
+
+namespace masm {
+
+static const amd64::Reg amd64_regs[RegCount] = {
+	amd64::rdi, amd64::rsi, amd64::rdx, amd64::rcx, amd64::r8, amd64::r9,
+	amd64::r10, amd64::r11,
+	amd64::rbx, amd64::r12, amd64::r13, amd64::r14, amd64::r15,
+	amd64::rax, amd64::rsp,
+};
+
+static amd64::Reg x86(Reg r, u8 size = 64) { return {amd64_regs[r.n].code, size}; }
+
+static const amd64::Cond amd64_conds[] = {
+	amd64::E, amd64::NE,
+	amd64::L, amd64::LE, amd64::G, amd64::GE,
+	amd64::B, amd64::BE, amd64::A, amd64::AE,
+};
+
+void label(Masm<Amd64> &m, LabelId l) { ::label(*m.a, l); }
+void mov(Masm<Amd64> &m, Reg d, Reg s) { amd64::mov(*m.a, x86(d), x86(s)); }
+void mov(Masm<Amd64> &m, Reg d, u64 imm) { amd64::mov(*m.a, x86(d), imm); }
+
+// d = x op y with two operand instructions, if d is y it is
+// either swapped with x or, for sub, negated and added to x
+static void binary(Masm<Amd64> &m, Reg d, Reg x, Reg y, void (*op)(Assembler &, amd64::Reg, amd64::Reg), bool commutes)
+{
+	Assembler &a = *m.a;
+	if (d.n == y.n && d.n != x.n) {
+		if (commutes)
+			return op(a, x86(d), x86(x));
+		amd64::neg(a, x86(d));
+		return amd64::add(a, x86(d), x86(x));
+	}
+	if (d.n != x.n)
+		amd64::mov(a, x86(d), x86(x));
+	op(a, x86(d), x86(y));
+}
+
+static void binary(Masm<Amd64> &m, Reg d, Reg x, s32 imm, void (*op)(Assembler &, amd64::Reg, u32))
+{
+	if (d.n != x.n)
+		amd64::mov(*m.a, x86(d), x86(x));
+	op(*m.a, x86(d), imm);
+}
+
+static void shift(Masm<Amd64> &m, Reg d, Reg x, u8 n, void (*op)(Assembler &, amd64::Reg, u8))
+{
+	if (d.n != x.n)
+		amd64::mov(*m.a, x86(d), x86(x));
+	op(*m.a, x86(d), n);
+}
+
+void add(Masm<Amd64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, amd64::add, true); }
+void sub(Masm<Amd64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, amd64::sub, false); }
+void mul(Masm<Amd64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, amd64::imul, true); }
+void and_(Masm<Amd64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, amd64::and_, true); }
+void or_(Masm<Amd64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, amd64::or_, true); }
+void xor_(Masm<Amd64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, amd64::xor_, true); }
+void sub(Masm<Amd64> &m, Reg d, Reg x, s32 imm) { binary(m, d, x, imm, amd64::sub); }
+void and_(Masm<Amd64> &m, Reg d, Reg x, s32 imm) { binary(m, d, x, imm, amd64::and_); }
+void or_(Masm<Amd64> &m, Reg d, Reg x, s32 imm) { binary(m, d, x, imm, amd64::or_); }
+void xor_(Masm<Amd64> &m, Reg d, Reg x, s32 imm) { binary(m, d, x, imm, amd64::xor_); }
+void shl(Masm<Amd64> &m, Reg d, Reg x, u8 n) { shift(m, d, x, n, amd64::shl); }
+void shr(Masm<Amd64> &m, Reg d, Reg x, u8 n) { shift(m, d, x, n, amd64::shr); }
+void sar(Masm<Amd64> &m, Reg d, Reg x, u8 n) { shift(m, d, x, n, amd64::sar); }
+
+void add(Masm<Amd64> &m, Reg d, Reg x, s32 imm)
+{
+	if (d.n == x.n)
+		return amd64::add(*m.a, x86(d), imm);
+	amd64::lea(*m.a, x86(d), amd64::ptr(x86(x), imm));
+}
+
+void load(Masm<Amd64> &m, Reg d, Mem src, u8 size)
+{
+	amd64::Ptr p = amd64::ptr(x86(src.base), src.offset);
+	if (size < 32)
+		return amd64::movzx(*m.a, x86(d, 32), p, size);
+	amd64::mov(*m.a, x86(d, size), p);
+}
+
+void store(Masm<Amd64> &m, Mem dst, Reg s, u8 size)
+{
+	amd64::mov(*m.a, amd64::ptr(x86(dst.base), dst.offset), x86(s, size));
+}
+
+void br(Masm<Amd64> &m, Cond c, Reg x, Reg y, LabelId l)
+{
+	amd64::cmp(*m.a, x86(x), x86(y));
+	amd64::jcc(*m.a, amd64_conds[c], l);
+}
+
+void br(Masm<Amd64> &m, Cond c, Reg x, s32 imm, LabelId l)
+{
+	if (!imm)
+		amd64::test(*m.a, x86(x), x86(x));
+	else
+		amd64::cmp(*m.a, x86(x), imm);
+	amd64::jcc(*m.a, amd64_conds[c], l);
+}
+
+void jmp(Masm<Amd64> &m, LabelId l) { amd64::jmp(*m.a, l); }
+void call(Masm<Amd64> &m, LabelId l) { amd64::call(*m.a, l); }
+void call(Masm<Amd64> &m, Reg r) { amd64::call(*m.a, x86(r)); }
+void ret(Masm<Amd64> &m) { amd64::ret(*m.a); }
+
+// The return address and saved registers are padded to keep
+// the stack 16 byte aligned
+void enter(Masm<Amd64> &m, u8 saved)
+{
+	Assembler &a = *m.a;
+	if (saved > SavedCount) {
+		a.err = amd64::ErrReg;
+		return;
+	}
+	amd64::push(a, amd64::rbp);
+	amd64::mov(a, amd64::rbp, amd64::rsp);
+	for (u8 i = 0; i < saved; i++)
+		amd64::push(a, x86({u8(s0.n + i)}));
+	if (saved % 2)
+		amd64::sub(a, amd64::rsp, 8);
+}
+
+void leave(Masm<Amd64> &m, u8 saved)
+{
+	Assembler &a = *m.a;
+	if (saved > SavedCount) {
+		a.err = amd64::ErrReg;
+		return;
+	}
+	if (saved % 2)
+		amd64::add(a, amd64::rsp, 8);
+	for (u8 i = saved; i--;)
+		amd64::pop(a, x86({u8(s0.n + i)}));
+	amd64::pop(a, amd64::rbp);
+	amd64::ret(a);
+}
+
+static const arm64::Reg arm64_regs[RegCount] = {
+	arm64::x0, arm64::x1, arm64::x2, arm64::x3, arm64::x4, arm64::x5,
+	arm64::x9, arm64::x10,
+	arm64::x19, arm64::x20, arm64::x21, arm64::x22, arm64::x23,
+	arm64::x0, arm64::sp,
+};
+
+static const arm64::Reg ip0 = arm64::x16;
+
+static arm64::Reg arm(Reg r, u8 size = 64) { return {arm64_regs[r.n].code, size == 64, arm64_regs[r.n].sp}; }
+
+static const arm64::Cond arm64_conds[] = {
+	arm64::EQ, arm64::NE,
+	arm64::LT, arm64::LE, arm64::GT, arm64::GE,
+	arm64::CC, arm64::LS, arm64::HI, arm64::CS,
+};
+
+void label(Masm<Arm64> &m, LabelId l) { ::label(*m.a, l); }
+void mov(Masm<Arm64> &m, Reg d, Reg s) { arm64::mov(*m.a, arm(d), arm(s)); }
+void mov(Masm<Arm64> &m, Reg d, u64 imm) { arm64::mov(*m.a, arm(d), imm); }
+
+static void binary(Masm<Arm64> &m, Reg d, Reg x, Reg y, void (*op)(Assembler &, arm64::Reg, arm64::Reg, arm64::Reg))
+{
+	op(*m.a, arm(d), arm(x), arm(y));
+}
+
+void add(Masm<Arm64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, arm64::add); }
+void sub(Masm<Arm64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, arm64::sub); }
+void mul(Masm<Arm64> &m, Reg d, Reg x, Reg y) { binary(m, d, x, y, arm64::mul); }
+
+// Logical operations with the default shift of the register forms
+static void logical(Masm<Arm64> &m, Reg d, Reg x, Reg y, void (*op)(Assembler &, arm64::Reg, arm64::Reg, arm64::Reg, arm64::Sh, u8))
+{
+	op(*m.a, arm(d), arm(x), arm(y), arm64::LSL, 0);
+}
+
+static void logical(Masm<Arm64> &m, Reg d, Reg x, s32 imm,
+	void (*op)(Assembler &, arm64::Reg, arm64::Reg, u64),
+	void (*opr)(Assembler &, arm64::Reg, arm64::Reg, arm64::Reg, arm64::Sh, u8))
+{
+	if (arm64::enc::encode((s64)imm, 64).size)
+		return op(*m.a, arm(d), arm(x), (s64)imm);
+	arm64::mov(*m.a, ip0, (s64)imm);
+	opr(*m.a, arm(d), arm(x), ip0, arm64::LSL, 0);
+}
+
+void and_(Masm<Arm64> &m, Reg d, Reg x, Reg y) { logical(m, d, x, y, arm64::and_); }
+void or_(Masm<Arm64> &m, Reg d, Reg x, Reg y) { logical(m, d, x, y, arm64::orr); }
+void xor_(Masm<Arm64> &m, Reg d, Reg x, Reg y) { logical(m, d, x, y, arm64::eor); }
+void and_(Masm<Arm64> &m, Reg d, Reg x, s32 imm) { logical(m, d, x, imm, arm64::and_, arm64::and_); }
+void or_(Masm<Arm64> &m, Reg d, Reg x, s32 imm) { logical(m, d, x, imm, arm64::orr, arm64::orr); }
+void xor_(Masm<Arm64> &m, Reg d, Reg x, s32 imm) { logical(m, d, x, imm, arm64::eor, arm64::eor); }
+void shl(Masm<Arm64> &m, Reg d, Reg x, u8 n) { arm64::lsl(*m.a, arm(d), arm(x), n); }
+void shr(Masm<Arm64> &m, Reg d, Reg x, u8 n) { arm64::lsr(*m.a, arm(d), arm(x), n); }
+void sar(Masm<Arm64> &m, Reg d, Reg x, u8 n) { arm64::asr(*m.a, arm(d), arm(x), n); }
+
+// d = x + imm as an add or sub of a 12 bit immediate, possibly
+// shifted, or of ip0 loaded with it
+static void addimm(Masm<Arm64> &m, Reg d, Reg x, s64 imm)
+{
+	Assembler &a = *m.a;
+	u64 v = imm < 0 ? -imm : imm;
+	if (v < 4096 || (!(v & 0xfff) && v < 4096 << 12)) {
+		u8 shift = v < 4096 ? 0 : 12;
+		if (imm < 0)
+			return arm64::sub(a, arm(d), arm(x), v >> shift, arm64::LSL, shift);
+		return arm64::add(a, arm(d), arm(x), v >> shift, arm64::LSL, shift);
+	}
+	arm64::mov(a, ip0, imm);
+	arm64::add(a, arm(d), arm(x), ip0);
+}
+
+void add(Masm<Arm64> &m, Reg d, Reg x, s32 imm) { addimm(m, d, x, imm); }
+void sub(Masm<Arm64> &m, Reg d, Reg x, s32 imm) { addimm(m, d, x, -(s64)imm); }
+
+// Whether a load or store of size bits reaches offset directly,
+// either scaled unsigned or unscaled signed
+static bool reaches(s32 offset, u8 size)
+{
+	s32 scale = size/8;
+	if (offset >= -256 && offset < 256)
+		return true;
+	return offset >= 0 && !(offset % scale) && offset/scale < 4096;
+}
+
+static arm64::Ptr address(Masm<Arm64> &m, Mem p, u8 size)
+{
+	if (reaches(p.offset, size))
+		return arm64::ptr(arm(p.base), p.offset);
+	arm64::mov(*m.a, ip0, (s64)p.offset);
+	arm64::add(*m.a, ip0, arm(p.base), ip0);
+	return arm64::ptr(ip0);
+}
+
+void load(Masm<Arm64> &m, Reg d, Mem src, u8 size)
+{
+	arm64::Ptr p = address(m, src, size);
+	switch (size) {
+		case 8:  return arm64::ldrb(*m.a, arm(d, 32), p);
+		case 16: return arm64::ldrh(*m.a, arm(d, 32), p);
+		default: return arm64::ldr(*m.a, arm(d, size), p);
+	}
+}
+
+void store(Masm<Arm64> &m, Mem dst, Reg s, u8 size)
+{
+	arm64::Ptr p = address(m, dst, size);
+	switch (size) {
+		case 8:  return arm64::strb(*m.a, arm(s, 32), p);
+		case 16: return arm64::strh(*m.a, arm(s, 32), p);
+		default: return arm64::str(*m.a, arm(s, size), p);
+	}
+}
+
+void br(Masm<Arm64> &m, Cond c, Reg x, Reg y, LabelId l)
+{
+	arm64::cmp(*m.a, arm(x), arm(y));
+	arm64::b(*m.a, arm64_conds[c], l);
+}
+
+void br(Masm<Arm64> &m, Cond c, Reg x, s32 imm, LabelId l)
+{
+	Assembler &a = *m.a;
+	if (!imm && c == EQ)
+		return arm64::cbz(a, arm(x), l);
+	if (!imm && c == NE)
+		return arm64::cbnz(a, arm(x), l);
+	if (imm >= 0 && imm < 4096)
+		arm64::cmp(a, arm(x), imm);
+	else if (imm < 0 && imm > -4096)
+		arm64::adds(a, arm64::xzr, arm(x), -imm);
+	else {
+		arm64::mov(a, ip0, (s64)imm);
+		arm64::cmp(a, arm(x), ip0);
+	}
+	arm64::b(a, arm64_conds[c], l);
+}
+
+void jmp(Masm<Arm64> &m, LabelId l) { arm64::b(*m.a, l); }
+void call(Masm<Arm64> &m, LabelId l) { arm64::bl(*m.a, l); }
+void call(Masm<Arm64> &m, Reg r) { arm64::blr(*m.a, arm(r)); }
+void ret(Masm<Arm64> &m) { arm64::ret(*m.a); }
+
+// Frame record first, then the saved registers in pairs, every
+// push is 16 bytes to keep the stack aligned
+void enter(Masm<Arm64> &m, u8 saved)
+{
+	Assembler &a = *m.a;
+	if (saved > SavedCount) {
+		a.err = arm64::ErrReg;
+		return;
+	}
+	arm64::stp(a, arm64::x29, arm64::lr, arm64::pre(arm64::sp, -16));
+	arm64::mov(a, arm64::x29, arm64::sp);
+	for (u8 i = 0; i + 1 < saved; i += 2)
+		arm64::stp(a, arm({u8(s0.n + i)}), arm({u8(s0.n + i + 1)}), arm64::pre(arm64::sp, -16));
+	if (saved % 2)
+		arm64::str(a, arm({u8(s0.n + saved - 1)}), arm64::pre(arm64::sp, -16));
+}
+
+void leave(Masm<Arm64> &m, u8 saved)
+{
+	Assembler &a = *m.a;
+	if (saved > SavedCount) {
+		a.err = arm64::ErrReg;
+		return;
+	}
+	if (saved % 2)
+		arm64::ldr(a, arm({u8(s0.n + saved - 1)}), arm64::post(arm64::sp, 16));
+	for (u8 i = saved & ~1; i; i -= 2)
+		arm64::ldp(a, arm({u8(s0.n + i - 2)}), arm({u8(s0.n + i - 1)}), arm64::post(arm64::sp, 16));
+	arm64::ldp(a, arm64::x29, arm64::lr, arm64::post(arm64::sp, 16));
+	arm64::ret(a);
+}
+
+}
@@ -0,0 +1,128 @@
+// Target neutral macro assembler. Code generators are written once
+// as templates over the target and lowered to amd64 or arm64 by
+// overload resolution, so nothing is dispatched at run time:
+//
+//	template <typename T>
+//	void twice(Masm<T> &m) { add(m, rv, a0, a0); ret(m); }
+//
+//	Masm<Amd64> m = {&a};
+//	twice(m);
+//
+// Operations work on 64 bit virtual registers that each target maps
+// to machine ones following its calling convention (System V on
+// amd64, AAPCS64 on arm64). Lowering may clobber the flags, and on
+// arm64 also x16 for constants and offsets that do not fit.
+namespace masm {
+
+struct Amd64 {};
+struct Arm64 {};
+
+template <typename T>
+struct Masm {
+	Assembler *a;
+};
+
+struct Reg {
+	u8 n;
+};
+
+// Arguments, caller saved temporaries, callee saved registers (see
+// enter), the result and the stack pointer. The result is a0 on arm64,
+// so it has to be written after the arguments are last read.
+constexpr Reg a0 = {0}, a1 = {1}, a2 = {2}, a3 = {3}, a4 = {4}, a5 = {5};
+constexpr Reg t0 = {6}, t1 = {7};
+constexpr Reg s0 = {8}, s1 = {9}, s2 = {10}, s3 = {11}, s4 = {12};
+constexpr Reg rv = {13}, sp = {14};
+
+static const u8 RegCount = 15;
+static const u8 SavedCount = 5;
+
+struct Mem {
+	Reg base;
+	s32 offset;
+};
+
+constexpr Mem mem(Reg base, s32 offset = 0) { return {base, offset}; }
+
+enum Cond {
+	EQ, NE,
+	LT, LE, GT, GE, // signed
+	LO, LS, HI, HS, // unsigned
+};
+
+// Loads zero extend values of size bits, stores truncate them.
+// enter sets up a frame saving the first saved callee saved
+// registers, leave restores them and returns. Functions that call
+// others need a frame, ret alone is for leaves.
+void label(Masm<Amd64> &m, LabelId l);
+void mov(Masm<Amd64> &m, Reg d, Reg s);
+void mov(Masm<Amd64> &m, Reg d, u64 imm);
+void add(Masm<Amd64> &m, Reg d, Reg x, Reg y);
+void add(Masm<Amd64> &m, Reg d, Reg x, s32 imm);
+void sub(Masm<Amd64> &m, Reg d, Reg x, Reg y);
+void sub(Masm<Amd64> &m, Reg d, Reg x, s32 imm);
+void mul(Masm<Amd64> &m, Reg d, Reg x, Reg y);
+void and_(Masm<Amd64> &m, Reg d, Reg x, Reg y);
+void and_(Masm<Amd64> &m, Reg d, Reg x, s32 imm);
+void or_(Masm<Amd64> &m, Reg d, Reg x, Reg y);
+void or_(Masm<Amd64> &m, Reg d, Reg x, s32 imm);
+void xor_(Masm<Amd64> &m, Reg d, Reg x, Reg y);
+void xor_(Masm<Amd64> &m, Reg d, Reg x, s32 imm);
+void shl(Masm<Amd64> &m, Reg d, Reg x, u8 n);
+void shr(Masm<Amd64> &m, Reg d, Reg x, u8 n);
+void sar(Masm<Amd64> &m, Reg d, Reg x, u8 n);
+void load(Masm<Amd64> &m, Reg d, Mem src, u8 size = 64);
+void store(Masm<Amd64> &m, Mem dst, Reg s, u8 size = 64);
+void br(Masm<Amd64> &m, Cond c, Reg x, Reg y, LabelId l);
+void br(Masm<Amd64> &m, Cond c, Reg x, s32 imm, LabelId l);
+void jmp(Masm<Amd64> &m, LabelId l);
+void call(Masm<Amd64> &m, LabelId l);
+void call(Masm<Amd64> &m, Reg r);
+void enter(Masm<Amd64> &m, u8 saved = 0);
+void leave(Masm<Amd64> &m, u8 saved = 0);
+void ret(Masm<Amd64> &m);
+
+void label(Masm<Arm64> &m, LabelId l);
+void mov(Masm<Arm64> &m, Reg d, Reg s);
+void mov(Masm<Arm64> &m, Reg d, u64 imm);
+void add(Masm<Arm64> &m, Reg d, Reg x, Reg y);
+void add(Masm<Arm64> &m, Reg d, Reg x, s32 imm);
+void sub(Masm<Arm64> &m, Reg d, Reg x, Reg y);
+void sub(Masm<Arm64> &m, Reg d, Reg x, s32 imm);
+void mul(Masm<Arm64> &m, Reg d, Reg x, Reg y);
+void and_(Masm<Arm64> &m, Reg d, Reg x, Reg y);
+void and_(Masm<Arm64> &m, Reg d, Reg x, s32 imm);
+void or_(Masm<Arm64> &m, Reg d, Reg x, Reg y);
+void or_(Masm<Arm64> &m, Reg d, Reg x, s32 imm);
+void xor_(Masm<Arm64> &m, Reg d, Reg x, Reg y);
+void xor_(Masm<Arm64> &m, Reg d, Reg x, s32 imm);
+void shl(Masm<Arm64> &m, Reg d, Reg x, u8 n);
+void shr(Masm<Arm64> &m, Reg d, Reg x, u8 n);
+void sar(Masm<Arm64> &m, Reg d, Reg x, u8 n);
+void load(Masm<Arm64> &m, Reg d, Mem src, u8 size = 64);
+void store(Masm<Arm64> &m, Mem dst, Reg s, u8 size = 64);
+void br(Masm<Arm64> &m, Cond c, Reg x, Reg y, LabelId l);
+void br(Masm<Arm64> &m, Cond c, Reg x, s32 imm, LabelId l);
+void jmp(Masm<Arm64> &m, LabelId l);
+void call(Masm<Arm64> &m, LabelId l);
+void call(Masm<Arm64> &m, Reg r);
+void enter(Masm<Arm64> &m, u8 saved = 0);
+void leave(Masm<Arm64> &m, u8 saved = 0);
+void ret(Masm<Arm64> &m);
+
+template <typename T>
+inline void label(Masm<T> &m, const char *name) { label(m, label_id(*m.a, name)); }
+
+template <typename T>
+inline void br(Masm<T> &m, Cond c, Reg x, Reg y, const char *l) { br(m, c, x, y, label_id(*m.a, l)); }
+
+template <typename T>
+inline void br(Masm<T> &m, Cond c, Reg x, s32 imm, const char *l) { br(m, c, x, imm, label_id(*m.a, l)); }
+
+template <typename T>
+inline void jmp(Masm<T> &m, const char *l) { jmp(m, label_id(*m.a, l)); }
+
+template <typename T>
+inline void call(Masm<T> &m, const char *l) { call(m, label_id(*m.a, l)); }
+
+}
@@ -0,0 +1,444 @@
+#include <string.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "amd64.hh"
+#include "arm64.hh"
+#include "peep.hh"
+
+// The window is the same for both targets, only the ops and
+// the way they are encoded and rewritten differ.
+
+template <typename P>
+static bool on(const P &p, PeepRule r) { return p.rules >> r & 1; }
+
+template <typename P>
+static void hit(P &p, PeepRule r) { p.hits[r]++; }
+
+template <typename P>
+static void remove(P &p, u32 i)
+{
+	p.n--;
+	memmove(p.win + i, p.win + i + 1, (p.n - i)*sizeof(p.win[0]));
+}
+
+// Encode the oldest op to make room, a fold waiting
+// on it can no longer happen
+template <typename P>
+static void retire(P &p)
+{
+	encode(*p.a, p.win[0]);
+	remove(p, 0);
+	if (p.n)
+		p.win[0].fold = false;
+}
+
+template <typename P>
+static Assembler &drain(P &p)
+{
+	while (p.n)
+		retire(p);
+	return *p.a;
+}
+
+template <typename P, typename O>
+static void place(P &p, const O &o)
+{
+	if (p.n == PeepWindow)
+		retire(p);
+	p.win[p.n++] = o;
+}
+
+// Resolve the folds waiting for the fate of the flags: f > 0 means
+// they are overwritten before being read, f < 0 that they may be
+// read. Labels count as overwriting, see the rules in peep.hh.
+template <typename P>
+static void settle(P &p, int f)
+{
+	if (!f)
+		return;
+	for (u32 i = 1; i < p.n; i++) {
+		if (!p.win[i].fold)
+			continue;
+		if (f < 0) {
+			p.win[i].fold = false;
+			continue;
+		}
+		fold(p, i);
+		i--;
+	}
+}
+
+template <typename P, typename O>
+static void queue(P &p, const O &o)
+{
+	settle(p, flags(o));
+	place(p, o);
+}
+
+// A jump to the label being bound is a jump to the next instruction
+template <typename P>
+static void bind(P &p, LabelId l)
+{
+	while (on(p, PeepJmpNext) && p.n && jumps(p.win[p.n-1]) && p.win[p.n-1].l.sym == l.sym) {
+		p.n--;
+		hit(p, PeepJmpNext);
+	}
+	settle(p, 1);
+	drain(p);
+	label(*p.a, l);
+}
+
+template <typename P>
+static void init_peep(P &p, Assembler &a, u32 rules)
+{
+	memset(&p, 0, sizeof(p));
+	p.a = &a;
+	p.rules = rules;
+}
+
+namespace amd64 {
+
+enum PeepKind {
+	PeepMov,
+	PeepMovImm,
+	PeepAdd,
+	PeepAddImm,
+	PeepSub,
+	PeepSubImm,
+	PeepCmp,
+	PeepCmpImm,
+	PeepTest,
+	PeepLea,
+	PeepJcc,
+	PeepJmp,
+};
+
+static bool same(Reg r1, Reg r2) { return r1.code == r2.code && r1.size == r2.size; }
+
+static void encode(Assembler &a, const PeepOp &o)
+{
+	switch (o.kind) {
+		case PeepMov:    return mov(a, o.d, o.s);
+		case PeepMovImm: return mov(a, o.d, o.imm);
+		case PeepAdd:    return add(a, o.d, o.s);
+		case PeepAddImm: return add(a, o.d, (u32)o.imm);
+		case PeepSub:    return sub(a, o.d, o.s);
+		case PeepSubImm: return sub(a, o.d, (u32)o.imm);
+		case PeepCmp:    return cmp(a, o.d, o.s);
+		case PeepCmpImm: return cmp(a, o.d, (u32)o.imm);
+		case PeepTest:   return test(a, o.d, o.s);
+		case PeepLea:    return lea(a, o.d, o.x.size ? ptr(o.s, o.x*1, (s32)o.imm) : ptr(o.s, (s32)o.imm));
+		case PeepJcc:    return jcc(a, o.c, o.l);
+		case PeepJmp:    return jmp(a, o.l);
+	}
+}
+
+static bool jumps(const PeepOp &o) { return o.kind == PeepJcc || o.kind == PeepJmp; }
+
+static int flags(const PeepOp &o)
+{
+	switch (o.kind) {
+		case PeepAdd: case PeepAddImm: case PeepSub: case PeepSubImm:
+		case PeepCmp: case PeepCmpImm: case PeepTest:
+		case PeepJmp:
+			return 1;
+		case PeepJcc:
+			return -1;
+	}
+	return 0;
+}
+
+// mov d, s; add d, x -> lea d, [s+x]
+static void fold(Peep &p, u32 i)
+{
+	PeepOp &m = p.win[i-1], &o = p.win[i];
+	PeepOp l = {};
+	l.kind = PeepLea;
+	l.d = o.d;
+	l.s = {m.s.code, 64};
+	if (o.kind == PeepAdd)
+		l.x = {(same(o.s, o.d) ? m.s : o.s).code, 64};
+	else
+		l.imm = o.imm;
+	if (l.x.size && l.x.code == rsp.code) { // not encodable as an index
+		l.x = l.s;
+		l.s = rsp;
+	}
+	m = l;
+	remove(p, i);
+	hit(p, PeepFold);
+}
+
+// The add can become part of the mov before it as a lea
+static bool foldable(const Peep &p, const PeepOp &o)
+{
+	if (!on(p, PeepFold) || !p.n)
+		return false;
+	const PeepOp &m = p.win[p.n-1];
+	if (m.kind != PeepMov || !same(m.d, o.d) || (o.d.size != 32 && o.d.size != 64))
+		return false;
+	if (o.kind == PeepAddImm)
+		return true;
+	Reg x = same(o.s, o.d) ? m.s : o.s;
+	return x.size == o.d.size && !(x.code == rsp.code && m.s.code == rsp.code);
+}
+
+void init(Peep &p, Assembler &a, u32 rules) { init_peep(p, a, rules); }
+Assembler &flush(Peep &p) { return drain(p); }
+void label(Peep &p, LabelId l) { bind(p, l); }
+void label(Peep &p, const char *name) { bind(p, label_id(*p.a, name)); }
+
+void mov(Peep &p, Reg dst, Reg src)
+{
+	// 32 bit moves clear the upper half, so they are never no-ops
+	if (on(p, PeepSelfMov) && same(dst, src) && dst.size != 32) {
+		hit(p, PeepSelfMov);
+		return;
+	}
+	if (on(p, PeepMovBack) && p.n && dst.size != 32) {
+		const PeepOp &m = p.win[p.n-1];
+		if (m.kind == PeepMov && same(m.d, src) && same(m.s, dst)) {
+			hit(p, PeepMovBack);
+			return;
+		}
+	}
+	PeepOp o = {};
+	o.kind = PeepMov;
+	o.d = dst;
+	o.s = src;
+	queue(p, o);
+}
+
+void mov(Peep &p, Reg dst, u64 src)
+{
+	PeepOp o = {};
+	o.kind = PeepMovImm;
+	o.d = dst;
+	o.imm = src;
+	queue(p, o);
+}
+
+static void arith(Peep &p, u8 kind, Reg dst, Reg src, u64 imm)
+{
+	PeepOp o = {};
+	o.kind = kind;
+	o.d = dst;
+	o.s = src;
+	o.imm = imm;
+	settle(p, flags(o));
+	o.fold = (kind == PeepAdd || kind == PeepAddImm) && foldable(p, o);
+	place(p, o);
+}
+
+void add(Peep &p, Reg dst, Reg src) { arith(p, PeepAdd, dst, src, 0); }
+void add(Peep &p, Reg dst, u32 src) { arith(p, PeepAddImm, dst, {}, src); }
+void sub(Peep &p, Reg dst, Reg src) { arith(p, PeepSub, dst, src, 0); }
+void sub(Peep &p, Reg dst, u32 src) { arith(p, PeepSubImm, dst, {}, src); }
+void cmp(Peep &p, Reg dst, Reg src) { arith(p, PeepCmp, dst, src, 0); }
+void test(Peep &p, Reg dst, Reg src) { arith(p, PeepTest, dst, src, 0); }
+
+void cmp(Peep &p, Reg dst, u32 src)
+{
+	if (on(p, PeepZero) && !src) {
+		hit(p, PeepZero);
+		return arith(p, PeepTest, dst, dst, 0);
+	}
+	arith(p, PeepCmpImm, dst, {}, src);
+}
+
+void jcc(Peep &p, Cond c, LabelId l)
+{
+	PeepOp o = {};
+	o.kind = PeepJcc;
+	o.c = c;
+	o.l = l;
+	queue(p, o);
+}
+
+void jcc(Peep &p, Cond c, const char *l) { jcc(p, c, label_id(*p.a, l)); }
+
+void jmp(Peep &p, LabelId l)
+{
+	PeepOp o = {};
+	o.kind = PeepJmp;
+	o.l = l;
+	queue(p, o);
+}
+
+void jmp(Peep &p, const char *l) { jmp(p, label_id(*p.a, l)); }
+
+}
+
+namespace arm64 {
+
+enum PeepKind {
+	PeepMov,
+	PeepAdd,
+	PeepAddImm,
+	PeepSub,
+	PeepSubImm,
+	PeepCmp,
+	PeepCmpImm,
+	PeepB,
+	PeepBCond,
+	PeepCbz,
+	PeepCbnz,
+};
+
+static bool same(Reg r1, Reg r2) { return r1.code == r2.code && r1.sf == r2.sf && r1.sp == r2.sp; }
+
+static void encode(Assembler &a, const PeepOp &o)
+{
+	switch (o.kind) {
+		case PeepMov:    return mov(a, o.d, o.n);
+		case PeepAdd:    return add(a, o.d, o.n, o.m);
+		case PeepAddImm: return add(a, o.d, o.n, o.imm);
+		case PeepSub:    return sub(a, o.d, o.n, o.m);
+		case PeepSubImm: return sub(a, o.d, o.n, o.imm);
+		case PeepCmp:    return cmp(a, o.n, o.m);
+		case PeepCmpImm: return cmp(a, o.n, o.imm);
+		case PeepB:      return b(a, o.l);
+		case PeepBCond:  return b(a, o.c, o.l);
+		case PeepCbz:    return cbz(a, o.n, o.l);
+		case PeepCbnz:   return cbnz(a, o.n, o.l);
+	}
+}
+
+static bool jumps(const PeepOp &o) { return o.kind >= PeepB; }
+
+static int flags(const PeepOp &o)
+{
+	switch (o.kind) {
+		case PeepCmp: case PeepCmpImm: case PeepB:
+			return 1;
+		case PeepBCond:
+			return -1;
+	}
+	return 0;
+}
+
+// cmp n, 0; b.eq l -> cbz n, l
+static void fold(Peep &p, u32 i)
+{
+	PeepOp &c = p.win[i-1], &o = p.win[i];
+	c.kind = o.c == EQ ? PeepCbz : PeepCbnz;
+	c.l = o.l;
+	remove(p, i);
+	hit(p, PeepZero);
+}
+
+void init(Peep &p, Assembler &a, u32 rules) { init_peep(p, a, rules); }
+Assembler &flush(Peep &p) { return drain(p); }
+void label(Peep &p, LabelId l) { bind(p, l); }
+void label(Peep &p, const char *name) { bind(p, label_id(*p.a, name)); }
+
+void mov(Peep &p, Reg d, Reg n)
+{
+	// 32 bit moves clear the upper half, so they are never no-ops
+	if (on(p, PeepSelfMov) && same(d, n) && d.sf) {
+		hit(p, PeepSelfMov);
+		return;
+	}
+	if (on(p, PeepMovBack) && p.n && d.sf) {
+		const PeepOp &m = p.win[p.n-1];
+		if (m.kind == PeepMov && same(m.d, n) && same(m.n, d)) {
+			hit(p, PeepMovBack);
+			return;
+		}
+	}
+	PeepOp o = {};
+	o.kind = PeepMov;
+	o.d = d;
+	o.n = n;
+	queue(p, o);
+}
+
+// mov d, s; add d, d, m -> add d, s, m, the flags are not
+// involved so there is nothing to wait for
+static void arith(Peep &p, u8 kind, Reg d, Reg n, Reg m, u16 imm)
+{
+	bool reg = kind == PeepAdd || kind == PeepSub;
+	if (on(p, PeepFold) && p.n && same(d, n) && d.code != 31 && !(reg && m.code == 31)) {
+		PeepOp &mv = p.win[p.n-1];
+		if (mv.kind == PeepMov && same(mv.d, d) && mv.n.code != 31) {
+			mv.kind = kind;
+			if (reg)
+				mv.m = same(m, d) ? mv.n : m;
+			mv.imm = imm;
+			hit(p, PeepFold);
+			return;
+		}
+	}
+	PeepOp o = {};
+	o.kind = kind;
+	o.d = d;
+	o.n = n;
+	o.m = m;
+	o.imm = imm;
+	queue(p, o);
+}
+
+void add(Peep &p, Reg d, Reg n, Reg m) { arith(p, PeepAdd, d, n, m, 0); }
+void add(Peep &p, Reg d, Reg n, u16 imm12) { arith(p, PeepAddImm, d, n, {}, imm12); }
+void sub(Peep &p, Reg d, Reg n, Reg m) { arith(p, PeepSub, d, n, m, 0); }
+void sub(Peep &p, Reg d, Reg n, u16 imm12) { arith(p, PeepSubImm, d, n, {}, imm12); }
+
+void cmp(Peep &p, Reg n, Reg m)
+{
+	PeepOp o = {};
+	o.kind = PeepCmp;
+	o.n = n;
+	o.m = m;
+	queue(p, o);
+}
+
+void cmp(Peep &p, Reg n, u16 imm12)
+{
+	PeepOp o = {};
+	o.kind = PeepCmpImm;
+	o.n = n;
+	o.imm = imm12;
+	queue(p, o);
+}
+
+void b(Peep &p, LabelId l)
+{
+	PeepOp o = {};
+	o.kind = PeepB;
+	o.l = l;
+	queue(p, o);
+}
+
+void b(Peep &p, const char *l) { b(p, label_id(*p.a, l)); }
+
+void b(Peep &p, Cond c, LabelId l)
+{
+	PeepOp o = {};
+	o.kind = PeepBCond;
+	o.c = c;
+	o.l = l;
+	settle(p, flags(o));
+	if (on(p, PeepZero) && p.n && (c == EQ || c == NE)) {
+		const PeepOp &m = p.win[p.n-1];
+		o.fold = m.kind == PeepCmpImm && !m.imm && m.n.code != 31;
+	}
+	place(p, o);
+}
+
+void b(Peep &p, Cond c, const char *l) { b(p, c, label_id(*p.a, l)); }
+
+static void cb(Peep &p, u8 kind, Reg t, LabelId l)
+{
+	PeepOp o = {};
+	o.kind = kind;
+	o.n = t;
+	o.l = l;
+	queue(p, o);
+}
+
+void cbz(Peep &p, Reg t, LabelId l) { cb(p, PeepCbz, t, l); }
+void cbnz(Peep &p, Reg t, LabelId l) { cb(p, PeepCbnz, t, l); }
+
+}
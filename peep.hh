@@ -0,0 +1,100 @@
+// Peephole stage: the instructions it knows are buffered in a small
+// window in front of the assembler and only encoded when they leave
+// it, so wasteful sequences emitted by a naive front end can be
+// rewritten first. Anything else goes through flush(), which empties
+// the window and returns the assembler to emit it directly, e.g.
+// dec(flush(p), rdi). Labels must be bound through the stage too.
+//
+// The rules that drop a flag write (PeepFold on amd64, PeepZero on
+// arm64) wait until the flags are overwritten, or are left as they
+// are. They assume that the flags are dead at every label, i.e. that
+// code reached by a jump sets them before reading; clear the rule in
+// init for code where that does not hold.
+enum PeepRule {
+	PeepJmpNext, // jump to the label that follows it
+	PeepZero,    // cmp r, 0 -> test r, r (amd64), cmp r, 0; b.eq -> cbz (arm64)
+	PeepFold,    // mov d, s; add d, x -> lea d, [s+x] (amd64), add d, s, x (arm64)
+	PeepSelfMov, // mov r, r
+	PeepMovBack, // mov d, s; mov s, d -> mov d, s
+	PeepRules,
+};
+
+static const u32 PeepWindow = 4;
+
+namespace amd64 {
+
+struct PeepOp {
+	u8      kind;
+	bool    fold; // add after its mov, waits for a flag write, see settle
+	Cond    c;
+	Reg     d, s, x;
+	u64     imm;
+	LabelId l;
+};
+
+struct Peep {
+	Assembler *a;
+	u32       rules; // enabled, bit per PeepRule
+	u32       hits[PeepRules];
+	PeepOp    win[PeepWindow];
+	u32       n;
+};
+
+void init(Peep &p, Assembler &a, u32 rules = ~0u);
+Assembler &flush(Peep &p);
+void label(Peep &p, LabelId l);
+void label(Peep &p, const char *name);
+void mov(Peep &p, Reg dst, Reg src);
+void mov(Peep &p, Reg dst, u64 src);
+void add(Peep &p, Reg dst, Reg src);
+void add(Peep &p, Reg dst, u32 src);
+void sub(Peep &p, Reg dst, Reg src);
+void sub(Peep &p, Reg dst, u32 src);
+void cmp(Peep &p, Reg dst, Reg src);
+void cmp(Peep &p, Reg dst, u32 src);
+void test(Peep &p, Reg dst, Reg src);
+void jcc(Peep &p, Cond c, LabelId l);
+void jcc(Peep &p, Cond c, const char *l);
+void jmp(Peep &p, LabelId l);
+void jmp(Peep &p, const char *l);
+
+}
+
+namespace arm64 {
+
+struct PeepOp {
+	u8      kind;
+	bool    fold; // b.eq/b.ne after cmp 0, waits for a flag write
+	Cond    c;
+	Reg     d, n, m;
+	u16     imm;
+	LabelId l;
+};
+
+struct Peep {
+	Assembler *a;
+	u32       rules; // enabled, bit per PeepRule
+	u32       hits[PeepRules];
+	PeepOp    win[PeepWindow];
+	u32       n;
+};
+
+void init(Peep &p, Assembler &a, u32 rules = ~0u);
+Assembler &flush(Peep &p);
+void label(Peep &p, LabelId l);
+void label(Peep &p, const char *name);
+void mov(Peep &p, Reg d, Reg n);
+void add(Peep &p, Reg d, Reg n, Reg m);
+void add(Peep &p, Reg d, Reg n, u16 imm12);
+void sub(Peep &p, Reg d, Reg n, Reg m);
+void sub(Peep &p, Reg d, Reg n, u16 imm12);
+void cmp(Peep &p, Reg n, Reg m);
+void cmp(Peep &p, Reg n, u16 imm12);
+void b(Peep &p, LabelId l);
+void b(Peep &p, const char *l);
+void b(Peep &p, Cond c, LabelId l);
+void b(Peep &p, Cond c, const char *l);
+void cbz(Peep &p, Reg t, LabelId l);
+void cbnz(Peep &p, Reg t, LabelId l);
+
+}
@@ -0,0 +1,120 @@
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <elf.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "perf.hh"
+
+// Reference: tools/perf/Documentation/jitdump-specification.txt
+
+static const u32 DumpMagic = 0x4a695444;
+
+struct DumpHeader {
+	u32 magic;
+	u32 version;
+	u32 size;
+	u32 mach;
+	u32 pad;
+	u32 pid;
+	u64 timestamp;
+	u64 flags;
+};
+
+struct CodeLoad {
+	u32 id; // record header
+	u32 size;
+	u64 timestamp;
+	u32 pid;
+	u32 tid;
+	u64 vma;
+	u64 addr;
+	u64 codesize;
+	u64 index;
+};
+
+// perf record -k mono uses the same clock
+static u64 timestamp()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (u64)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+void init(Perf &p, int outputs)
+{
+	p = {-1, -1, 0, 0};
+	char path[64];
+	if (outputs & PerfMap) {
+		snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+		p.mapfd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+	}
+	if (outputs & PerfDump) {
+		snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+		p.dumpfd = open(path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+		if (p.dumpfd < 0)
+			return;
+#ifdef __aarch64__
+		u32 mach = EM_AARCH64;
+#else
+		u32 mach = EM_X86_64;
+#endif
+		DumpHeader h = {DumpMagic, 1, sizeof(DumpHeader), mach, 0, (u32)getpid(), timestamp(), 0};
+		if (write(p.dumpfd, &h, sizeof(h)) != sizeof(h)) {
+			close(p.dumpfd);
+			p.dumpfd = -1;
+			return;
+		}
+		p.marker = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ|PROT_EXEC, MAP_PRIVATE, p.dumpfd, 0);
+		if (p.marker == MAP_FAILED)
+			p.marker = 0;
+	}
+}
+
+void clear(Perf &p)
+{
+	if (p.marker)
+		munmap(p.marker, sysconf(_SC_PAGESIZE));
+	if (p.mapfd >= 0)
+		close(p.mapfd);
+	if (p.dumpfd >= 0)
+		close(p.dumpfd);
+	p = {-1, -1, 0, 0};
+}
+
+static void load(Perf &p, const char *name, u8 *code, u32 size)
+{
+	if (p.mapfd >= 0)
+		dprintf(p.mapfd, "%lx %x %s\n", (u64)code, size, name);
+	if (p.dumpfd < 0)
+		return;
+	u32 n = strlen(name) + 1;
+	CodeLoad r = {0, (u32)(sizeof(r) + n + size), timestamp(), (u32)getpid(), (u32)gettid(), (u64)code, (u64)code, size, p.index++};
+	iovec iov[] = {{&r, sizeof(r)}, {(void *)name, n}, {code, size}};
+	writev(p.dumpfd, iov, 3);
+}
+
+// Describe code published from a: every named label starts a function
+// that extends to the next one, the code before the first is "jit".
+void record(Perf &p, Assembler &a, void *code)
+{
+	u32 n;
+	Symbol **syms = sorted_syms(a, n);
+	u8 *base = (u8 *)code;
+	u32 start = 0;
+	const char *name = "jit";
+	for (u32 i = 0; i < n; i++) {
+		if (syms[i]->addr > start)
+			load(p, name, base + start, syms[i]->addr - start);
+		start = syms[i]->addr;
+		name = syms[i]->name;
+	}
+	if (a.ip > start)
+		load(p, name, base + start, a.ip - start);
+}
@@ -0,0 +1,16 @@
+enum PerfOutput {
+	PerfMap  = 1, // /tmp/perf-<pid>.map
+	PerfDump = 2, // /tmp/jit-<pid>.dump for perf inject --jit
+};
+
+// Tells perf about JITed code, so that samples in it can be attributed
+struct Perf {
+	int  mapfd;
+	int  dumpfd;
+	void *marker; // mapping of the dump, perf record looks for it
+	u64  index;
+};
+
+void init(Perf &p, int outputs);
+void clear(Perf &p);
+void record(Perf &p, Assembler &a, void *code);
@@ -0,0 +1,35 @@
+#include <string.h>
+#include <assert.h>
+
+#include "types.hh"
+#include "arena.hh"
+#include "asm.hh"
+#include "stencil.hh"
+
+void init(StencilLib &l, u32 nop)
+{
+	l = {};
+	l.ops = (StencilOp *)alloc(l.tmp, nop*sizeof(StencilOp));
+	memset(l.ops, 0, nop*sizeof(StencilOp));
+	l.nop = nop;
+}
+
+void clear(StencilLib &l)
+{
+	reset(l.tmp);
+	l = {};
+}
+
+void add(StencilLib &l, u32 op, const u8 *code, u32 size, const Hole *holes, u32 nhole)
+{
+	assert(op < l.nop);
+	StencilOp &s = l.ops[op];
+	u32 padded = (size + 15) & ~15u; // see push_stencil
+	s.code = (u8 *)alloc(l.tmp, padded, 16);
+	memcpy(s.code, code, size);
+	memset(s.code + size, 0, padded - size);
+	s.holes = (Hole *)alloc(l.tmp, nhole*sizeof(Hole));
+	memcpy(s.holes, holes, nhole*sizeof(Hole));
+	s.size = size;
+	s.nhole = nhole;
+}
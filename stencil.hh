@@ -0,0 +1,32 @@
+struct StencilOp {
+	u8   *code;
+	Hole *holes;
+	u32  size, nhole;
+};
+
+// Copy-and-patch compiler: a stencil for every opcode, compiled by
+// copying them back to back and filling their holes. The stencils can
+// come from constant expressions or be built with the same functions
+// at startup; their hole names must outlive the library.
+struct StencilLib {
+	Arena     tmp; // copies of the stencils
+	StencilOp *ops;
+	u32       nop;
+};
+
+void init(StencilLib &l, u32 nop);
+void clear(StencilLib &l);
+void add(StencilLib &l, u32 op, const u8 *code, u32 size, const Hole *holes, u32 nhole);
+
+template <u32 N, u32 H>
+inline void add(StencilLib &l, u32 op, const Stencil<N, H> &s)
+{
+	add(l, op, s.code, s.size, s.holes, s.nhole);
+}
+
+// f fills the holes of the stencil of op
+inline void push_stencil(Assembler &a, const StencilLib &l, u32 op, const Fill *f)
+{
+	const StencilOp &s = l.ops[op];
+	push_stencil(a, s.code, s.size, s.holes, s.nhole, f);
+}
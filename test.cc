@@ -1,11 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <elf.h>
 
 #include "types.hh"
 #include "arena.hh"
 #include "asm.hh"
 #include "amd64.hh"
 #include "arm64.hh"
+#include "heap.hh"
+#include "elf.hh"
+#include "perf.hh"
+#include "gdb.hh"
+#include "stencil.hh"
+#include "peep.hh"
+#include "masm.hh"
+#include "ir.hh"
 
 void expect(const Assembler &a, const u8 b[], u64 s, const char *file, int line)
 {
@@ -17,7 +30,17 @@ void expect(const Assembler &a, const u8 b[], u64 s, const char *file, int line)
 	}
 }
 
-#define expect(a, ...) expect(a, (u8[])__VA_ARGS__, sizeof((u8[])__VA_ARGS__), __FILE__, __LINE__)
+#define expect(a, ...) expect(a, (const u8[])__VA_ARGS__, sizeof((const u8[])__VA_ARGS__), __FILE__, __LINE__)
+
+void check(bool ok, const char *file, int line)
+{
+	if (!ok) {
+		printf("Test failed: %s:%d\n", file, line);
+		exit(1);
+	}
+}
+
+#define check(ok) check(ok, __FILE__, __LINE__)
 
 // TODO: add error cases
 
@@ -54,6 +77,11 @@ void testamd64()
 label(a, "foo");
 	jcc(a, A, "foo");                   expect(a, {0x0f, 0x87, 0xfa, 0xff, 0xff, 0xff});
 	jcc(a, E, "foo");                   expect(a, {0x0f, 0x84, 0xf4, 0xff, 0xff, 0xff});
+	jmp(a, label_id(a, "foo"));         expect(a, {0xe9, 0xef, 0xff, 0xff, 0xff});
+	LabelId baz = label_id(a, "baz");
+	call(a, baz);
+label(a, baz);
+	                                    expect(a, {0xe8, 0x00, 0x00, 0x00, 0x00});
 	add(a, rax, rbx);                   expect(a, {0x48, 0x01, 0xd8});
 	add(a, eax, ecx);                   expect(a, {0x01, 0xc8});
 	add(a, al, r12b);                   expect(a, {0x44, 0x00, 0xe0});
@@ -114,6 +142,14 @@ label(a, "foo");
 	div(a, ebx);                        expect(a, {0xf7, 0xf3});
 	div(a, rbx);                        expect(a, {0x48, 0xf7, 0xf3});
 	div(a, r9);                         expect(a, {0x49, 0xf7, 0xf1});
+	neg(a, rax);                        expect(a, {0x48, 0xf7, 0xd8});
+	imul(a, rax, r9);                   expect(a, {0x49, 0x0f, 0xaf, 0xc1});
+	imul(a, ecx, edx);                  expect(a, {0x0f, 0xaf, 0xca});
+	shl(a, rax, 3);                     expect(a, {0x48, 0xc1, 0xe0, 0x03});
+	shr(a, r10d, 31);                   expect(a, {0x41, 0xc1, 0xea, 0x1f});
+	sar(a, rdx, 63);                    expect(a, {0x48, 0xc1, 0xfa, 0x3f});
+	movzx(a, eax, ptr(rdi, 8), 8);      expect(a, {0x0f, 0xb6, 0x47, 0x08});
+	movzx(a, r11d, ptr(r12), 16);       expect(a, {0x45, 0x0f, 0xb7, 0x1c, 0x24});
 	nop(a);                             expect(a, {0x90});
 	mfence(a);                          expect(a, {0x0f, 0xae, 0xf0});
 	rdtsc(a);                           expect(a, {0x0f, 0x31});
@@ -122,6 +158,469 @@ label(a, "foo");
 	clear(a);
 }
 
+void testavx()
+{
+	using namespace amd64;
+	Assembler a{};
+	// instruction                                        // expected byte sequence
+	vmovdqu(a, ymm0, ptr(rdi));                           expect(a, {0xc5, 0xfe, 0x6f, 0x07});
+	vmovdqu(a, ptr(rdi, rax*4, 32), xmm9);                expect(a, {0xc5, 0x7a, 0x7f, 0x4c, 0x87, 0x20});
+	vmovdqu(a, zmm1, ptr(rdi, 128));                      expect(a, {0x62, 0xf1, 0x7e, 0x48, 0x6f, 0x4f, 0x02});
+	vmovdqu(a, zmm1, ptr(rdi, 100));                      expect(a, {0x62, 0xf1, 0x7e, 0x48, 0x6f, 0x8f, 0x64, 0x00, 0x00, 0x00});
+	vmovdqu(a, mask(ymm2, k1, true), ptr(rsi));           expect(a, {0x62, 0xf1, 0x7e, 0xa9, 0x6f, 0x16});
+	vmovdqu(a, ptr(r8), mask(zmm3, k2));                  expect(a, {0x62, 0xd1, 0x7e, 0x4a, 0x7f, 0x18});
+	vmovups(a, xmm12, xmm1);                              expect(a, {0xc5, 0x78, 0x10, 0xe1});
+	vmovups(a, ptr(rax), ymm15);                          expect(a, {0xc5, 0x7c, 0x11, 0x38});
+	vpaddd(a, ymm0, ymm1, ymm2);                          expect(a, {0xc5, 0xf5, 0xfe, 0xc2});
+	vpaddd(a, ymm8, ymm9, ymm10);                         expect(a, {0xc4, 0x41, 0x35, 0xfe, 0xc2});
+	vpaddd(a, xmm16, xmm1, xmm2);                         expect(a, {0x62, 0xe1, 0x75, 0x08, 0xfe, 0xc2});
+	vpaddd(a, zmm1, zmm2, zmm31);                         expect(a, {0x62, 0x91, 0x6d, 0x48, 0xfe, 0xcf});
+	vpaddd(a, mask(zmm1, k1, true), zmm2, ptr(rax, 128)); expect(a, {0x62, 0xf1, 0x6d, 0xc9, 0xfe, 0x48, 0x02});
+	vpaddd(a, zmm1, zmm20, ptr(r13, r12*8, -64));         expect(a, {0x62, 0x91, 0x5d, 0x40, 0xfe, 0x4c, 0xe5, 0xff});
+	vpaddq(a, ymm1, ymm2, ymm3);                          expect(a, {0xc5, 0xed, 0xd4, 0xcb});
+	vpaddq(a, zmm1, zmm2, zmm3);                          expect(a, {0x62, 0xf1, 0xed, 0x48, 0xd4, 0xcb});
+	vpsubd(a, xmm1, xmm2, ptr(rcx));                      expect(a, {0xc5, 0xe9, 0xfa, 0x09});
+	vpmulld(a, ymm1, ymm2, ymm3);                         expect(a, {0xc4, 0xe2, 0x6d, 0x40, 0xcb});
+	vpmulld(a, zmm1, zmm2, zmm3);                         expect(a, {0x62, 0xf2, 0x6d, 0x48, 0x40, 0xcb});
+	vpand(a, ymm1, ymm2, ymm3);                           expect(a, {0xc5, 0xed, 0xdb, 0xcb});
+	vpor(a, zmm1, zmm2, zmm3);                            expect(a, {0x62, 0xf1, 0x6d, 0x48, 0xeb, 0xcb});
+	vpxor(a, xmm0, xmm0, xmm0);                           expect(a, {0xc5, 0xf9, 0xef, 0xc0});
+	vaddps(a, ymm1, ymm2, ymm3);                          expect(a, {0xc5, 0xec, 0x58, 0xcb});
+	vaddpd(a, zmm1, zmm2, ptr(rdx, 64));                  expect(a, {0x62, 0xf1, 0xed, 0x48, 0x58, 0x4a, 0x01});
+	vmulps(a, xmm1, xmm2, xmm3);                          expect(a, {0xc5, 0xe8, 0x59, 0xcb});
+	vmulpd(a, ymm1, ymm2, ymm3);                          expect(a, {0xc5, 0xed, 0x59, 0xcb});
+	vpcmpeqd(a, ymm1, ymm2, ymm3);                        expect(a, {0xc5, 0xed, 0x76, 0xcb});
+	vpcmpgtd(a, xmm1, xmm2, ptr(rdi));                    expect(a, {0xc5, 0xe9, 0x66, 0x0f});
+	vpcmpeqd(a, k1, zmm2, zmm3);                          expect(a, {0x62, 0xf1, 0x6d, 0x48, 0x76, 0xcb});
+	vpcmpgtd(a, k2, ymm2, ptr(rdi, 32));                  expect(a, {0x62, 0xf1, 0x6d, 0x28, 0x66, 0x57, 0x01});
+	vpcmpd(a, k3, zmm1, zmm2, 1);                         expect(a, {0x62, 0xf3, 0x75, 0x48, 0x1f, 0xda, 0x01});
+	vcmpps(a, ymm1, ymm2, ymm3, 1);                       expect(a, {0xc5, 0xec, 0xc2, 0xcb, 0x01});
+	vcmpps(a, k1, zmm2, zmm3, 2);                         expect(a, {0x62, 0xf1, 0x6c, 0x48, 0xc2, 0xcb, 0x02});
+	vpblendvb(a, ymm1, ymm2, ymm3, ymm4);                 expect(a, {0xc4, 0xe3, 0x6d, 0x4c, 0xcb, 0x40});
+	vblendvps(a, xmm1, xmm2, xmm3, xmm12);                expect(a, {0xc4, 0xe3, 0x69, 0x4a, 0xcb, 0xc0});
+	vpblendmd(a, mask(zmm1, k1), zmm2, zmm3);             expect(a, {0x62, 0xf2, 0x6d, 0x49, 0x64, 0xcb});
+	vblendmps(a, mask(ymm1, k2), ymm2, ptr(rax));         expect(a, {0x62, 0xf2, 0x6d, 0x2a, 0x65, 0x08});
+	vpshufd(a, ymm1, ymm2, 0x1b);                         expect(a, {0xc5, 0xfd, 0x70, 0xca, 0x1b});
+	vpshufd(a, zmm1, ptr(rax, 64), 0x1b);                 expect(a, {0x62, 0xf1, 0x7d, 0x48, 0x70, 0x48, 0x01, 0x1b});
+	vpshufb(a, ymm1, ymm2, ymm3);                         expect(a, {0xc4, 0xe2, 0x6d, 0x00, 0xcb});
+	vpermd(a, ymm1, ymm2, ymm3);                          expect(a, {0xc4, 0xe2, 0x6d, 0x36, 0xcb});
+	vpermps(a, zmm1, zmm2, zmm3);                         expect(a, {0x62, 0xf2, 0x6d, 0x48, 0x16, 0xcb});
+	vpbroadcastd(a, ymm1, xmm2);                          expect(a, {0xc4, 0xe2, 0x7d, 0x58, 0xca});
+	vpbroadcastd(a, zmm1, ptr(rdi, 8));                   expect(a, {0x62, 0xf2, 0x7d, 0x48, 0x58, 0x4f, 0x02});
+	vpbroadcastd(a, zmm1, eax);                           expect(a, {0x62, 0xf2, 0x7d, 0x48, 0x7c, 0xc8});
+	vpbroadcastq(a, ymm1, ptr(rdi));                      expect(a, {0xc4, 0xe2, 0x7d, 0x59, 0x0f});
+	vpbroadcastq(a, zmm1, ptr(rdi, 16));                  expect(a, {0x62, 0xf2, 0xfd, 0x48, 0x59, 0x4f, 0x02});
+	vbroadcastss(a, ymm1, xmm2);                          expect(a, {0xc4, 0xe2, 0x7d, 0x18, 0xca});
+	vpgatherdd(a, ymm1, ptr(rdi, ymm2*4), ymm3);          expect(a, {0xc4, 0xe2, 0x65, 0x90, 0x0c, 0x97});
+	vgatherdps(a, xmm1, ptr(r8, xmm10*4, 8), xmm3);       expect(a, {0xc4, 0x82, 0x61, 0x92, 0x4c, 0x90, 0x08});
+	vpgatherdd(a, mask(zmm1, k1), ptr(rdi, zmm2*4));      expect(a, {0x62, 0xf2, 0x7d, 0x49, 0x90, 0x0c, 0x97});
+	vpgatherdd(a, mask(ymm1, k1), ptr(rdi, ymm20*4, 64)); expect(a, {0x62, 0xf2, 0x7d, 0x21, 0x90, 0x4c, 0xa7, 0x10});
+	vpmovmskb(a, eax, ymm1);                              expect(a, {0xc5, 0xfd, 0xd7, 0xc1});
+	vmovmskps(a, r9d, xmm1);                              expect(a, {0xc5, 0x78, 0x50, 0xc9});
+	vzeroupper(a);                                        expect(a, {0xc5, 0xf8, 0x77});
+	kmovw(a, k1, k2);                                     expect(a, {0xc5, 0xf8, 0x90, 0xca});
+	kmovw(a, k1, ptr(rdi));                               expect(a, {0xc5, 0xf8, 0x90, 0x0f});
+	kmovw(a, ptr(rdi), k1);                               expect(a, {0xc5, 0xf8, 0x91, 0x0f});
+	kmovw(a, k1, r8d);                                    expect(a, {0xc4, 0xc1, 0x78, 0x92, 0xc8});
+	kmovw(a, eax, k1);                                    expect(a, {0xc5, 0xf8, 0x93, 0xc1});
+	kandw(a, k1, k2, k3);                                 expect(a, {0xc5, 0xec, 0x41, 0xcb});
+	korw(a, k1, k2, k3);                                  expect(a, {0xc5, 0xec, 0x45, 0xcb});
+	kxorw(a, k1, k1, k1);                                 expect(a, {0xc5, 0xf4, 0x47, 0xc9});
+	knotw(a, k1, k2);                                     expect(a, {0xc5, 0xf8, 0x44, 0xca});
+	kortestw(a, k1, k1);                                  expect(a, {0xc5, 0xf8, 0x98, 0xc9});
+	check(!a.err);
+	vpaddd(a, ymm1, ymm2, xmm3);        check(a.err == ErrSize);
+	clear(a);
+	vpcmpeqd(a, zmm1, zmm2, zmm3);      check(a.err == ErrSize);
+	clear(a);
+	vpcmpeqd(a, xmm16, xmm2, xmm3);     check(a.err == ErrReg);
+	clear(a);
+	vpgatherdd(a, ymm1, ptr(rdi, ymm2*4)); check(a.err == ErrReg);
+	clear(a);
+}
+
+
+void testshort()
+{
+	using namespace amd64;
+	Assembler a{};
+	a.flags = AsmShort;
+	// instruction                       // expected byte sequence
+	mov(a, rax, 0UL);                    expect(a, {0x31, 0xc0});
+	mov(a, r9, 0UL);                     expect(a, {0x45, 0x31, 0xc9});
+	mov(a, cl, 0UL);                     expect(a, {0x30, 0xc9});
+	mov(a, rax, 5);                      expect(a, {0xb8, 0x05, 0x00, 0x00, 0x00});
+	mov(a, ecx, 7);                      expect(a, {0xb9, 0x07, 0x00, 0x00, 0x00});
+	mov(a, r8, 0xffffffff);              expect(a, {0x41, 0xb8, 0xff, 0xff, 0xff, 0xff});
+	mov(a, rax, -1UL);                   expect(a, {0x48, 0xc7, 0xc0, 0xff, 0xff, 0xff, 0xff});
+	mov(a, rax, 0x123456789);            expect(a, {0x48, 0xb8, 0x89, 0x67, 0x45, 0x23, 0x01, 0x00, 0x00, 0x00});
+	add(a, rax, 8);                      expect(a, {0x48, 0x83, 0xc0, 0x08});
+	add(a, rax, 0x1000);                 expect(a, {0x48, 0x05, 0x00, 0x10, 0x00, 0x00});
+	sub(a, r10d, -1);                    expect(a, {0x41, 0x83, 0xea, 0xff});
+	and_(a, ax, 0xfff0);                 expect(a, {0x66, 0x83, 0xe0, 0xf0});
+	cmp(a, al, 5);                       expect(a, {0x3c, 0x05});
+	cmp(a, rdi, 0);                      expect(a, {0x48, 0x85, 0xff});
+	test(a, rax, rbx);                   expect(a, {0x48, 0x85, 0xd8});
+	mov(a, rax, ptr(rcx*1, 8));          expect(a, {0x48, 0x8b, 0x41, 0x08});
+	lea(a, rax, ptr(rcx*2, 8));          expect(a, {0x48, 0x8d, 0x44, 0x09, 0x08});
+	mov(a, rax, ptr(rcx*4, 8));          expect(a, {0x48, 0x8b, 0x04, 0x8d, 0x08, 0x00, 0x00, 0x00});
+	a.flags = 0;
+	mov(a, rax, ptr(rcx*1, 8));          expect(a, {0x48, 0x8b, 0x04, 0x0d, 0x08, 0x00, 0x00, 0x00});
+	cmp(a, rdi, 0);                      expect(a, {0x48, 0x81, 0xff, 0x00, 0x00, 0x00, 0x00});
+	check(!a.err);
+	clear(a);
+}
+
+void testpeep()
+{
+	{
+		using namespace amd64;
+		Assembler a{};
+		Peep p;
+		init(p, a);
+		// instruction                   // expected byte sequence
+		mov(p, rax, rax);                check(!flush(p).ip);
+		mov(p, r8w, r8w);                check(!flush(p).ip);
+		mov(p, eax, eax);                expect(flush(p), {0x89, 0xc0});
+		mov(p, rdx, rcx);
+		mov(p, rcx, rdx);                expect(flush(p), {0x89, 0xc0, 0x48, 0x89, 0xca});
+		cmp(p, rdi, 0);                  expect(flush(p), {0x48, 0x85, 0xff});
+		mov(p, rdx, rcx);
+		add(p, rdx, rax);
+		cmp(p, rdi, rsi);                expect(flush(p), {0x48, 0x8d, 0x14, 0x01, 0x48, 0x39, 0xf7});
+		mov(p, eax, ecx);
+		add(p, eax, 8);
+		jmp(p, "out");                   expect(flush(p), {0x8d, 0x41, 0x08, 0xe9, 0x00, 0x00, 0x00, 0x00});
+		mov(p, rax, rcx);
+		add(p, rax, rsp);
+		mov(p, rcx, rax);
+		add(p, rcx, rcx);
+		test(p, rax, rax);               expect(flush(p), {0x48, 0x8d, 0x04, 0x0c, 0x48, 0x8d, 0x0c, 0x00, 0x48, 0x85, 0xc0});
+		check(p.hits[PeepSelfMov] == 2 && p.hits[PeepMovBack] == 1);
+		check(p.hits[PeepZero] == 1 && p.hits[PeepFold] == 4);
+		u32 ip = a.ip;
+		mov(p, rdx, rcx);
+		add(p, rdx, rax);
+		jcc(p, E, "out");                // the flags of the add may be read
+		mov(p, rdx, rcx);
+		add(p, rdx, rax);                // nothing overwrites them
+		flush(p);
+		check(a.ip == ip + 3+3+6+3+3 && p.hits[PeepFold] == 4);
+		ip = a.ip;
+		jcc(p, NE, "out");
+		jmp(p, "out");
+		label(p, "out");
+		check(a.ip == ip && p.hits[PeepJmpNext] == 2);
+		finalize(a);
+		check(!a.err && !label_id(a, "out").sym->refs);
+		init(p, a, ~0u & ~(1 << PeepZero));
+		cmp(p, rdi, 0);                  expect(flush(p), {0x48, 0x81, 0xff, 0x00, 0x00, 0x00, 0x00});
+		clear(a);
+	}
+	{
+		using namespace arm64;
+		Assembler a{};
+		Peep p;
+		init(p, a);
+		// instruction                   // expected byte sequence
+label(p, "top");
+		mov(p, x0, x0);                  check(!flush(p).ip);
+		mov(p, w0, w0);
+		cmp(p, x3, 0);
+		b(p, NE, "top");
+		cmp(p, x4, x5);                  expect(flush(p), {0xe0, 0x03, 0x00, 0x2a, 0xe3, 0xff, 0xff, 0xb5, 0x9f, 0x00, 0x05, 0xeb});
+		mov(p, x0, x1);
+		mov(p, x1, x0);                  expect(flush(p), {0xe0, 0x03, 0x01, 0xaa});
+		mov(p, x0, x1);
+		add(p, x0, x0, x2);              expect(flush(p), {0x20, 0x00, 0x02, 0x8b});
+		mov(p, x0, x1);
+		add(p, x0, x0, x0);              expect(flush(p), {0x20, 0x00, 0x01, 0x8b});
+		mov(p, x0, x1);
+		sub(p, x0, x0, 16);              expect(flush(p), {0x20, 0x40, 0x00, 0xd1});
+		check(p.hits[PeepSelfMov] == 1 && p.hits[PeepMovBack] == 1);
+		check(p.hits[PeepZero] == 1 && p.hits[PeepFold] == 3);
+		u32 ip = a.ip;
+		cmp(p, x3, 0);
+		b(p, EQ, "top");
+		b(p, LT, "top");                 // the flags of the cmp may be read
+		cmp(p, x3, 0);
+		b(p, EQ, "top");                 // nothing overwrites them
+		flush(p);
+		check(a.ip == ip + 5*4 && p.hits[PeepZero] == 1);
+		ip = a.ip;
+		b(p, "next");
+		cbz(p, x1, label_id(a, "next"));
+label(p, "next");
+		check(a.ip == ip && p.hits[PeepJmpNext] == 2);
+		cbz(a, w3, "fwd");
+		udf(a, 0);
+label(a, "fwd");
+		expect(a, {0x43, 0x00, 0x00, 0x34, 0x00, 0x00, 0x00, 0x00});
+		finalize(a);
+		check(!a.err);
+		clear(a);
+	}
+}
+
+// Sum of n u64 at p, and a caller that keeps a value in a
+// callee saved register across the call
+template <typename T>
+static void masm_sum(masm::Masm<T> &m)
+{
+	using namespace masm;
+label(m, "sum");
+	mov(m, t0, 0UL);
+label(m, "loop");
+	br(m, EQ, a1, 0, "done");
+	load(m, t1, mem(a0));
+	add(m, t0, t0, t1);
+	add(m, a0, a0, 8);
+	sub(m, a1, a1, 1);
+	jmp(m, "loop");
+label(m, "done");
+	mov(m, rv, t0);
+	ret(m);
+label(m, "twice");
+	enter(m, 1);
+	load(m, s0, mem(a0), 32);
+	call(m, "sum");
+	shl(m, rv, rv, 1);
+	add(m, rv, rv, s0);
+	leave(m, 1);
+}
+
+void testmasm()
+{
+	using namespace masm;
+	{
+		Assembler a{};
+		Masm<Amd64> m = {&a};
+label(m, "x");
+		// instruction                    // expected byte sequence
+		sub(m, s0, a1, s0);               expect(a, {0x48, 0xf7, 0xdb, 0x48, 0x01, 0xf3});
+		sub(m, a0, a0, a1);               expect(a, {0x48, 0x29, 0xf7});
+		add(m, t0, a0, 16);               expect(a, {0x4c, 0x8d, 0x57, 0x10});
+		add(m, t0, t0, -1);               expect(a, {0x49, 0x81, 0xc2, 0xff, 0xff, 0xff, 0xff});
+		mul(m, rv, a0, a1);               expect(a, {0x48, 0x89, 0xf8, 0x48, 0x0f, 0xaf, 0xc6});
+		and_(m, t0, t1, t0);              expect(a, {0x4d, 0x21, 0xda});
+		xor_(m, t0, t1, 12345);           expect(a, {0x4d, 0x89, 0xda, 0x49, 0x81, 0xf2, 0x39, 0x30, 0x00, 0x00});
+		shr(m, a2, a2, 3);                expect(a, {0x48, 0xc1, 0xea, 0x03});
+		load(m, t1, mem(sp, 40000), 8);   expect(a, {0x44, 0x0f, 0xb6, 0x9c, 0x24, 0x40, 0x9c, 0x00, 0x00});
+		load(m, s2, mem(s3, 8), 32);      expect(a, {0x45, 0x8b, 0x6e, 0x08});
+		store(m, mem(s1, -8), a2, 32);    expect(a, {0x41, 0x89, 0x54, 0x24, 0xf8});
+		store(m, mem(a0), a1, 8);         expect(a, {0x40, 0x88, 0x37});
+		br(m, LT, a0, -5, "x");           expect(a, {0x48, 0x81, 0xff, 0xfb, 0xff, 0xff, 0xff, 0x0f, 0x8c, 0xb2, 0xff, 0xff, 0xff});
+		br(m, EQ, a0, 0, "x");            expect(a, {0x48, 0x85, 0xff, 0x0f, 0x84, 0xa9, 0xff, 0xff, 0xff});
+		br(m, HS, a0, a1, "x");           expect(a, {0x48, 0x39, 0xf7, 0x0f, 0x83, 0xa0, 0xff, 0xff, 0xff});
+		call(m, t1);                      expect(a, {0x41, 0xff, 0xd3});
+		enter(m, 1);                      expect(a, {0x55, 0x48, 0x89, 0xe5, 0x53, 0x48, 0x81, 0xec, 0x08, 0x00, 0x00, 0x00});
+		leave(m, 1);                      expect(a, {0x48, 0x81, 0xc4, 0x08, 0x00, 0x00, 0x00, 0x5b, 0x5d, 0xc3});
+		check(!a.err);
+		clear(a);
+	}
+	{
+		Assembler a{};
+		Masm<Arm64> m = {&a};
+label(m, "x");
+		// instruction                    // expected byte sequence
+		sub(m, s0, a1, s0);               expect(a, {0x33, 0x00, 0x13, 0xcb});
+		add(m, t0, a0, 16);               expect(a, {0x09, 0x40, 0x00, 0x91});
+		add(m, t0, t0, 0x12345);          expect(a, {0xb0, 0x68, 0x84, 0xd2, 0x30, 0x00, 0xa0, 0xf2, 0x29, 0x01, 0x10, 0x8b});
+		sub(m, t1, t1, 4096);             expect(a, {0x4a, 0x05, 0x40, 0xd1});
+		sub(m, t1, t1, -8);               expect(a, {0x4a, 0x21, 0x00, 0x91});
+		and_(m, t0, t0, 0xff);            expect(a, {0x29, 0x1d, 0x40, 0x92});
+		xor_(m, t0, t1, 12345);           expect(a, {0x30, 0x07, 0x86, 0xd2, 0x49, 0x01, 0x10, 0xca});
+		shl(m, t0, t1, 3);                expect(a, {0x49, 0xf1, 0x7d, 0xd3});
+		sar(m, t0, t1, 63);               expect(a, {0x49, 0xfd, 0x7f, 0x93});
+		mul(m, rv, a0, a1);               expect(a, {0x00, 0x7c, 0x01, 0x9b});
+		load(m, t1, mem(sp, 40000), 8);   expect(a, {0x10, 0x88, 0x93, 0xd2, 0xf0, 0x63, 0x30, 0x8b, 0x0a, 0x02, 0x40, 0x39});
+		load(m, s2, mem(s3, 8), 32);      expect(a, {0xd5, 0x0a, 0x40, 0xb9});
+		store(m, mem(s1, -8), a2, 32);    expect(a, {0x82, 0x82, 0x1f, 0xb8});
+		load(m, a3, mem(a4, 6), 16);      expect(a, {0x83, 0x0c, 0x40, 0x79});
+		br(m, LT, a0, -5, "x");           expect(a, {0x1f, 0x14, 0x00, 0xb1, 0x8b, 0xfd, 0xff, 0x54});
+		br(m, EQ, a0, 0, "x");            expect(a, {0x60, 0xfd, 0xff, 0xb4});
+		br(m, NE, a0, 0, "x");            expect(a, {0x40, 0xfd, 0xff, 0xb5});
+		br(m, HI, a0, 100000, "x");       expect(a, {0x10, 0xd4, 0x90, 0xd2, 0x30, 0x00, 0xa0, 0xf2, 0x1f, 0x00, 0x10, 0xeb, 0xc8, 0xfc, 0xff, 0x54});
+		br(m, HS, a0, a1, "x");           expect(a, {0x1f, 0x00, 0x01, 0xeb, 0x82, 0xfc, 0xff, 0x54});
+		call(m, t1);                      expect(a, {0x40, 0x01, 0x3f, 0xd6});
+		enter(m, 3);                      expect(a, {0xfd, 0x7b, 0xbf, 0xa9, 0xfd, 0x03, 0x00, 0x91, 0xf3, 0x53, 0xbf, 0xa9, 0xf5, 0x0f, 0x1f, 0xf8});
+		leave(m, 3);                      expect(a, {0xf5, 0x07, 0x41, 0xf8, 0xf3, 0x53, 0xc1, 0xa8, 0xfd, 0x7b, 0xc1, 0xa8, 0xc0, 0x03, 0x5f, 0xd6});
+		enter(m, SavedCount + 1);
+		check(a.err == arm64::ErrReg);
+		clear(a);
+	}
+	{
+		Assembler a{};
+		Masm<Arm64> m = {&a};
+		masm_sum(m);
+		finalize(a);
+		check(!a.err && a.ip == 4*19);
+		clear(a);
+	}
+	Assembler a{};
+	Masm<Amd64> m = {&a};
+	masm_sum(m);
+	CodeHeap h;
+	init(h, 1 << 16);
+	void *code = publish(h, a);
+	u64 (*sum)(const u64 *, u64) = (u64 (*)(const u64 *, u64))entry(a, code, "sum");
+	u64 (*twice)(const u64 *, u64) = (u64 (*)(const u64 *, u64))entry(a, code, "twice");
+	u64 v[] = {1, 2, 3, 0x100000000};
+	check(sum(v, 4) == 0x100000006 && sum(v, 0) == 0);
+	check(twice(v, 3) == 13);
+	clear(h);
+	clear(a);
+}
+
+// Sum of n u64 at p
+static void ir_sum(Ir &ir)
+{
+	Val p = val(ir), n = val(ir), s = val(ir), x = val(ir);
+	IrLabel loop = label(ir), done = label(ir);
+	arg(ir, p, 0);
+	arg(ir, n, 1);
+	mov(ir, s, 0UL);
+	bind(ir, loop);
+	br(ir, masm::EQ, n, 0, done);
+	load(ir, x, p, 0);
+	add(ir, s, s, x);
+	add(ir, p, p, 8);
+	sub(ir, n, n, 1);
+	jmp(ir, loop);
+	bind(ir, done);
+	ret(ir, s);
+}
+
+// Twice the sum plus the first u32, which lives across the call
+static void ir_twice(Ir &ir, LabelId sum)
+{
+	Val p = val(ir), n = val(ir), x = val(ir), r = val(ir);
+	arg(ir, p, 0);
+	arg(ir, n, 1);
+	load(ir, x, p, 0, 32);
+	Val args[] = {p, n};
+	call(ir, r, sum, args, 2);
+	shl(ir, r, r, 1);
+	add(ir, r, r, x);
+	ret(ir, r);
+}
+
+// More live values than registers
+static void ir_spill(Ir &ir)
+{
+	Val p = val(ir), s = val(ir), v[12];
+	arg(ir, p, 0);
+	for (u32 i = 0; i < 12; i++) {
+		v[i] = val(ir);
+		load(ir, v[i], p, 8*i);
+	}
+	mov(ir, s, 0UL);
+	for (u32 i = 0; i < 12; i++) {
+		xor_(ir, s, s, v[i]);
+		shl(ir, s, s, 1);
+	}
+	ret(ir, s);
+}
+
+// More values live than temporaries in a leaf, they go to the
+// argument registers once those are read
+static void ir_leaf(Ir &ir)
+{
+	Val a = val(ir), b = val(ir), c = val(ir), d = val(ir), x = val(ir), y = val(ir);
+	arg(ir, a, 0);
+	arg(ir, b, 1);
+	arg(ir, c, 2);
+	arg(ir, d, 3);
+	mul(ir, x, a, b);
+	sub(ir, y, c, d);
+	xor_(ir, a, a, d);
+	add(ir, x, x, y);
+	add(ir, x, x, a);
+	add(ir, x, x, b);
+	add(ir, x, x, c);
+	ret(ir, x);
+}
+
+template <typename T>
+static void ir_funcs(masm::Masm<T> &m, Ir &ir)
+{
+	clear(ir);
+	ir_sum(ir);
+	allocate(ir);
+	label(m, "sum");
+	lower(ir, m);
+	clear(ir);
+	ir_twice(ir, label_id(*m.a, "sum"));
+	allocate(ir);
+	label(m, "twice");
+	lower(ir, m);
+	clear(ir);
+	ir_spill(ir);
+	allocate(ir);
+	label(m, "spill");
+	lower(ir, m);
+	clear(ir);
+	ir_leaf(ir);
+	allocate(ir);
+	label(m, "leaf");
+	lower(ir, m);
+	clear(ir);
+}
+
+void testir()
+{
+	Ir ir{};
+	ir_sum(ir);
+	allocate(ir);
+	// p and n enter the loop, so they live until its back edge, and
+	// with no call all four fit in caller saved registers
+	check(ir.live[1].end == 9 && ir.live[2].end == 9 && ir.live[4].end == 6);
+	check(ir.nslot == 0 && ir.nsaved == 0);
+	clear(ir);
+	Assembler a{};
+	ir_twice(ir, label_id(a, "sum"));
+	allocate(ir);
+	check(ir.nslot == 0 && ir.nsaved == 1);
+	clear(ir);
+	ir_spill(ir);
+	allocate(ir);
+	check(ir.nslot > 0);
+	clear(ir);
+	ir_leaf(ir);
+	allocate(ir);
+	check(ir.nslot == 0 && ir.nsaved == 0);
+	clear(ir);
+	{
+		Assembler a{};
+		masm::Masm<masm::Arm64> m = {&a};
+		ir_funcs(m, ir);
+		finalize(a);
+		check(!a.err);
+		clear(a);
+	}
+	masm::Masm<masm::Amd64> m = {&a};
+	ir_funcs(m, ir);
+	CodeHeap h;
+	init(h, 1 << 16);
+	void *code = publish(h, a);
+	u64 (*sum)(const u64 *, u64) = (u64 (*)(const u64 *, u64))entry(a, code, "sum");
+	u64 (*twice)(const u64 *, u64) = (u64 (*)(const u64 *, u64))entry(a, code, "twice");
+	u64 (*spill)(const u64 *) = (u64 (*)(const u64 *))entry(a, code, "spill");
+	u64 (*leaf)(u64, u64, u64, u64) = (u64 (*)(u64, u64, u64, u64))entry(a, code, "leaf");
+	u64 v[12];
+	u64 s = 0;
+	for (u32 i = 0; i < 12; i++) {
+		v[i] = 0x0101010101010101*i + 0x100000001;
+		s = (s ^ v[i]) << 1;
+	}
+	check(sum(v, 3) == 3*0x100000001 + 3*0x0101010101010101 && sum(v, 0) == 0);
+	check(twice(v, 2) == 2*sum(v, 2) + 1);
+	check(spill(v) == s);
+	check(leaf(7, 9, 100, 30) == 7*9 + 70 + (7^30) + 9 + 100);
+	clear(h);
+	clear(a);
+}
+
 void testarm64()
 {
 	using namespace arm64;
@@ -156,6 +655,12 @@ label(a, "bar");
 	sdiv(a, x23, x9, x12);              expect(a, {0x37, 0x0d, 0xcc, 0x9a});
 	udiv(a, x21, x19, x2);              expect(a, {0x75, 0x0a, 0xc2, 0x9a});
 	bl(a, "foo");                       expect(a, {0xfa, 0xff, 0xff, 0x97});
+	LabelId baz = label_id(a, "baz");
+	b(a, NE, baz);
+	bl(a, baz);
+label(a, baz);
+	                                    expect(a, {0x41, 0x00, 0x00, 0x54, 0x01, 0x00, 0x00, 0x94});
+	b(a, label_id(a, "foo"));           expect(a, {0xf7, 0xff, 0xff, 0x17});
 	br(a, x23);                         expect(a, {0xe0, 0x02, 0x1f, 0xd6});
 	blr(a, x15);                        expect(a, {0xe0, 0x01, 0x3f, 0xd6});
 	adds(a, x5, x2, x17, UXTX, 4);      expect(a, {0x45, 0x70, 0x31, 0xab});
@@ -177,15 +682,936 @@ label(a, "bar");
 	orr(a, w8, w9, 0xf0f0f0f0);         expect(a, {0x28, 0xcd, 0x04, 0x32});
 	orr(a, w8, w9, 0xf0f0f0f0);         expect(a, {0x28, 0xcd, 0x04, 0x32});
 	orr(a, x8, x9, 0xcfcfcfcfcfcfcfcf); expect(a, {0x28, 0xd5, 0x02, 0xb2});
+	mul(a, x0, x1, x2);                 expect(a, {0x20, 0x7c, 0x02, 0x9b});
+	mul(a, w3, w4, w5);                 expect(a, {0x83, 0x7c, 0x05, 0x1b});
+	and_(a, x0, x1, x2);                expect(a, {0x20, 0x00, 0x02, 0x8a});
+	and_(a, w3, w4, 0xff);              expect(a, {0x83, 0x1c, 0x00, 0x12});
+	eor(a, x5, x6, x7, LSL, 3);         expect(a, {0xc5, 0x0c, 0x07, 0xca});
+	eor(a, x0, x0, 0x5555555555555555); expect(a, {0x00, 0xf0, 0x00, 0xd2});
+	lsl(a, x0, x1, 3);                  expect(a, {0x20, 0xf0, 0x7d, 0xd3});
+	lsr(a, w2, w3, 31);                 expect(a, {0x62, 0x7c, 0x1f, 0x53});
+	asr(a, x4, x5, 63);                 expect(a, {0xa4, 0xfc, 0x7f, 0x93});
+	lsl(a, w0, w0, 0);                  expect(a, {0x00, 0x7c, 0x00, 0x53});
+	clear(a);
+}
+
+// Prologue with the frame size patched in when it is emitted
+constexpr auto prologue = [] {
+	using namespace amd64;
+	Stencil<16, 1> s{};
+	emit(s, enc::push(rbp));
+	emit(s, enc::mov(rbp, rsp));
+	emit(s, enc::sub(rsp, 0));
+	hole(s, "frame", 4);
+	return s;
+}();
+
+constexpr auto addimm = [] {
+	using namespace arm64;
+	Stencil<8, 1> s{};
+	emit(s, enc::add(x0, x0, 1));
+	hole(s, "imm", 4, 10, 12);
+	emit(s, enc::ret());
+	return s;
+}();
+
+static_assert(prologue.size == 11 && prologue.code[0] == 0x55 && hole(prologue, "frame") == 0);
+static_assert(addimm.size == 8 && addimm.code[1] == 0x00 && addimm.code[3] == 0x91);
+static_assert(amd64::enc::mov(amd64::rbx, amd64::r8).lo == 0xc3894c);
+static_assert(arm64::enc::orr(arm64::x0, arm64::x1, 0xff00).v == 0xb2781c20);
+static_assert(amd64::enc::mov(amd64::rax, amd64::ptr(amd64::rsp*3)).err == amd64::ErrScale);
+
+void testmovimm()
+{
+	using namespace arm64;
+	Assembler a{};
+	// instruction                        // expected byte sequence
+	mov(a, x0, 0);                        expect(a, {0x00, 0x00, 0x80, 0xd2});
+	mov(a, x0, 0x1234);                   expect(a, {0x80, 0x46, 0x82, 0xd2});
+	mov(a, x0, 0x12340000);               expect(a, {0x80, 0x46, 0xa2, 0xd2});
+	mov(a, x0, -1UL);                     expect(a, {0x00, 0x00, 0x80, 0x92});
+	mov(a, x0, 0xffffffffffff1234);       expect(a, {0x60, 0xb9, 0x9d, 0x92});
+	mov(a, w0, 0xffff1234);               expect(a, {0x60, 0xb9, 0x9d, 0x12});
+	mov(a, w3, 0);                        expect(a, {0x03, 0x00, 0x80, 0x52});
+	mov(a, w3, 0xff00ff00);               expect(a, {0xe3, 0x9f, 0x08, 0x32});
+	mov(a, x0, 0x00ff00ff00ff00ff);       expect(a, {0xe0, 0x9f, 0x00, 0xb2});
+	mov(a, x0, 0x12345678);               expect(a, {0x00, 0xcf, 0x8a, 0xd2, 0x80, 0x46, 0xa2, 0xf2});
+	mov(a, x0, 0x123400005678);           expect(a, {0x00, 0xcf, 0x8a, 0xd2, 0x80, 0x46, 0xc2, 0xf2});
+	mov(a, x0, 0xffff1234ffff5678);       expect(a, {0xe0, 0x30, 0x95, 0x92, 0x80, 0x46, 0xc2, 0xf2});
+	mov(a, x0, 0x0f0f0f0f0f0f1234);       expect(a, {0xe0, 0xcf, 0x00, 0xb2, 0x80, 0x46, 0x82, 0xf2});
+	check(!a.err);
+	clear(a);
+	mov(a, x0, 0x123456789abcdef0);
+	ret(a);
+	pool(a);
+	                                      expect(a, {0x40, 0x00, 0x00, 0x58, 0xc0, 0x03, 0x5f, 0xd6,
+	                                                 0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12});
+	check(a.ip == 16 && !a.lits);
+	mov(a, w0, 0x100000000);              check(a.err == ErrSize);
+	clear(a);
+	mov(a, sp, 1);                        check(a.err == ErrReg);
+	clear(a);
+}
+
+void testpool()
+{
+	using namespace amd64;
+	Assembler a{};
+	u8 mask[16] = {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12};
+	u32 seven = 7;
+	LabelId c = literal(a, 0x123456789abcdef0);
+	check(literal(a, 0x123456789abcdef0).sym == c.sym);
+	mov(a, rax, ptr(a, c));
+	mov(a, ecx, ptr(a, literal(a, &seven, 4)));
+	add(a, rax, rcx);
+	ret(a);
+	vpshufb(a, xmm0, xmm0, ptr(a, literal(a, mask, 16)));
+	vpbroadcastd(a, ymm1, ptr(a, literal(a, &seven, 4)));
+	ret(a);
+	finalize(a);
+	// code, padding to 16, then the literals from the largest
+	expect(a, {0x48, 0x8b, 0x05, 0x39, 0x00, 0x00, 0x00, 0x8b, 0x0d, 0x3b, 0x00, 0x00, 0x00, 0x48, 0x01, 0xc8, 0xc3,
+	           0xc4, 0xe2, 0x79, 0x00, 0x05, 0x16, 0x00, 0x00, 0x00, 0xc4, 0xe2, 0x7d, 0x58, 0x0d, 0x25, 0x00, 0x00, 0x00, 0xc3,
+	           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	           0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c,
+	           0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12, 0x07, 0x00, 0x00, 0x00});
+	check(!a.err && a.ip == 76 && !a.lits);
+	clear(a);
+	// the displacements follow the code when relaxation moves it
+	a.flags = AsmRelax|AsmBatch;
+	test(a, rdi, rdi);
+	jcc(a, E, "zero");
+	mov(a, rax, ptr(a, literal(a, 0x123456789abcdef0)));
+	ret(a);
+label(a, "zero");
+	mov(a, eax, ptr(a, literal(a, &seven, 4)));
+	ret(a);
+	CodeHeap h;
+	init(h, 1 << 16);
+	u64 (*f)(u64) = (u64 (*)(u64))publish(h, a);
+	check(f && f(1) == 0x123456789abcdef0 && f(0) == 7);
+	clear(h);
+	clear(a);
+	{
+		Assembler a{};
+		arm64::mov(a, arm64::x0, 0x123456789abcdef0);
+		arm64::mov(a, arm64::x1, 0x123456789abcdef0);
+		arm64::ldr(a, arm64::q0, literal(a, mask, 16));
+		arm64::ret(a);
+		finalize(a);
+		expect(a, {0x00, 0x01, 0x00, 0x58, 0xe1, 0x00, 0x00, 0x58, 0x40, 0x00, 0x00, 0x9c, 0xc0, 0x03, 0x5f, 0xd6,
+		           0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c,
+		           0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12});
+		check(!a.err && a.ip == 40);
+		clear(a);
+		// an island with a branch around it at the first branch after
+		// which the literal could go out of the reach of its load
+		arm64::mov(a, arm64::x0, 0x123456789abcdef0);
+		for (u32 i = 0; i < (1 << 18); i++)
+			arm64::b(a, "end");
+label(a, "end");
+		arm64::ret(a);
+		finalize(a);
+		u32 island = (1 << 20) - 64 - 8 - (1 << 16);
+		check(!a.err && a.ip == 4 + (1 << 18)*4 + 4 + 16);
+		expect(a, {0x01, 0x00, 0x00, 0x14, 0xc0, 0x03, 0x5f, 0xd6});
+		check(!memcmp(a.code + island, "\x04\x00\x00\x14\x00\x00\x00\x00\xf0\xde\xbc\x9a\x78\x56\x34\x12", 16));
+		clear(a);
+		// blocks of 100 instructions, each loading its own constant,
+		// over 3MB: every load reaches its literal in some island
+		u32 loads[8000];
+		for (u32 k = 0; k < 8000; k++) {
+			loads[k] = a.ip;
+			arm64::mov(a, arm64::x0, 0x1234567890ab0000 | (k + 1));
+			for (u32 i = 0; i < 98; i++)
+				arm64::nop(a);
+			LabelId next = new_label(a);
+			arm64::b(a, next);
+			label(a, next);
+		}
+		arm64::ret(a);
+		pool(a);
+		finalize(a);
+		check(!a.err && a.ip > 3*(1 << 20));
+		for (u32 k = 0; k < 8000; k++) {
+			u32 ldr, off;
+			u64 v;
+			memcpy(&ldr, a.code + loads[k], 4);
+			check((ldr & 0xff00001f) == 0x58000000);
+			off = loads[k] + ((s32)(ldr << 8) >> 13)*4;
+			memcpy(&v, a.code + off, 8);
+			check(v == (0x1234567890ab0000 | (k + 1)));
+		}
+		clear(a);
+		// straight code out of the reach needs island by hand
+		for (int by_hand = 0; by_hand < 2; by_hand++) {
+			arm64::mov(a, arm64::x0, 0x123456789abcdef0);
+			for (u32 i = 0; i < (1 << 18); i++) {
+				arm64::nop(a);
+				if (by_hand && i % 1024 == 0)
+					arm64::island(a, 4096);
+			}
+			arm64::ret(a);
+			finalize(a);
+			check(a.err == (by_hand ? 0 : ErrOverflow));
+			clear(a);
+		}
+	}
+}
+
+static u64 triple(u64 x) { return 3*x; }
+
+void testrip()
+{
+	using namespace amd64;
+	Assembler a{};
+	mov(a, rax, ptr(a, "data"));
+	mov(a, ptr(a, "data", 8), rsi);
+	lea(a, rcx, ptr(a, "data", -4));
+	cmov(a, E, rdx, ptr(a, "data"));
+	xchg(a, rbx, ptr(a, "data"));
+	vpshufd(a, xmm0, ptr(a, "data"), 0x1b); // imm8 after the disp32
+	jmp(a, ptr(a, "data"));
+	call(a, ptr(a, "data"));
+label(a, "data");
+	expect(a, {0x48, 0x8b, 0x05, 0x32, 0x00, 0x00, 0x00, 0x48, 0x89, 0x35, 0x33, 0x00, 0x00, 0x00,
+	           0x48, 0x8d, 0x0d, 0x20, 0x00, 0x00, 0x00, 0x48, 0x0f, 0x44, 0x15, 0x1c, 0x00, 0x00, 0x00,
+	           0x48, 0x87, 0x1d, 0x15, 0x00, 0x00, 0x00, 0xc5, 0xf9, 0x70, 0x05, 0x0c, 0x00, 0x00, 0x00, 0x1b,
+	           0xff, 0x25, 0x06, 0x00, 0x00, 0x00, 0xff, 0x15, 0x00, 0x00, 0x00, 0x00});
+	check(!a.err);
+	// one label_num for each label and offset, however often used
+	u32 n = a.numcnt;
+	for (u32 i = 0; i < 1000; i++)
+		mov(a, rax, ptr(a, "data", 8*(i % 4)));
+	check(!a.err && a.numcnt == n + 2);
+	Ptr p = ptr(a, "data");
+	p.base = rax;
+	mov(a, rcx, p);                       expect(a, {0x0f, 0x0b});
+	check(a.err == ErrReg);
+	clear(a);
+	// a jump table of offsets from its start, with the relaxed
+	// branches of the cases in between
+	a.flags = AsmRelax|AsmBatch;
+	lea(a, rax, ptr(a, "table"));
+	mov(a, ecx, ptr(rax, rdi*4));
+	add(a, rax, rcx);
+	jmp(a, rax);
+label(a, "table", 4);
+	u32 table = a.ip;
+	const char *cases[] = {"c0", "c1", "c2"};
+	for (const char *c : cases) {
+		label_ref(a, c, a.ip, table, 1, 32, 0);
+		push_bytes(a, 0, 4);
+	}
+	for (u32 i = 0; i < 3; i++) {
+		label(a, cases[i]);
+		mov(a, eax, 10*i + 7);
+		jmp(a, "out");
+	}
+label(a, "out");
+	ret(a);
+	// calls and tail calls through a pointer in the pool
+label(a, "call");
+	push(a, rbx);
+	call(a, ptr(a, literal(a, (u64)triple)));
+	pop(a, rbx);
+	ret(a);
+label(a, "tail");
+	jmp(a, ptr(a, literal(a, (u64)triple)));
+	CodeHeap h;
+	init(h, 1 << 16);
+	void *code = publish(h, a);
+	u64 (*f)(u64) = (u64 (*)(u64))code;
+	check(f && f(0) == 7 && f(1) == 17 && f(2) == 27);
+	f = (u64 (*)(u64))entry(a, code, "call");
+	check(f && f(5) == 15);
+	f = (u64 (*)(u64))entry(a, code, "tail");
+	check(f && f(7) == 21);
+	clear(h);
+	clear(a);
+}
+
+void testneon()
+{
+	using namespace arm64;
+	Assembler a{};
+	// instruction                         // expected byte sequence
+	add(a, v4s(v0), v4s(v1), v4s(v2));     expect(a, {0x20, 0x84, 0xa2, 0x4e});
+	add(a, v2d(v31), v2d(v30), v2d(v29));  expect(a, {0xdf, 0x87, 0xfd, 0x4e});
+	sub(a, v8b(v3), v8b(v4), v8b(v5));     expect(a, {0x83, 0x84, 0x25, 0x2e});
+	mul(a, v8h(v1), v8h(v2), v8h(v3));     expect(a, {0x41, 0x9c, 0x63, 0x4e});
+	smax(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0x64, 0xa3, 0x4e});
+	smin(a, v2s(v1), v2s(v2), v2s(v3));    expect(a, {0x41, 0x6c, 0xa3, 0x0e});
+	umax(a, v16b(v1), v16b(v2), v16b(v3)); expect(a, {0x41, 0x64, 0x23, 0x6e});
+	umin(a, v4h(v1), v4h(v2), v4h(v3));    expect(a, {0x41, 0x6c, 0x63, 0x2e});
+	cmeq(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0x8c, 0xa3, 0x6e});
+	cmgt(a, v2d(v1), v2d(v2), v2d(v3));    expect(a, {0x41, 0x34, 0xe3, 0x4e});
+	cmge(a, v16b(v1), v16b(v2), v16b(v3)); expect(a, {0x41, 0x3c, 0x23, 0x4e});
+	cmhi(a, v8h(v1), v8h(v2), v8h(v3));    expect(a, {0x41, 0x34, 0x63, 0x6e});
+	cmhs(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0x3c, 0xa3, 0x6e});
+	and_(a, v16b(v1), v16b(v2), v16b(v3)); expect(a, {0x41, 0x1c, 0x23, 0x4e});
+	bic(a, v8b(v1), v8b(v2), v8b(v3));     expect(a, {0x41, 0x1c, 0x63, 0x0e});
+	orr(a, v16b(v1), v16b(v2), v16b(v3));  expect(a, {0x41, 0x1c, 0xa3, 0x4e});
+	orn(a, v16b(v1), v16b(v2), v16b(v3));  expect(a, {0x41, 0x1c, 0xe3, 0x4e});
+	eor(a, v16b(v1), v16b(v2), v16b(v3));  expect(a, {0x41, 0x1c, 0x23, 0x6e});
+	bsl(a, v16b(v1), v16b(v2), v16b(v3));  expect(a, {0x41, 0x1c, 0x63, 0x6e});
+	bit(a, v16b(v1), v16b(v2), v16b(v3));  expect(a, {0x41, 0x1c, 0xa3, 0x6e});
+	bif(a, v16b(v1), v16b(v2), v16b(v3));  expect(a, {0x41, 0x1c, 0xe3, 0x6e});
+	mov(a, v16b(v7), v16b(v20));           expect(a, {0x87, 0x1e, 0xb4, 0x4e});
+	cnt(a, v16b(v1), v16b(v2));            expect(a, {0x41, 0x58, 0x20, 0x4e});
+	mvn(a, v8b(v1), v8b(v2));              expect(a, {0x41, 0x58, 0x20, 0x2e});
+	abs(a, v4s(v1), v4s(v2));              expect(a, {0x41, 0xb8, 0xa0, 0x4e});
+	neg(a, v2d(v1), v2d(v2));              expect(a, {0x41, 0xb8, 0xe0, 0x6e});
+	addv(a, s0, v4s(v1));                  expect(a, {0x20, 0xb8, 0xb1, 0x4e});
+	addv(a, b0, v16b(v1));                 expect(a, {0x20, 0xb8, 0x31, 0x4e});
+	addv(a, h3, v4h(v9));                  expect(a, {0x23, 0xb9, 0x71, 0x0e});
+	smaxv(a, s0, v4s(v1));                 expect(a, {0x20, 0xa8, 0xb0, 0x4e});
+	sminv(a, h0, v8h(v1));                 expect(a, {0x20, 0xa8, 0x71, 0x4e});
+	umaxv(a, b0, v8b(v1));                 expect(a, {0x20, 0xa8, 0x30, 0x2e});
+	uminv(a, s0, v4s(v1));                 expect(a, {0x20, 0xa8, 0xb1, 0x6e});
+	uzp1(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0x18, 0x83, 0x4e});
+	uzp2(a, v8b(v1), v8b(v2), v8b(v3));    expect(a, {0x41, 0x58, 0x03, 0x0e});
+	trn1(a, v8h(v1), v8h(v2), v8h(v3));    expect(a, {0x41, 0x28, 0x43, 0x4e});
+	trn2(a, v2d(v1), v2d(v2), v2d(v3));    expect(a, {0x41, 0x68, 0xc3, 0x4e});
+	zip1(a, v16b(v1), v16b(v2), v16b(v3)); expect(a, {0x41, 0x38, 0x03, 0x4e});
+	zip2(a, v2s(v1), v2s(v2), v2s(v3));    expect(a, {0x41, 0x78, 0x83, 0x0e});
+	tbl(a, v16b(v0), v1, 1, v16b(v2));     expect(a, {0x20, 0x00, 0x02, 0x4e});
+	tbl(a, v8b(v0), v30, 3, v8b(v2));      expect(a, {0xc0, 0x43, 0x02, 0x0e});
+	tbx(a, v16b(v0), v4, 4, v16b(v9));     expect(a, {0x80, 0x70, 0x09, 0x4e});
+	dup(a, v4s(v0), w1);                   expect(a, {0x20, 0x0c, 0x04, 0x4e});
+	dup(a, v2d(v0), x1);                   expect(a, {0x20, 0x0c, 0x08, 0x4e});
+	dup(a, v16b(v0), w9);                  expect(a, {0x20, 0x0d, 0x01, 0x4e});
+	dup(a, v4s(v0), v4s(v1), 3);           expect(a, {0x20, 0x04, 0x1c, 0x4e});
+	dup(a, v8h(v0), v8h(v1), 5);           expect(a, {0x20, 0x04, 0x16, 0x4e});
+	ins(a, v4s(v2), 1, w3);                expect(a, {0x62, 0x1c, 0x0c, 0x4e});
+	ins(a, d2, 1, x3);                     expect(a, {0x62, 0x1c, 0x18, 0x4e});
+	umov(a, w0, s1, 2);                    expect(a, {0x20, 0x3c, 0x14, 0x0e});
+	umov(a, x0, d1, 1);                    expect(a, {0x20, 0x3c, 0x18, 0x4e});
+	umov(a, w0, b1, 15);                   expect(a, {0x20, 0x3c, 0x1f, 0x0e});
+	fadd(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0xd4, 0x23, 0x4e});
+	fadd(a, v2d(v1), v2d(v2), v2d(v3));    expect(a, {0x41, 0xd4, 0x63, 0x4e});
+	fadd(a, s1, s2, s3);                   expect(a, {0x41, 0x28, 0x23, 0x1e});
+	fadd(a, d1, d2, d3);                   expect(a, {0x41, 0x28, 0x63, 0x1e});
+	fsub(a, v2s(v1), v2s(v2), v2s(v3));    expect(a, {0x41, 0xd4, 0xa3, 0x0e});
+	fsub(a, d1, d2, d3);                   expect(a, {0x41, 0x38, 0x63, 0x1e});
+	fmul(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0xdc, 0x23, 0x6e});
+	fmul(a, s1, s2, s3);                   expect(a, {0x41, 0x08, 0x23, 0x1e});
+	fdiv(a, v2d(v1), v2d(v2), v2d(v3));    expect(a, {0x41, 0xfc, 0x63, 0x6e});
+	fdiv(a, d1, d2, d3);                   expect(a, {0x41, 0x18, 0x63, 0x1e});
+	fmax(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0xf4, 0x23, 0x4e});
+	fmax(a, s1, s2, s3);                   expect(a, {0x41, 0x48, 0x23, 0x1e});
+	fmin(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0xf4, 0xa3, 0x4e});
+	fmin(a, d1, d2, d3);                   expect(a, {0x41, 0x58, 0x63, 0x1e});
+	fmla(a, v4s(v1), v4s(v2), v4s(v3));    expect(a, {0x41, 0xcc, 0x23, 0x4e});
+	fcmeq(a, v4s(v1), v4s(v2), v4s(v3));   expect(a, {0x41, 0xe4, 0x23, 0x4e});
+	fcmge(a, v2d(v1), v2d(v2), v2d(v3));   expect(a, {0x41, 0xe4, 0x63, 0x6e});
+	fcmgt(a, v4s(v1), v4s(v2), v4s(v3));   expect(a, {0x41, 0xe4, 0xa3, 0x6e});
+	fabs(a, v4s(v1), v4s(v2));             expect(a, {0x41, 0xf8, 0xa0, 0x4e});
+	fabs(a, d1, d2);                       expect(a, {0x41, 0xc0, 0x60, 0x1e});
+	fneg(a, v2d(v1), v2d(v2));             expect(a, {0x41, 0xf8, 0xe0, 0x6e});
+	fneg(a, s1, s2);                       expect(a, {0x41, 0x40, 0x21, 0x1e});
+	fsqrt(a, v4s(v1), v4s(v2));            expect(a, {0x41, 0xf8, 0xa1, 0x6e});
+	fsqrt(a, d1, d2);                      expect(a, {0x41, 0xc0, 0x61, 0x1e});
+	fmov(a, s1, s2);                       expect(a, {0x41, 0x40, 0x20, 0x1e});
+	fmov(a, d1, x2);                       expect(a, {0x41, 0x00, 0x67, 0x9e});
+	fmov(a, s1, w2);                       expect(a, {0x41, 0x00, 0x27, 0x1e});
+	fmov(a, x1, d2);                       expect(a, {0x41, 0x00, 0x66, 0x9e});
+	fmov(a, w1, s2);                       expect(a, {0x41, 0x00, 0x26, 0x1e});
+	fcvt(a, d1, s2);                       expect(a, {0x41, 0xc0, 0x22, 0x1e});
+	fcvt(a, s1, d2);                       expect(a, {0x41, 0x40, 0x62, 0x1e});
+	fcmp(a, d1, d2);                       expect(a, {0x20, 0x20, 0x62, 0x1e});
+	fcmp(a, s1, s2);                       expect(a, {0x20, 0x20, 0x22, 0x1e});
+	scvtf(a, d1, x2);                      expect(a, {0x41, 0x00, 0x62, 0x9e});
+	scvtf(a, s1, w2);                      expect(a, {0x41, 0x00, 0x22, 0x1e});
+	ucvtf(a, d1, w2);                      expect(a, {0x41, 0x00, 0x63, 0x1e});
+	fcvtzs(a, x1, d2);                     expect(a, {0x41, 0x00, 0x78, 0x9e});
+	fcvtzu(a, w1, s2);                     expect(a, {0x41, 0x00, 0x39, 0x1e});
+	check(!a.err);
+	add(a, v4s(v0), v4s(v1), v2d(v2));     check(a.err == ErrSize);
+	clear(a);
+	add(a, v1d(v0), v1d(v1), v1d(v2));     check(a.err == ErrSize);
+	clear(a);
+	mul(a, v2d(v0), v2d(v1), v2d(v2));     check(a.err == ErrSize);
+	clear(a);
+	eor(a, v4s(v0), v4s(v1), v4s(v2));     check(a.err == ErrSize);
+	clear(a);
+	addv(a, d0, v2d(v1));                  check(a.err == ErrSize);
+	clear(a);
+	tbl(a, v16b(v0), v1, 5, v16b(v2));     check(a.err == ErrReg);
+	clear(a);
+	dup(a, v4s(v0), x1);                   check(a.err == ErrSize);
+	clear(a);
+	fmla(a, s0, s1, s2);                   check(a.err == ErrSize);
+	clear(a);
+	fmov(a, d1, w2);                       check(a.err == ErrSize);
+	clear(a);
+}
+
+
+void testldst()
+{
+	using namespace arm64;
+	Assembler a{};
+	// instruction                           // expected byte sequence
+	ldr(a, x0, ptr(x1));                     expect(a, {0x20, 0x00, 0x40, 0xf9});
+	ldr(a, x0, ptr(sp, 32760));              expect(a, {0xe0, 0xff, 0x7f, 0xf9});
+	ldr(a, w0, ptr(x1, 16380));              expect(a, {0x20, 0xfc, 0x7f, 0xb9});
+	ldr(a, x0, ptr(x1, -8));                 expect(a, {0x20, 0x80, 0x5f, 0xf8});
+	ldr(a, x0, ptr(x1, 3));                  expect(a, {0x20, 0x30, 0x40, 0xf8});
+	str(a, x0, ptr(x1, 255));                expect(a, {0x20, 0xf0, 0x0f, 0xf8});
+	str(a, w5, ptr(x6, 4));                  expect(a, {0xc5, 0x04, 0x00, 0xb9});
+	str(a, x0, pre(sp, -16));                expect(a, {0xe0, 0x0f, 0x1f, 0xf8});
+	ldr(a, x0, post(sp, 16));                expect(a, {0xe0, 0x07, 0x41, 0xf8});
+	ldr(a, x0, ptr(x1, x2));                 expect(a, {0x20, 0x68, 0x62, 0xf8});
+	ldr(a, x0, ptr(x1, x2, LSL, 3));         expect(a, {0x20, 0x78, 0x62, 0xf8});
+	ldr(a, w0, ptr(x1, w2, SXTW, 2));        expect(a, {0x20, 0xd8, 0x62, 0xb8});
+	str(a, x0, ptr(x1, w2, UXTW));           expect(a, {0x20, 0x48, 0x22, 0xf8});
+	ldrb(a, w0, ptr(x1, 4095));              expect(a, {0x20, 0xfc, 0x7f, 0x39});
+	strb(a, w0, post(x1, 1));                expect(a, {0x20, 0x14, 0x00, 0x38});
+	ldrh(a, w0, ptr(x1, 2));                 expect(a, {0x20, 0x04, 0x40, 0x79});
+	strh(a, w0, ptr(x1, x2, LSL, 1));        expect(a, {0x20, 0x78, 0x22, 0x78});
+	ldrsb(a, x0, ptr(x1));                   expect(a, {0x20, 0x00, 0x80, 0x39});
+	ldrsb(a, w0, ptr(x1));                   expect(a, {0x20, 0x00, 0xc0, 0x39});
+	ldrsh(a, x0, ptr(x1, 6));                expect(a, {0x20, 0x0c, 0x80, 0x79});
+	ldrsw(a, x0, ptr(x1, 8));                expect(a, {0x20, 0x08, 0x80, 0xb9});
+	ldrsw(a, x0, ptr(x1, x2, SXTX, 2));      expect(a, {0x20, 0xf8, 0xa2, 0xb8});
+	ldr(a, q0, ptr(x1, 32));                 expect(a, {0x20, 0x08, 0xc0, 0x3d});
+	ldr(a, v4s(v0), ptr(x1, 16));            expect(a, {0x20, 0x04, 0xc0, 0x3d});
+	ldr(a, d0, ptr(x1, 8));                  expect(a, {0x20, 0x04, 0x40, 0xfd});
+	ldr(a, v8b(v2), ptr(x1, 8));             expect(a, {0x22, 0x04, 0x40, 0xfd});
+	ldr(a, s0, ptr(x1, -4));                 expect(a, {0x20, 0xc0, 0x5f, 0xbc});
+	ldr(a, h0, ptr(x1, 2));                  expect(a, {0x20, 0x04, 0x40, 0x7d});
+	ldr(a, b0, ptr(x1, 1));                  expect(a, {0x20, 0x04, 0x40, 0x3d});
+	str(a, q31, pre(x0, 32));                expect(a, {0x1f, 0x0c, 0x82, 0x3c});
+	str(a, d1, ptr(x0, x1, LSL, 3));         expect(a, {0x01, 0x78, 0x21, 0xfc});
+	prfm(a, PLDL1KEEP, ptr(x0, 64));         expect(a, {0x00, 0x20, 0x80, 0xf9});
+	prfm(a, PSTL2STRM, ptr(x0, x1, LSL, 3)); expect(a, {0x13, 0x78, 0xa1, 0xf8});
+	prfm(a, PLDL1STRM, ptr(x0, -8));         expect(a, {0x01, 0x80, 0x9f, 0xf8});
+	stp(a, fp, lr, pre(sp, -16));            expect(a, {0xfd, 0x7b, 0xbf, 0xa9});
+	ldp(a, fp, lr, post(sp, 16));            expect(a, {0xfd, 0x7b, 0xc1, 0xa8});
+	stp(a, x19, x20, ptr(sp, 16));           expect(a, {0xf3, 0x53, 0x01, 0xa9});
+	ldp(a, w0, w1, ptr(x2, -256));           expect(a, {0x40, 0x04, 0x60, 0x29});
+	ldp(a, q0, q1, ptr(x1, 32));             expect(a, {0x20, 0x04, 0x41, 0xad});
+	stp(a, q0, q1, post(x0, 32));            expect(a, {0x00, 0x04, 0x81, 0xac});
+	stp(a, d8, d9, ptr(sp, 504));            expect(a, {0xe8, 0xa7, 0x1f, 0x6d});
+	ldp(a, s0, s1, pre(x3, 4));              expect(a, {0x60, 0x84, 0xc0, 0x2d});
+label(a, "lit");
+	ldr(a, x3, "lit");                       expect(a, {0x03, 0x00, 0x00, 0x58});
+	ldr(a, q1, "lit");                       expect(a, {0xe1, 0xff, 0xff, 0x9c});
+	ldrsw(a, x2, "lit");                     expect(a, {0xc2, 0xff, 0xff, 0x98});
+	prfm(a, PLDL1KEEP, "lit");               expect(a, {0xa0, 0xff, 0xff, 0xd8});
+	ldr(a, d0, "next");
+	ldr(a, w1, "next");
+label(a, "next");
+	                                         expect(a, {0x40, 0x00, 0x00, 0x5c, 0x21, 0x00, 0x00, 0x18});
+	check(!a.err);
+	ldr(a, x0, ptr(x1, 32768));              check(a.err == ErrSize);
+	clear(a);
+	ldr(a, x0, ptr(x1, -257));               check(a.err == ErrSize);
+	clear(a);
+	ldr(a, x0, pre(x1, 256));                check(a.err == ErrSize);
+	clear(a);
+	ldr(a, x0, ptr(xzr));                    check(a.err == ErrReg);
+	clear(a);
+	ldr(a, x0, ptr(w1));                     check(a.err == ErrReg);
+	clear(a);
+	ldr(a, x1, post(x1, 8));                 check(a.err == ErrReg);
+	clear(a);
+	ldr(a, x0, ptr(x1, x2, LSL, 2));         check(a.err == ErrSize);
+	clear(a);
+	ldr(a, x0, ptr(x1, x2, LSR));            check(a.err == ErrReg);
+	clear(a);
+	ldr(a, x0, ptr(x1, w2, UXTX));           check(a.err == ErrReg);
+	clear(a);
+	ldrb(a, x0, ptr(x1));                    check(a.err == ErrSize);
+	clear(a);
+	ldp(a, x0, x0, ptr(x1));                 check(a.err == ErrReg);
+	clear(a);
+	ldp(a, x0, x1, ptr(x2, 4));              check(a.err == ErrSize);
+	clear(a);
+	stp(a, x0, x1, ptr(x2, 512));            check(a.err == ErrSize);
+	clear(a);
+	ldp(a, h0, h1, ptr(x2));                 check(a.err == ErrSize);
+	clear(a);
+}
+
+
+void teststencil()
+{
+	Assembler a{};
+	Fill frame = {0x1234}, imm = {42};
+	push_stencil(a, prologue, &frame);  expect(a, {0x55, 0x48, 0x89, 0xe5, 0x48, 0x81, 0xec, 0x34, 0x12, 0x00, 0x00});
+	push_stencil(a, addimm, &imm);      expect(a, {0x00, 0xa8, 0x00, 0x91, 0xc0, 0x03, 0x5f, 0xd6});
+	check(a.ip == 19 && !a.err);
+	clear(a);
+}
+
+enum { OpConst, OpAdd, OpJnz, OpRet, OpCount };
+
+constexpr auto opconst = [] {
+	using namespace amd64;
+	Stencil<16, 1> s{};
+	emit(s, enc::mov(rax, 0UL));
+	hole(s, "v", 8);
+	return s;
+}();
+
+constexpr auto opadd = [] {
+	using namespace amd64;
+	Stencil<4, 0> s{};
+	emit(s, enc::add(rcx, rax));
+	return s;
+}();
+
+constexpr auto opjnz = [] {
+	using namespace amd64;
+	Stencil<8, 1> s{};
+	emit(s, enc::jcc(NE, 0));
+	hole(s, "target", HoleRel32);
+	return s;
+}();
+
+void testlib()
+{
+	using namespace amd64;
+	StencilLib l;
+	init(l, OpCount);
+	add(l, OpConst, opconst);
+	add(l, OpAdd, opadd);
+	add(l, OpJnz, opjnz);
+	Stencil<1, 0> r{};
+	emit(r, enc::ret()); // built at run time
+	add(l, OpRet, r);
+	u32 flags[] = {0, AsmBatch};
+	for (u32 i = 0; i < 2; i++) {
+		Assembler a{}, b{};
+		a.flags = b.flags = flags[i];
+		LabelId top = new_label(a), out = new_label(a);
+		Fill f[] = {{5}}, t[1], o[1];
+		t[0].l = top;
+		o[0].l = out;
+		push_stencil(a, l, OpJnz, o);
+	label(a, top);
+		push_stencil(a, l, OpConst, f);
+		push_stencil(a, l, OpAdd, 0);
+		push_stencil(a, l, OpJnz, t);
+	label(a, out);
+		push_stencil(a, l, OpRet, 0);
+		finalize(a);
+		jcc(b, NE, "out");
+	label(b, "top");
+		mov(b, rax, 5UL);
+		add(b, rcx, rax);
+		jcc(b, NE, "top");
+	label(b, "out");
+		ret(b);
+		finalize(b);
+		check(!a.err && a.ip == b.ip && !memcmp(a.code, b.code, a.ip));
+		clear(a);
+		clear(b);
+	}
+	clear(l);
+}
+
+void testanon()
+{
+	Assembler a{};
+	LabelId l1 = new_label(a), l2 = new_label(a);
+label(a, l1);
+	amd64::jcc(a, amd64::NE, l2);
+	amd64::jmp(a, l1);
+label(a, l2);
+	expect(a, {0x0f, 0x85, 0x05, 0x00, 0x00, 0x00, 0xe9, 0xf5, 0xff, 0xff, 0xff});
+	check(l1.sym != l2.sym && !lookup(a, "") && a.symcnt == 0);
+	rewind(a);
+	l1 = new_label(a), l2 = new_label(a);
+label(a, l1);
+	arm64::b(a, arm64::EQ, l2);
+	arm64::bl(a, l1);
+label(a, l2);
+	expect(a, {0x40, 0x00, 0x00, 0x54, 0xff, 0xff, 0xff, 0x97});
+	label(a, l2);
+	check(a.err == ErrDupLabel);
+	clear(a);
+}
+
+void testrelax()
+{
+	using namespace amd64;
+	Assembler a{};
+	a.flags = AsmRelax;
+label(a, "top");
+	jcc(a, E, "out");
+	nop(a);
+	jmp(a, "top");
+	call(a, "out");
+label(a, "out");
+	ret(a);
+	finalize(a);
+	expect(a, {0x74, 0x08, 0x90, 0xeb, 0xfb, 0xe8, 0x00, 0x00, 0x00, 0x00, 0xc3});
+	check(a.ip == 11);
+	clear(a);
+	// the first branch only fits once the second one is shortened
+	a.flags = AsmRelax;
+label(a, "start");
+	jcc(a, E, "end");
+	jcc(a, NE, "end");
+	for (int i = 0; i < 125; i++)
+		nop(a);
+label(a, "end");
+	jmp(a, "start");
+	finalize(a);
+	check(a.ip == 134);
+	check(a.code[0] == 0x74 && a.code[1] == 0x7f && a.code[2] == 0x75 && a.code[3] == 0x7d);
+	expect(a, {0xe9, 0x7a, 0xff, 0xff, 0xff});
+	clear(a);
+}
+
+void testalign()
+{
+	using namespace amd64;
+	Assembler a{};
+	// instruction                      // expected byte sequence
+	nop(a, 2);                          expect(a, {0x66, 0x90});
+	nop(a, 5);                          expect(a, {0x0f, 0x1f, 0x44, 0x00, 0x00});
+	nop(a, 9);                          expect(a, {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00});
+	align(a, 32);                       expect(a, {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00});
+	align(a, 32);
+	ret(a);
+label(a, "l", 8);                       expect(a, {0xc3, 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00});
+	check(a.ip == 40 && lookup(a, "l")->addr == 40);
+	nop(a, 10);
+	check(a.err == ErrSize);
+	a.err = 0;
+	align(a, 3);
+	check(a.err == ErrAlign);
+	clear(a);
+	// the padding grows back when the branch before it is shortened,
+	// and the call that ends where it starts keeps its displacement
+	a.flags = AsmRelax;
+label(a, "top");
+	jcc(a, E, "loop");
+	call(a, "top");
+label(a, "loop", 16);
+	jmp(a, "loop");
+	jmp(a, "top");
+	finalize(a);
+	check(!a.err && a.ip == 20 && lookup(a, "loop")->addr == 16);
+	expect(a, {0x74, 0x0e, 0xe8, 0xf9, 0xff, 0xff, 0xff, 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00, 0xeb, 0xfe, 0xeb, 0xec});
+	CodeHeap h;
+	init(h, 1 << 16);
+	check(!((u64)publish(h, a) & 63) && !((u64)publish(h, a) & 63));
+	clear(h);
+	clear(a);
+	arm64::nop(a);                      expect(a, {0x1f, 0x20, 0x03, 0xd5});
+	arm64::align(a, 16, true);          expect(a, {0x1f, 0x20, 0x03, 0xd5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+	arm64::ret(a);
+	arm64::label(a, "f", 32);           expect(a, {0xc0, 0x03, 0x5f, 0xd6, 0x1f, 0x20, 0x03, 0xd5, 0x1f, 0x20, 0x03, 0xd5, 0x1f, 0x20, 0x03, 0xd5});
+	check(a.ip == 32 && lookup(a, "f")->addr == 32);
+	clear(a);
+}
+
+void testbatch()
+{
+	Assembler a{};
+	a.flags = AsmBatch;
+label(a, "top");
+	amd64::jcc(a, amd64::E, "out");
+	amd64::call(a, "top");
+	amd64::jmp(a, "nowhere");
+label(a, "out");
+	finalize(a);
+	check(lookup(a, "nowhere")->refs);
+	amd64::nop(a);
+label(a, "nowhere");
+	expect(a, {0x0f, 0x84, 0x0a, 0x00, 0x00, 0x00, 0xe8, 0xf5, 0xff, 0xff, 0xff, 0xe9, 0x01, 0x00, 0x00, 0x00, 0x90});
+	rewind(a);
+label(a, "top");
+	arm64::b(a, arm64::NE, "out");
+	arm64::bl(a, "top");
+	arm64::b(a, "out");
+label(a, "out");
+	finalize(a);
+	expect(a, {0x61, 0x00, 0x00, 0x54, 0xff, 0xff, 0xff, 0x97, 0x01, 0x00, 0x00, 0x14});
+	rewind(a);
+	a.flags = AsmBatch|AsmRelax;
+label(a, "top");
+	amd64::jcc(a, amd64::E, "out");
+	amd64::nop(a);
+	amd64::jmp(a, "top");
+	amd64::call(a, "out");
+label(a, "out");
+	amd64::ret(a);
+	finalize(a);
+	expect(a, {0x74, 0x08, 0x90, 0xeb, 0xfb, 0xe8, 0x00, 0x00, 0x00, 0x00, 0xc3});
+	clear(a);
+}
+
+void testrewind()
+{
+	using namespace amd64;
+	Assembler a{};
+	a.flags = AsmRelax;
+label(a, "l");
+	jmp(a, "l");
+	finalize(a);
+	u8 *code = a.code;
+	Page *page = a.tmp.p;
+	rewind(a);
+	check(!a.ip && !a.syms && a.code == code && a.flags == AsmRelax);
+label(a, "l");
+	jmp(a, "l");
+	finalize(a);
+	check(!a.err && a.tmp.p == page);
+	expect(a, {0xeb, 0xfe});
+	// relaxing shortens the code, rewind still releases what the
+	// long form touched
+	rewind(a);
+	a.keep = 4096;
+	for (u32 i = 0; i < 2000; i++) {
+		LabelId l = new_label(a);
+		jmp(a, l);
+		label(a, l);
+	}
+	finalize(a);
+	check(!a.err && a.ip == 4000 && a.top == 10000);
+	rewind(a);
+	check(!a.ip && !a.top && a.keep == 4096);
+	clear(a);
+}
+
+void testbacking()
+{
+	using namespace amd64;
+	Assembler a{};
+	u8 buf[12];
+	init(a, buf, sizeof(buf));
+	mov(a, r9, 123);                    expect(a, {0x49, 0xb9, 0x7b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+	check(a.code == buf && !a.err);
+	ret(a);
+	ret(a);
+	check(a.ip == 12 && !a.err);
+	ret(a);
+	check(a.ip == 12 && a.err == ErrOverflow);
+	rewind(a);
+	ret(a);
+	check(a.code == buf && a.ip == 1 && !a.err);
+	clear(a);
+	ret(a);
+	check(a.backing == BackFixed && a.code == buf && a.cap == sizeof(buf) && a.ip == 1);
+	clear(a);
+	init(a, 100);
+	check(a.cap == 4096);
+label(a, "top");
+	for (int i = 0; i < 3000; i++)
+		mov(a, r9, 123);
+	jmp(a, "top");
+	check(!a.err && a.cap >= a.ip && a.cap < 2*a.ip);
+	check(a.code[0] == 0x49 && a.code[29990] == 0x49 && a.code[29999] == 0x00);
+	expect(a, {0xe9, 0xcb, 0x8a, 0xff, 0xff});
+	clear(a);
+	check(a.backing == BackGrow && !a.code);
+	for (int i = 0; i < 500; i++)
+		mov(a, r9, 123);
+	check(!a.err && a.cap == 8192 && a.code[4990] == 0x49);
+	clear(a);
+}
+
+void testheap()
+{
+	using namespace amd64;
+	CodeHeap h;
+	init(h, 1);
+	Assembler a{};
+	nop(a);
+label(a, "f");
+	mov(a, eax, 42);
+	ret(a);
+	void *f = publish(h, a);
+	check(f && entry(a, f, "f") == (u8 *)f + 1 && !entry(a, f, "g"));
+	check(!memcmp(f, a.code, a.ip));
+#ifdef __x86_64__
+	check(((int(*)())entry(a, f, "f"))() == 42);
+#endif
+	rewind(a);
+	ret(a);
+	void *g = publish(h, a);
+	check(g && g != f);
+	retire(h, f);
+	retire(h, g);
+	void *k = publish(h, a);
+	check(k == f);
+	rewind(a);
+	jmp(a, "nowhere");
+	check(!publish(h, a));
+	clear(a);
+	clear(h);
+}
+
+void testelf()
+{
+	using namespace arm64;
+	Assembler a{};
+	LabelId end = new_label(a);
+	svc(a, 0);
+label(a, "f");
+	b(a, end);
+	ret(a);
+	int fd = memfd_create("elf", 0);
+	check(!write_elf(a, fd, EM_AARCH64, ET_REL)); // unresolved reference
+label(a, end);
+	check(write_elf(a, fd, EM_AARCH64, ET_REL));
+	u8 buf[1024];
+	u64 n = pread(fd, buf, sizeof(buf), 0);
+	Elf64_Ehdr *eh = (Elf64_Ehdr *)buf;
+	check(n > sizeof(*eh) && n < sizeof(buf) && !memcmp(eh->e_ident, ELFMAG, SELFMAG));
+	check(eh->e_type == ET_REL && eh->e_machine == EM_AARCH64 && eh->e_shoff + eh->e_shnum*sizeof(Elf64_Shdr) == n);
+	Elf64_Shdr *sh = (Elf64_Shdr *)(buf + eh->e_shoff);
+	check(sh[1].sh_size == 12 && !memcmp(buf + sh[1].sh_offset, a.code, 12));
+	Elf64_Sym *sym = (Elf64_Sym *)(buf + sh[2].sh_offset);
+	check(sh[2].sh_size == 3*sizeof(Elf64_Sym) && sym[2].st_value == 4);
+	check(!strcmp((char *)buf + sh[sh[2].sh_link].sh_offset + sym[2].st_name, "f"));
+	close(fd);
+	clear(a);
+}
+
+void testperf()
+{
+	using namespace amd64;
+	Perf p;
+	init(p, PerfMap|PerfDump);
+	check(p.mapfd >= 0 && p.dumpfd >= 0);
+	CodeHeap h;
+	init(h, 1);
+	h.perf = &p;
+	Assembler a{};
+	nop(a);
+label(a, "f");
+	ret(a);
+label(a, "g");
+	xor_(a, eax, eax);
+	ret(a);
+	u8 *code = (u8 *)publish(h, a);
+	char path[64], buf[256], want[256];
+	snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+	int fd = open(path, O_RDONLY);
+	buf[read(fd, buf, sizeof(buf) - 1)] = 0;
+	close(fd);
+	unlink(path);
+	snprintf(want, sizeof(want), "%lx 1 jit\n%lx 1 f\n%lx 3 g\n", (u64)code, (u64)code + 1, (u64)code + 2);
+	check(!strcmp(buf, want));
+	snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+	u64 n = pread(p.dumpfd, buf, sizeof(buf), 0);
+	unlink(path);
+	u32 *w = (u32 *)buf;
+	check(n == 40 + 3*56 + 4 + 2 + 2 + 1 + 1 + 3 && w[0] == 0x4a695444 && w[1] == 1 && w[2] == 40);
+	check(w[10] == 0 && w[11] == 56 + 4 + 1 && !strcmp(buf + 40 + 56, "jit") && (u8)buf[40 + 56 + 4] == 0x90);
+	clear(a);
+	clear(h);
+	clear(p);
+}
+
+void testgdb()
+{
+	using namespace amd64;
+	GdbJit g;
+	init(g);
+	CodeHeap h;
+	init(h, 1);
+	h.gdb = &g;
+	Assembler a{};
+label(a, "f");
+	ret(a);
+label(a, "g");
+	xor_(a, eax, eax);
+	ret(a);
+	u8 *f = (u8 *)publish(h, a);
+	rewind(a);
+label(a, "h");
+	ret(a);
+	u8 *hc = (u8 *)publish(h, a);
+	check(g.nfunc == 3);
+	jit_descriptor &d = __jit_debug_descriptor;
+	jit_code_entry *e = flush(g);
+	check(e && !g.nfunc && !flush(g));
+	check(d.version == 1 && d.action_flag == JIT_REGISTER_FN && d.first_entry == e && d.relevant_entry == e);
+	const Elf64_Ehdr *eh = (const Elf64_Ehdr *)e->symfile_addr;
+	check(!memcmp(eh->e_ident, ELFMAG, SELFMAG) && eh->e_type == ET_REL);
+	const Elf64_Shdr *sh = (const Elf64_Shdr *)(e->symfile_addr + eh->e_shoff);
+	check(sh[1].sh_type == SHT_NOBITS && sh[1].sh_addr == (u64)f && sh[1].sh_size == (u64)(hc + 1 - f));
+	const Elf64_Sym *sym = (const Elf64_Sym *)(e->symfile_addr + sh[2].sh_offset);
+	const char *str = e->symfile_addr + sh[3].sh_offset;
+	check(sh[2].sh_size == 5*sizeof(Elf64_Sym));
+	for (u32 i = 2; i < 5; i++) {
+		const char *n = str + sym[i].st_name;
+		u64 addr = (u64)f + sym[i].st_value;
+		check(ELF64_ST_TYPE(sym[i].st_info) == STT_FUNC);
+		check((!strcmp(n, "f") && addr == (u64)f && sym[i].st_size == 1) ||
+		      (!strcmp(n, "g") && addr == (u64)f + 1 && sym[i].st_size == 3) ||
+		      (!strcmp(n, "h") && addr == (u64)hc && sym[i].st_size == 1));
+	}
+	publish(h, a);
+	jit_code_entry *e2 = flush(g);
+	check(d.first_entry == e2 && e2->next_entry == e && e->prev_entry == e2);
+	unregister(e);
+	check(d.action_flag == JIT_UNREGISTER_FN && d.first_entry == e2 && !e2->next_entry);
+	unregister(e2);
+	check(!d.first_entry);
 	clear(a);
+	clear(h);
+	clear(g);
 }
 
 int main()
 {
 	printf("testing amd64\n");
 	testamd64();
+	printf("testing avx\n");
+	testavx();
+	printf("testing shortest encodings\n");
+	testshort();
+	printf("testing peephole\n");
+	testpeep();
 	printf("testing arm64\n");
 	testarm64();
+	printf("testing arm64 constants\n");
+	testmovimm();
+	printf("testing literal pools\n");
+	testpool();
+	printf("testing rip relative operands\n");
+	testrip();
+	printf("testing macro assembler\n");
+	testmasm();
+	printf("testing ir\n");
+	testir();
+	printf("testing neon\n");
+	testneon();
+	printf("testing arm64 loads and stores\n");
+	testldst();
+	printf("testing stencil\n");
+	teststencil();
+	printf("testing stencil library\n");
+	testlib();
+	printf("testing anonymous labels\n");
+	testanon();
+	printf("testing relaxation\n");
+	testrelax();
+	printf("testing alignment\n");
+	testalign();
+	printf("testing batched fixups\n");
+	testbatch();
+	printf("testing rewind\n");
+	testrewind();
+	printf("testing backing modes\n");
+	testbacking();
+	printf("testing elf\n");
+	testelf();
+	printf("testing code heap\n");
+	testheap();
+	printf("testing perf\n");
+	testperf();
+	printf("testing gdb\n");
+	testgdb();
 	printf("all passed\n");
 	return 0;
 }